@@ -0,0 +1,397 @@
+#include <UT/UT_Assert.h>
+#include <UT/UT_FileUtil.h>
+#include <UT/UT_String.h>
+
+#include "CaptureFile.h"
+#include "CaptureTable.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace AKA;
+
+namespace
+{
+
+enum CaptureFileSection
+{
+	theBindingCountsSection,
+	theRestPSection,
+	theXformSection,
+	theInstancesSection,
+	thePrimsSection,
+	theUVsSection,
+	theWeightsSection,
+	theCornerCountsSection,
+	theCornerPtsSection,
+	theCornerWeightsSection,
+	theReferencedPrimsSection,
+	theQRestPSection,
+	theQXformSection,
+	theQRestPScalesSection,
+	theQUVsSection,
+	theQWeightsSection,
+	theQCornerCountsSection,
+	theQCornerWeightsSection,
+	theNumSections
+};
+
+constexpr char theMagic[8] = { 'A', 'K', 'A', 'C', 'A', 'P', 'T', '\0' };
+constexpr uint32 theByteOrder = 0x01020304;
+constexpr uint32 theXformFlag = 1;
+constexpr uint32 theQuantizedFlag = 2;
+constexpr uint32 theInstancedFlag = 4;
+constexpr int64 theSectionAlignment = 64;
+
+struct CaptureFileHeader
+{
+	char Magic[8];
+	uint32 Version;
+	uint32 ByteOrder;
+	int64 NumPointOffsets;
+	int64 Stride;
+	int64 CornerStride;
+	int64 NumReferencedPrims;
+	uint32 Flags;
+	fpreal32 QuantizeError;
+	uint64 TopologyFingerprint;
+	uint64 InputsFingerprint;
+	int64 SectionOffsets[theNumSections];
+	int64 SectionSizes[theNumSections];
+};
+
+inline int64
+alignSection(int64 offset)
+{
+	return (offset + theSectionAlignment - 1) / theSectionAlignment * theSectionAlignment;
+}
+
+// Calls f(section, array) for every array of the table.
+template<typename TABLE, typename F>
+void
+forEachSection(TABLE &table, const F &f)
+{
+	f(theBindingCountsSection, table.BindingCounts);
+	f(theRestPSection, table.RestP);
+	f(theXformSection, table.Xform);
+	f(theInstancesSection, table.Instances);
+	f(thePrimsSection, table.Prims);
+	f(theUVsSection, table.UVs);
+	f(theWeightsSection, table.Weights);
+	f(theCornerCountsSection, table.CornerCounts);
+	f(theCornerPtsSection, table.CornerPts);
+	f(theCornerWeightsSection, table.CornerWeights);
+	f(theReferencedPrimsSection, table.ReferencedPrims);
+	f(theQRestPSection, table.QRestP);
+	f(theQXformSection, table.QXform);
+	f(theQRestPScalesSection, table.QRestPScales);
+	f(theQUVsSection, table.QUVs);
+	f(theQWeightsSection, table.QWeights);
+	f(theQCornerCountsSection, table.QCornerCounts);
+	f(theQCornerWeightsSection, table.QCornerWeights);
+}
+
+// Number of elements every section of a table with the header's layout holds.
+void
+sectionEntries(const CaptureFileHeader &header, int64 entries[theNumSections])
+{
+	const int64 numbindings = header.NumPointOffsets * header.Stride;
+	const int64 numcorners = numbindings * header.CornerStride;
+	const int64 numpages = (header.NumPointOffsets + GA_PAGE_SIZE - 1) / GA_PAGE_SIZE;
+	const bool quantized = (header.Flags & theQuantizedFlag) != 0;
+
+	entries[theBindingCountsSection] = header.NumPointOffsets;
+	entries[theRestPSection] = quantized ? 0 : header.NumPointOffsets;
+	entries[theXformSection] = !quantized && (header.Flags & theXformFlag) ? header.NumPointOffsets : 0;
+	entries[theInstancesSection] = header.Flags & theInstancedFlag ? header.NumPointOffsets : 0;
+	entries[thePrimsSection] = numbindings;
+	entries[theUVsSection] = quantized ? 0 : numbindings;
+	entries[theWeightsSection] = quantized ? 0 : numbindings;
+	entries[theCornerCountsSection] = !quantized && header.CornerStride ? numbindings : 0;
+	entries[theCornerPtsSection] = numcorners;
+	entries[theCornerWeightsSection] = quantized ? 0 : numcorners;
+	entries[theReferencedPrimsSection] = header.NumReferencedPrims;
+	entries[theQRestPSection] = quantized ? header.NumPointOffsets : 0;
+	entries[theQXformSection] = quantized && (header.Flags & theXformFlag) ? header.NumPointOffsets : 0;
+	entries[theQRestPScalesSection] = quantized ? numpages : 0;
+	entries[theQUVsSection] = quantized ? numbindings : 0;
+	entries[theQWeightsSection] = quantized && header.Stride > 1 ? numbindings : 0;
+	entries[theQCornerCountsSection] = quantized && header.CornerStride ? numbindings : 0;
+	entries[theQCornerWeightsSection] = quantized ? numcorners : 0;
+}
+
+} // end anonymous namespace
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool
+MappedFile::open(const char *filename)
+{
+	close();
+
+#ifdef _WIN32
+	// sharing the delete access lets a writer rename a new capture over the
+	// file while it is mapped here
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	myFile = file;
+
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file, &filesize) || !filesize.QuadPart)
+	{
+		close();
+		return false;
+	}
+	mySize = exint(filesize.QuadPart);
+
+	myMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (myMapping)
+		myData = MapViewOfFile(myMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	myFd = ::open(filename, O_RDONLY);
+	if (myFd < 0)
+		return false;
+
+	struct stat filestat;
+	if (fstat(myFd, &filestat) || !filestat.st_size)
+	{
+		close();
+		return false;
+	}
+	mySize = exint(filestat.st_size);
+
+	void *data = mmap(nullptr, size_t(mySize), PROT_READ, MAP_SHARED, myFd, 0);
+	if (data != MAP_FAILED)
+		myData = data;
+#endif
+
+	if (!myData)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void
+MappedFile::close()
+{
+#ifdef _WIN32
+	if (myData)
+		UnmapViewOfFile(myData);
+	if (myMapping)
+		CloseHandle(myMapping);
+	if (myFile)
+		CloseHandle(myFile);
+	myMapping = nullptr;
+	myFile = nullptr;
+#else
+	if (myData)
+		munmap(myData, size_t(mySize));
+	if (myFd >= 0)
+		::close(myFd);
+	myFd = -1;
+#endif
+	myData = nullptr;
+	mySize = 0;
+}
+
+bool
+CaptureFile::write(const char *filename, 
+				   const CaptureTable &table, 
+				   const CaptureFileFingerprint &fingerprint, 
+				   UT_WorkBuffer &error)
+{
+	CaptureFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, theMagic, sizeof(theMagic));
+	header.Version = theVersion;
+	header.ByteOrder = theByteOrder;
+	header.NumPointOffsets = int64(table.NumPointOffsets);
+	header.Stride = int64(table.Stride);
+	header.CornerStride = int64(table.CornerStride);
+	header.NumReferencedPrims = int64(table.ReferencedPrims.size());
+	header.Flags = (table.HasXform ? theXformFlag : 0) | (table.Quantized ? theQuantizedFlag : 0) | 
+		(table.Instanced ? theInstancedFlag : 0);
+	header.QuantizeError = table.QuantizeError;
+	header.TopologyFingerprint = uint64(fingerprint.Topology);
+	header.InputsFingerprint = uint64(fingerprint.Inputs);
+
+	// a quantized table may still hold its float arrays, only the arrays
+	// of the layout are written
+	int64 entries[theNumSections];
+	sectionEntries(header, entries);
+
+	int64 offset = alignSection(sizeof(CaptureFileHeader));
+	forEachSection(table, [&](int section, const auto &array)
+	{
+		UT_ASSERT(array.size() >= entries[section]);
+		header.SectionOffsets[section] = offset;
+		header.SectionSizes[section] = entries[section] * int64(sizeof(array[0]));
+		offset = alignSection(offset + header.SectionSizes[section]);
+	});
+
+	// the default path is in a directory of the hip file nothing else makes
+	UT_String dir, file_name;
+	UT_String(filename).splitPath(dir, file_name);
+	if (dir.isstring() && !UT_FileUtil::makeDirs(dir.c_str()))
+	{
+		error.sprintf("Cannot create the directory of the capture file %s!\n", filename);
+		return false;
+	}
+
+	// write next to the file and rename it over, so processes mapping the
+	// old file keep a consistent copy. The temporary name is unique to the
+	// process and write, farm processes may write the same capture at once.
+	static std::atomic<int64> theTmpCount(0);
+#ifdef _WIN32
+	const int64 pid = int64(GetCurrentProcessId());
+#else
+	const int64 pid = int64(getpid());
+#endif
+	UT_WorkBuffer tmpname;
+	tmpname.sprintf("%s.%" SYS_PRId64 ".%" SYS_PRId64 ".tmp", filename, pid, int64(theTmpCount++));
+	{
+		std::ofstream file(tmpname.buffer(), std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			error.sprintf("Cannot write the capture file %s!\n", filename);
+			return false;
+		}
+
+		const char padding[theSectionAlignment] = {};
+		int64 written = sizeof(CaptureFileHeader);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(CaptureFileHeader));
+		forEachSection(table, [&](int section, const auto &array)
+		{
+			file.write(padding, header.SectionOffsets[section] - written);
+			file.write(reinterpret_cast<const char *>(array.array()), header.SectionSizes[section]);
+			written = header.SectionOffsets[section] + header.SectionSizes[section];
+		});
+
+		if (!file)
+		{
+			file.close();
+			std::remove(tmpname.buffer());
+			error.sprintf("Cannot write the capture file %s!\n", filename);
+			return false;
+		}
+	}
+
+#ifdef _WIN32
+	if (!MoveFileExA(tmpname.buffer(), filename, MOVEFILE_REPLACE_EXISTING))
+#else
+	if (std::rename(tmpname.buffer(), filename))
+#endif
+	{
+		std::remove(tmpname.buffer());
+		error.sprintf("Cannot write the capture file %s!\n", filename);
+		return false;
+	}
+	return true;
+}
+
+bool
+CaptureFile::read(const char *filename, 
+				  CaptureTable &table, 
+				  const CaptureFileFingerprint &fingerprint, 
+				  const CaptureTableLimits &limits, 
+				  UT_WorkBuffer &error)
+{
+	UT_UniquePtr<MappedFile> file(new MappedFile);
+	if (!file->open(filename))
+	{
+		error.sprintf("Cannot open the capture file %s, capturing instead.\n", filename);
+		return false;
+	}
+
+	CaptureFileHeader header;
+	if (file->size() < exint(sizeof(CaptureFileHeader)))
+	{
+		error.sprintf("%s is not a capture file, capturing instead.\n", filename);
+		return false;
+	}
+	memcpy(&header, file->data(), sizeof(CaptureFileHeader));
+
+	if (memcmp(header.Magic, theMagic, sizeof(theMagic)) || header.ByteOrder != theByteOrder)
+	{
+		error.sprintf("%s is not a capture file, capturing instead.\n", filename);
+		return false;
+	}
+	if (header.Version != theVersion)
+	{
+		error.sprintf("Capture file %s has version %u, expected %u, capturing instead.\n", filename, header.Version, theVersion);
+		return false;
+	}
+	if (header.TopologyFingerprint != uint64(fingerprint.Topology))
+	{
+		error.sprintf("Capture file %s was written for a different rest lattice topology, capturing instead.\n", filename);
+		return false;
+	}
+	if (header.InputsFingerprint != uint64(fingerprint.Inputs))
+	{
+		error.sprintf("Capture file %s was written for different inputs or parameters, capturing instead.\n", filename);
+		return false;
+	}
+
+	int64 entries[theNumSections];
+	sectionEntries(header, entries);
+
+	bool valid = header.NumPointOffsets >= 0 && header.Stride > 0 && header.CornerStride >= 0 && header.NumReferencedPrims >= 0;
+	forEachSection(table, [&](int section, const auto &array)
+	{
+		const int64 offset = header.SectionOffsets[section];
+		const int64 size = header.SectionSizes[section];
+		valid = valid && offset % theSectionAlignment == 0 && offset >= int64(sizeof(CaptureFileHeader)) &&
+			size == entries[section] * int64(sizeof(array[0])) && offset + size <= int64(file->size());
+	});
+	if (!valid)
+	{
+		error.sprintf("Capture file %s is truncated or corrupt, capturing instead.\n", filename);
+		return false;
+	}
+
+	// point the table into the mapping, the file stays mapped for as long
+	// as the table uses it
+	table.clear();
+	table.NumPointOffsets = GA_Size(header.NumPointOffsets);
+	table.Stride = exint(header.Stride);
+	table.CornerStride = exint(header.CornerStride);
+	table.HasXform = (header.Flags & theXformFlag) != 0;
+	table.Quantized = (header.Flags & theQuantizedFlag) != 0;
+	table.Instanced = (header.Flags & theInstancedFlag) != 0;
+	table.QuantizeError = header.QuantizeError;
+	forEachSection(table, [&](int section, auto &array)
+	{
+		using ElementType = typename std::remove_reference<decltype(array[0])>::type;
+		ElementType *data = reinterpret_cast<ElementType *>(const_cast<char *>(file->data() + header.SectionOffsets[section]));
+		if (entries[section])
+			array.unsafeShareData(data, exint(entries[section]));
+	});
+	table.Mapping = std::move(file);
+
+	// the fingerprints don't cover the data, a flipped bit or a padded
+	// truncation would otherwise index out of bounds when deforming
+	if (!table.checkIndices(limits))
+	{
+		table.clear();
+		error.sprintf("Capture file %s holds bindings out of range of the rest lattice, capturing instead.\n", filename);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifndef __CaptureFile_h__
+#define __CaptureFile_h__
+
+#include <SYS/SYS_Hash.h>
+#include <UT/UT_WorkBuffer.h>
+
+namespace AKA
+{
+
+struct CaptureTable;
+struct CaptureTableLimits;
+
+// Read-only memory mapping of a whole file, shared with every process
+// mapping the same file through the page cache.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool open(const char *filename);
+	void close();
+
+	const char *data() const { return static_cast<const char *>(myData); }
+	exint size() const { return mySize; }
+
+private:
+	void *myData = nullptr;
+	exint mySize = 0;
+#ifdef _WIN32
+	void *myFile = nullptr;
+	void *myMapping = nullptr;
+#else
+	int myFd = -1;
+#endif
+};
+
+// What the bindings of a capture file were computed from, a file is only
+// used when both match the inputs of the cook.
+struct CaptureFileFingerprint
+{
+	bool operator==(const CaptureFileFingerprint &other) const
+	{
+		return Topology == other.Topology && Inputs == other.Inputs;
+	}
+
+	// point count and primitive vertex lists of the rest lattice
+	SYS_HashType Topology = 0;
+	// rest positions of both inputs, group and capture parameters
+	SYS_HashType Inputs = 0;
+};
+
+// Versioned binary file holding a capture table, all sections are aligned
+// so that a read maps the file and points the table into it without a copy.
+class CaptureFile
+{
+public:
+	static constexpr uint32 theVersion = 4;
+
+	static bool write(const char *filename, 
+					  const CaptureTable &table, 
+					  const CaptureFileFingerprint &fingerprint, 
+					  UT_WorkBuffer &error);
+	// The indices of the bindings are checked against the limits of the
+	// rest lattice before the mapping is used, a damaged file fails.
+	static bool read(const char *filename, 
+					 CaptureTable &table, 
+					 const CaptureFileFingerprint &fingerprint, 
+					 const CaptureTableLimits &limits, 
+					 UT_WorkBuffer &error);
+};
+
+} // end AKA
+
+#endif
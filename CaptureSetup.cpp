@@ -0,0 +1,174 @@
+#include <GA/GA_Handle.h>
+#include <GEO/GEO_PrimPoly.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_RayIntersect.h>
+#include <UT/UT_ParallelUtil.h>
+#include <SYS/SYS_Math.h>
+
+#include "CaptureSetup.h"
+#include "CaptureTable.h"
+#include "PackedLattice.h"
+#include "ThreadedPointDeform.h"
+#include "Timer.h"
+#include "Utils.h"
+
+namespace AKA
+{
+
+exint
+polygonCornerStride(const GU_Detail *gdp)
+{
+	if (gdp->countPrimitiveType(GA_PRIMPOLY) != gdp->getNumPrimitives())
+		return 0;
+
+	// open polygons interpolate along their edges, not over their
+	// interior, so every polygon has to be closed like in isTriangleMesh()
+	GA_Size max_vtxcount = 0;
+	const GA_Range primrange(gdp->getPrimitiveRange());
+	for (GA_Iterator primitr(primrange); !primitr.atEnd(); ++primitr)
+	{
+		const GA_Primitive *prim = gdp->getPrimitive(*primitr);
+		if (!static_cast<const GEO_PrimPoly *>(prim)->isClosed())
+			return 0;
+		max_vtxcount = SYSmax(max_vtxcount, prim->getVertexCount());
+	}
+
+	return SYSmin(exint(max_vtxcount), CaptureTable::theMaxCornerStride);
+}
+
+exint
+polygonCornerStride(const PackedLattice &lattice)
+{
+	exint max_stride = 0;
+	for (const PackedLattice::Shape &shape : lattice.Shapes)
+	{
+		const exint stride = polygonCornerStride(shape.Gdp);
+		if (!stride)
+			return 0;
+		max_stride = SYSmax(max_stride, stride);
+	}
+	return max_stride;
+}
+
+void
+acquireShapeRays(const PackedLattice &lattice,
+				 UT_Array<RayIntersectCache::Handle> &rays,
+				 UT_Array<GU_RayIntersect *> &instance_rays,
+				 CookStats &cook_stats)
+{
+	// the shapes are whole packed details, keyed like any other lattice
+	rays.setSize(lattice.Shapes.size());
+	UT_Array<uint8> built;
+	built.setSize(lattice.Shapes.size());
+	UTparallelForEachNumber(lattice.Shapes.size(), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint shape = r.begin(); shape != r.end(); ++shape)
+		{
+			const GU_Detail *shape_gdp = lattice.Shapes[shape].Gdp;
+			bool shape_built;
+			rays[shape] = RayIntersectCache::acquire(shape_gdp, nullptr, RayIntersectCache::key(shape_gdp), shape_built);
+			built[shape] = shape_built;
+		}
+	});
+	for (uint8 shape_built : built)
+		++(shape_built ? cook_stats.BVHsBuilt : cook_stats.BVHsShared);
+
+	instance_rays.setSizeNoInit(lattice.Instances.size());
+	for (exint instance = 0; instance < lattice.Instances.size(); ++instance)
+		instance_rays[instance] = rays[lattice.Instances[instance].Shape].get();
+}
+
+template<typename T, typename V>
+void
+constructRayGroups(const Gdps &gdps,
+				   V pieceattrib_h,
+				   V rest_prim_pieceattrib_h,
+				   const PackedLattice *rest_lattice,
+				   ThreadedPointDeform &threaded_ptdeform,
+				   UT_Array<RayIntersectCache::Handle> &rays,
+				   CookStats &cook_stats)
+{
+	Timer phase_timer;
+
+	MapPieceId<T> piece_ids;
+	UT_Array<GU_RayIntersect *> piece_rays;
+	if (rest_lattice)
+	{
+		// every instance is a piece, the first instance with a value takes
+		// the points of that value
+		int32 instance = 0;
+		for (GA_Iterator primitr(gdps.RestGdp->getPrimitiveRange()); !primitr.atEnd(); ++primitr, ++instance)
+			piece_ids.Map.emplace(rest_prim_pieceattrib_h.get(*primitr), instance);
+
+		acquireShapeRays(*rest_lattice, rays, piece_rays, cook_stats);
+		cook_stats.addPhaseTime(CookPhase::BVHBuild, phase_timer);
+	}
+	else
+	{
+		// intern the rest piece values into dense piece ids
+		UT_Array<GA_PrimitiveGroupUPtr> piece_grps;
+		GA_Offset start, end;
+		for (GA_Iterator primitr(gdps.RestGdp->getPrimitiveRange()); primitr.blockAdvance(start, end);)
+		{
+			for (GA_Offset primoff = start; primoff < end; ++primoff)
+			{
+				const T attrib_value = rest_prim_pieceattrib_h.get(primoff);
+				auto piece_it = piece_ids.Map.find(attrib_value);
+				int32 piece;
+				if (piece_it == piece_ids.Map.end())
+				{
+					piece = int32(piece_grps.size());
+					piece_ids.Map[attrib_value] = piece;
+					piece_grps.append(gdps.RestGdp->createDetachedPrimitiveGroup());
+				}
+				else
+					piece = piece_it->second;
+				piece_grps[piece]->addOffset(primoff);
+			}
+		}
+
+		// the piece ids follow the primitive order, so a piece is defined by the
+		// piece attribute and its index
+		const GA_Attribute *rest_pieceattrib = rest_prim_pieceattrib_h.getAttribute();
+		SYS_HashType pieceattrib_key = rest_pieceattrib->getName().hash();
+		SYShashCombine(pieceattrib_key, rest_pieceattrib->getDataId());
+
+		// the per piece BVHs are independent, fetch or build them in parallel
+		rays.setSize(piece_grps.size());
+		UT_Array<uint8> built;
+		built.setSize(piece_grps.size());
+		UTparallelForEachNumber(piece_grps.size(), [&](const UT_BlockedRange<exint> &r)
+		{
+			for (exint piece = r.begin(); piece != r.end(); ++piece)
+			{
+				SYS_HashType group_key = pieceattrib_key;
+				SYShashCombine(group_key, piece);
+				bool piece_built;
+				rays[piece] = RayIntersectCache::acquire(gdps.RestGdp, piece_grps[piece].get(), 
+														 RayIntersectCache::key(gdps.RestGdp, group_key), piece_built);
+				built[piece] = piece_built;
+			}
+		});
+		for (uint8 piece_built : built)
+			++(piece_built ? cook_stats.BVHsBuilt : cook_stats.BVHsShared);
+
+		cook_stats.addPhaseTime(CookPhase::BVHBuild, phase_timer);
+
+		piece_rays.setSizeNoInit(rays.size());
+		for (exint piece = 0; piece < rays.size(); ++piece)
+			piece_rays[piece] = rays[piece].get();
+	}
+
+	UT_Array<int32> point_pieces;
+	threaded_ptdeform.findPointPieces(pieceattrib_h, piece_ids, point_pieces);
+	threaded_ptdeform.captureByPieceAttrib(point_pieces, piece_rays);
+
+	cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+}
+
+template void constructRayGroups<int32, GA_ROHandleI>(const Gdps &, GA_ROHandleI, GA_ROHandleI, const PackedLattice *, 
+													ThreadedPointDeform &, UT_Array<RayIntersectCache::Handle> &, CookStats &);
+template void constructRayGroups<UT_StringHolder, GA_ROHandleS>(const Gdps &, GA_ROHandleS, GA_ROHandleS, const PackedLattice *, 
+																ThreadedPointDeform &, UT_Array<RayIntersectCache::Handle> &, CookStats &);
+
+} // end AKA
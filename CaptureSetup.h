@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef __CaptureSetup_h__
+#define __CaptureSetup_h__
+
+#include <GA/GA_Handle.h>
+#include <UT/UT_Array.h>
+#include "RayIntersectCache.h"
+
+class GU_Detail;
+class GU_RayIntersect;
+
+namespace AKA
+{
+
+struct CookStats;
+struct Gdps;
+struct PackedLattice;
+class ThreadedPointDeform;
+
+// Capture steps shared by the SOP and the benchmark, so both time the same
+// code.
+
+// Number of corner slots every binding needs to be deformed by a plain
+// gather, or 0 when the lattice has primitives other than closed polygons
+// and the bindings have to be evaluated through the primitives. The stride
+// is capped at quads, bindings to larger polygons have no corners and
+// are evaluated through their primitive, so a few n-gons don't inflate
+// the corners of every binding.
+exint polygonCornerStride(const GU_Detail *gdp);
+// Corner slots every binding to the shapes of a packed lattice needs.
+exint polygonCornerStride(const PackedLattice &lattice);
+
+// Fetches the BVH of every shape of a packed lattice from the shared
+// cache, the instances of a shape share it.
+void acquireShapeRays(const PackedLattice &lattice,
+					  UT_Array<RayIntersectCache::Handle> &rays,
+					  UT_Array<GU_RayIntersect *> &instance_rays,
+					  CookStats &cook_stats);
+
+// Fetches or builds a BVH per rest lattice piece, or per instance of a
+// packed lattice, and captures every point against the piece of its value.
+// The handles keep the BVHs alive. Instantiated for int and string pieces.
+template<typename T, typename V>
+void constructRayGroups(const Gdps &gdps,
+						V pieceattrib_h,
+						V rest_prim_pieceattrib_h,
+						const PackedLattice *rest_lattice,
+						ThreadedPointDeform &threaded_ptdeform,
+						UT_Array<RayIntersectCache::Handle> &rays,
+						CookStats &cook_stats);
+
+} // end AKA
+
+#endif
@@ -0,0 +1,501 @@
+#include "CaptureFile.h"
+#include "CaptureTable.h"
+
+#include <UT/UT_ParallelUtil.h>
+#include <SYS/SYS_Math.h>
+
+#include <atomic>
+#include <limits>
+
+using namespace AKA;
+
+namespace
+{
+
+// Calls f(array, other_array) for every array of the two tables.
+template<typename F>
+void
+forEachArray(CaptureTable &table, const CaptureTable &other, const F &f)
+{
+	f(table.BindingCounts, other.BindingCounts);
+	f(table.RestP, other.RestP);
+	f(table.Xform, other.Xform);
+	f(table.Instances, other.Instances);
+	f(table.Prims, other.Prims);
+	f(table.UVs, other.UVs);
+	f(table.Weights, other.Weights);
+	f(table.CornerCounts, other.CornerCounts);
+	f(table.CornerPts, other.CornerPts);
+	f(table.CornerWeights, other.CornerWeights);
+	f(table.ReferencedPrims, other.ReferencedPrims);
+	f(table.QRestP, other.QRestP);
+	f(table.QXform, other.QXform);
+	f(table.QRestPScales, other.QRestPScales);
+	f(table.QUVs, other.QUVs);
+	f(table.QWeights, other.QWeights);
+	f(table.QCornerCounts, other.QCornerCounts);
+	f(table.QCornerWeights, other.QCornerWeights);
+}
+
+// Calls f(array) for every array of the table.
+template<typename F>
+void
+forEachArray(CaptureTable &table, const F &f)
+{
+	forEachArray(table, table, [&](auto &array, const auto &) { f(array); });
+}
+
+// Quantizes non-negative weights to integers in [0, maxvalue] summing to
+// maxvalue, the rounding error is given to the largest weight.
+template<typename T>
+void
+quantizeWeights(const fpreal32 *weights, exint count, uint32 maxvalue, T *qweights)
+{
+	fpreal32 sum = 0.f;
+	for (exint i = 0; i < count; ++i)
+		sum += SYSmax(weights[i], 0.f);
+	if (sum <= 0.f)
+	{
+		for (exint i = 0; i < count; ++i)
+			qweights[i] = T(i == 0 ? maxvalue : 0);
+		return;
+	}
+
+	int64 qsum = 0;
+	exint largest = 0;
+	for (exint i = 0; i < count; ++i)
+	{
+		const fpreal32 weight = SYSmax(weights[i], 0.f) / sum;
+		qweights[i] = T(SYSclamp(int64(SYSrint(weight * maxvalue)), int64(0), int64(maxvalue)));
+		qsum += qweights[i];
+		if (weights[i] > weights[largest])
+			largest = i;
+	}
+	qweights[largest] = T(SYSclamp(int64(qweights[largest]) + int64(maxvalue) - qsum, int64(0), int64(maxvalue)));
+}
+
+} // end anonymous namespace
+
+CaptureTable::~CaptureTable()
+{
+	releaseMapping();
+}
+
+void
+CaptureTable::releaseMapping()
+{
+	if (!Mapping)
+		return;
+
+	forEachArray(*this, [](auto &array) { array.unsafeClearData(); });
+	Mapping.reset();
+}
+
+void
+CaptureTable::ownData()
+{
+	if (!Mapping)
+		return;
+
+	forEachArray(*this, [](auto &array)
+	{
+		auto owned(array);
+		array.unsafeClearData();
+		array = std::move(owned);
+	});
+	Mapping.reset();
+}
+
+void
+CaptureTable::copy(const CaptureTable &other)
+{
+	releaseMapping();
+
+	NumPointOffsets = other.NumPointOffsets;
+	Stride = other.Stride;
+	CornerStride = other.CornerStride;
+	HasXform = other.HasXform;
+	Instanced = other.Instanced;
+	Quantized = other.Quantized;
+	QuantizeError = other.QuantizeError;
+	// the copies own their data even when the other table is mapped
+	forEachArray(*this, other, [](auto &array, const auto &other_array) { array = other_array; });
+}
+
+void
+CaptureTable::reset(GA_Size numptoffsets, exint stride, exint cornerstride, bool xform_required, bool instanced)
+{
+	releaseMapping();
+
+	NumPointOffsets = numptoffsets;
+	Stride = stride;
+	CornerStride = cornerstride;
+	HasXform = xform_required;
+	Instanced = instanced;
+	clearQuantized();
+
+	const exint numbindings = exint(numptoffsets) * stride;
+	const exint numcorners = numbindings * cornerstride;
+
+	BindingCounts.setSizeNoInit(numptoffsets);
+	BindingCounts.constant(0);
+	RestP.setSizeNoInit(numptoffsets);
+	if (xform_required)
+		Xform.setSizeNoInit(numptoffsets);
+	else
+		Xform.setCapacity(0);
+	if (instanced)
+	{
+		Instances.setSizeNoInit(numptoffsets);
+		Instances.constant(-1);
+	}
+	else
+		Instances.setCapacity(0);
+
+	Prims.setSizeNoInit(numbindings);
+	UVs.setSizeNoInit(numbindings);
+	Weights.setSizeNoInit(numbindings);
+	if (cornerstride)
+	{
+		CornerCounts.setSizeNoInit(numbindings);
+		CornerPts.setSizeNoInit(numcorners);
+		CornerWeights.setSizeNoInit(numcorners);
+	}
+	else
+	{
+		CornerCounts.setCapacity(0);
+		CornerPts.setCapacity(0);
+		CornerWeights.setCapacity(0);
+	}
+	ReferencedPrims.clear();
+}
+
+void
+CaptureTable::resize(GA_Size numptoffsets)
+{
+	ownData();
+	dequantize();
+
+	const GA_Size old_numptoffsets = NumPointOffsets;
+	NumPointOffsets = numptoffsets;
+
+	const exint numbindings = exint(numptoffsets) * Stride;
+	const exint numcorners = numbindings * CornerStride;
+
+	BindingCounts.setSizeNoInit(numptoffsets);
+	for (exint ptoff = exint(old_numptoffsets); ptoff < exint(numptoffsets); ++ptoff)
+		BindingCounts[ptoff] = 0;
+	RestP.setSizeNoInit(numptoffsets);
+	if (HasXform)
+		Xform.setSizeNoInit(numptoffsets);
+	if (Instanced)
+	{
+		Instances.setSizeNoInit(numptoffsets);
+		for (exint ptoff = exint(old_numptoffsets); ptoff < exint(numptoffsets); ++ptoff)
+			Instances[ptoff] = -1;
+	}
+
+	Prims.setSizeNoInit(numbindings);
+	UVs.setSizeNoInit(numbindings);
+	Weights.setSizeNoInit(numbindings);
+	if (CornerStride)
+	{
+		CornerCounts.setSizeNoInit(numbindings);
+		CornerPts.setSizeNoInit(numcorners);
+		CornerWeights.setSizeNoInit(numcorners);
+	}
+}
+
+void
+CaptureTable::clear()
+{
+	releaseMapping();
+
+	NumPointOffsets = 0;
+	Stride = 0;
+	CornerStride = 0;
+	HasXform = false;
+	Instanced = false;
+	clearQuantized();
+
+	BindingCounts.setCapacity(0);
+	RestP.setCapacity(0);
+	Xform.setCapacity(0);
+	Instances.setCapacity(0);
+	Prims.setCapacity(0);
+	UVs.setCapacity(0);
+	Weights.setCapacity(0);
+	CornerCounts.setCapacity(0);
+	CornerPts.setCapacity(0);
+	CornerWeights.setCapacity(0);
+	ReferencedPrims.setCapacity(0);
+}
+
+void
+CaptureTable::buildReferencedPrims(GA_Size numprims)
+{
+	UT_Array<uint8> referenced;
+	referenced.setSizeNoInit(numprims);
+	referenced.constant(0);
+
+	for (exint ptoff = 0; ptoff < exint(NumPointOffsets); ++ptoff)
+	{
+		const exint binding_start = ptoff * Stride;
+		for (exint binding = binding_start; binding < binding_start + BindingCounts[ptoff]; ++binding)
+			referenced[Prims[binding]] = 1;
+	}
+
+	ReferencedPrims.clear();
+	for (exint primidx = 0; primidx < exint(numprims); ++primidx)
+	{
+		if (referenced[primidx])
+			ReferencedPrims.append(int32(primidx));
+	}
+}
+
+bool
+CaptureTable::checkIndices(const CaptureTableLimits &limits) const
+{
+	if (Instanced && Instances.size() != NumPointOffsets)
+		return false;
+	for (int32 primidx : ReferencedPrims)
+	{
+		if (primidx < 0 || primidx >= limits.NumPrims)
+			return false;
+	}
+
+	std::atomic<bool> valid(true);
+	UTparallelFor(UT_BlockedRange<exint>(0, exint(NumPointOffsets)), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint ptoff = r.begin(); ptoff != r.end() && valid.load(std::memory_order_relaxed); ++ptoff)
+		{
+			const int32 numbindings = BindingCounts[ptoff];
+			if (numbindings < 0 || numbindings > Stride)
+			{
+				valid = false;
+				return;
+			}
+			if (!numbindings)
+				continue;
+
+			exint numprims = limits.NumPrims;
+			exint numpoints = limits.NumPoints;
+			if (Instanced)
+			{
+				const int32 instance = Instances[ptoff];
+				if (instance < 0 || instance >= limits.InstancePrims.size())
+				{
+					valid = false;
+					return;
+				}
+				numprims = limits.InstancePrims[instance];
+				numpoints = limits.InstancePoints[instance];
+			}
+
+			const exint binding_start = bindingStart(GA_Offset(ptoff));
+			for (exint binding = binding_start; binding < binding_start + numbindings; ++binding)
+			{
+				const int32 corner_count = CornerStride ? cornerCount(binding) : 0;
+				if (Prims[binding] < 0 || Prims[binding] >= numprims || corner_count < 0 || corner_count > CornerStride)
+				{
+					valid = false;
+					return;
+				}
+
+				const exint corner_start = cornerStart(binding);
+				for (exint corner = corner_start; corner < corner_start + corner_count; ++corner)
+				{
+					if (CornerPts[corner] < 0 || CornerPts[corner] >= numpoints)
+					{
+						valid = false;
+						return;
+					}
+				}
+			}
+		}
+	});
+	return valid;
+}
+
+int64
+CaptureTable::getMemoryUsage() const
+{
+	return BindingCounts.getMemoryUsage(false) +
+		RestP.getMemoryUsage(false) +
+		Xform.getMemoryUsage(false) +
+		Instances.getMemoryUsage(false) +
+		Prims.getMemoryUsage(false) +
+		UVs.getMemoryUsage(false) +
+		Weights.getMemoryUsage(false) +
+		CornerCounts.getMemoryUsage(false) +
+		CornerPts.getMemoryUsage(false) +
+		CornerWeights.getMemoryUsage(false) +
+		ReferencedPrims.getMemoryUsage(false) +
+		QRestP.getMemoryUsage(false) +
+		QXform.getMemoryUsage(false) +
+		QRestPScales.getMemoryUsage(false) +
+		QUVs.getMemoryUsage(false) +
+		QWeights.getMemoryUsage(false) +
+		QCornerCounts.getMemoryUsage(false) +
+		QCornerWeights.getMemoryUsage(false);
+}
+
+void
+CaptureTable::quantize()
+{
+	// the quantized corner counts are uint8, larger strides keep the full
+	// precision table
+	if (Quantized || CornerStride > std::numeric_limits<uint8>::max())
+		return;
+	ownData();
+
+	const exint numbindings = exint(NumPointOffsets) * Stride;
+	const exint numcorners = numbindings * CornerStride;
+	const exint numpages = (exint(NumPointOffsets) + GA_PAGE_SIZE - 1) / GA_PAGE_SIZE;
+
+	QRestP.setSizeNoInit(NumPointOffsets);
+	QXform.setSizeNoInit(HasXform ? NumPointOffsets : 0);
+	QRestPScales.setSizeNoInit(numpages);
+	QUVs.setSizeNoInit(numbindings);
+	QWeights.setSizeNoInit(Stride > 1 ? numbindings : 0);
+	QCornerCounts.setSizeNoInit(CornerStride ? numbindings : 0);
+	QCornerWeights.setSizeNoInit(numcorners);
+
+	// pages are independent, every page scales its rest positions to the
+	// int16 range of its largest component
+	UTparallelFor(UT_BlockedRange<exint>(0, numpages), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint page = r.begin(); page != r.end(); ++page)
+		{
+			const exint page_start = page * GA_PAGE_SIZE;
+			const exint page_end = SYSmin(page_start + GA_PAGE_SIZE, exint(NumPointOffsets));
+
+			fpreal32 max_abs = 0.f;
+			for (exint ptoff = page_start; ptoff < page_end; ++ptoff)
+			{
+				if (BindingCounts[ptoff])
+					max_abs = SYSmax(max_abs, SYSabs(RestP[ptoff][0]), SYSabs(RestP[ptoff][1]), SYSabs(RestP[ptoff][2]));
+			}
+			const fpreal32 scale = max_abs > 0.f ? max_abs / 32767.f : 1.f;
+			QRestPScales[page] = scale;
+
+			for (exint ptoff = page_start; ptoff < page_end; ++ptoff)
+			{
+				const int32 count = BindingCounts[ptoff];
+				for (int c = 0; c < 3; ++c)
+					QRestP[ptoff][c] = count ? int16(SYSclamp(int32(SYSrint(RestP[ptoff][c] / scale)), -32767, 32767)) : int16(0);
+				if (HasXform)
+				{
+					const UT_QuaternionF &quat = Xform[ptoff];
+					const fpreal32 components[4] = { quat.x(), quat.y(), quat.z(), quat.w() };
+					for (int c = 0; c < 4; ++c)
+						QXform[ptoff][c] = count ? int16(SYSclamp(int32(SYSrint(components[c] * 32767.f)), -32767, 32767)) : int16(0);
+				}
+
+				const exint binding_start = ptoff * Stride;
+				for (exint binding = binding_start; binding < binding_start + count; ++binding)
+				{
+					for (int c = 0; c < 2; ++c)
+						QUVs[binding][c] = uint16(SYSclamp(int32(SYSrint(UVs[binding][c] * 65535.f)), 0, 65535));
+
+					if (CornerStride)
+					{
+						const int32 corner_count = CornerCounts[binding];
+						QCornerCounts[binding] = uint8(corner_count);
+						quantizeWeights(CornerWeights.array() + binding * CornerStride, corner_count, 
+										65535, QCornerWeights.array() + binding * CornerStride);
+					}
+				}
+				if (Stride > 1)
+					quantizeWeights(Weights.array() + binding_start, count, 255, QWeights.array() + binding_start);
+			}
+		}
+	});
+
+	Quantized = true;
+}
+
+void
+CaptureTable::releaseUnquantized()
+{
+	if (!Quantized)
+		return;
+
+	RestP.setCapacity(0);
+	Xform.setCapacity(0);
+	UVs.setCapacity(0);
+	Weights.setCapacity(0);
+	CornerCounts.setCapacity(0);
+	CornerWeights.setCapacity(0);
+}
+
+void
+CaptureTable::discardQuantized()
+{
+	if (!Quantized || RestP.size() != exint(NumPointOffsets))
+		return;
+
+	clearQuantized();
+}
+
+void
+CaptureTable::dequantize()
+{
+	if (!Quantized)
+		return;
+	ownData();
+
+	const exint numbindings = exint(NumPointOffsets) * Stride;
+	const exint numcorners = numbindings * CornerStride;
+
+	RestP.setSizeNoInit(NumPointOffsets);
+	Xform.setSizeNoInit(HasXform ? NumPointOffsets : 0);
+	UVs.setSizeNoInit(numbindings);
+	Weights.setSizeNoInit(numbindings);
+	CornerCounts.setSizeNoInit(CornerStride ? numbindings : 0);
+	CornerWeights.setSizeNoInit(numcorners);
+
+	UTparallelForLightItems(UT_BlockedRange<exint>(0, exint(NumPointOffsets)), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint ptoff = r.begin(); ptoff != r.end(); ++ptoff)
+		{
+			RestP[ptoff] = restP(GA_Offset(ptoff));
+			if (HasXform && BindingCounts[ptoff])
+			{
+				const UT_FixedVector<int16, 4> &q = QXform[ptoff];
+				Xform[ptoff].assign(q[0] / 32767.f, q[1] / 32767.f, q[2] / 32767.f, q[3] / 32767.f);
+				Xform[ptoff].normalize();
+			}
+
+			const exint binding_start = ptoff * Stride;
+			for (exint binding = binding_start; binding < binding_start + BindingCounts[ptoff]; ++binding)
+			{
+				UVs[binding] = uv(binding);
+				Weights[binding] = weight(binding);
+				if (!CornerStride)
+					continue;
+
+				CornerCounts[binding] = cornerCount(binding);
+				const exint corner_start = binding * CornerStride;
+				for (exint corner = corner_start; corner < corner_start + CornerCounts[binding]; ++corner)
+					CornerWeights[corner] = cornerWeight(corner);
+			}
+		}
+	});
+
+	clearQuantized();
+}
+
+void
+CaptureTable::clearQuantized()
+{
+	Quantized = false;
+	QuantizeError = 0.f;
+	QRestP.setCapacity(0);
+	QXform.setCapacity(0);
+	QRestPScales.setCapacity(0);
+	QUVs.setCapacity(0);
+	QWeights.setCapacity(0);
+	QCornerCounts.setCapacity(0);
+	QCornerWeights.setCapacity(0);
+}
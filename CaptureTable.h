@@ -0,0 +1,196 @@
+#pragma once
+
+#ifndef __CaptureTable_h__
+#define __CaptureTable_h__
+
+#include <GA/GA_Types.h>
+#include <UT/UT_Array.h>
+#include <UT/UT_FixedVector.h>
+#include <UT/UT_Matrix3.h>
+#include <UT/UT_Quaternion.h>
+#include <UT/UT_UniquePtr.h>
+#include <UT/UT_Vector2.h>
+#include <UT/UT_Vector3.h>
+
+namespace AKA
+{
+
+class MappedFile;
+
+// Primitive and point counts the bindings may index, per instance for the
+// bindings to the shapes of a packed lattice.
+struct CaptureTableLimits
+{
+	exint NumPrims = 0;
+	exint NumPoints = 0;
+	UT_Array<exint> InstancePrims;
+	UT_Array<exint> InstancePoints;
+};
+
+// Flat capture bindings of the mesh to deform, indexed by point offset.
+// Every point owns a fixed-stride slot of Stride bindings in the per-binding
+// arrays, BindingCounts holds how many of them are in use.
+// For polygon lattices every binding also owns CornerStride corner slots
+// holding the lattice point indices of its polygon in vertex order and their
+// interpolation weights, so deforming is a plain gather and weighted sum.
+// CornerStride is at most theMaxCornerStride, bindings to polygons with
+// more corners have a corner count of 0 and are evaluated through their
+// primitive.
+// Bindings to a packed lattice are made in the space of the shape of the
+// instance in Instances, the primitive and point indices are the shape's.
+// The arrays may point into a mapped capture file instead of owning their
+// data, any modification takes a copy first.
+// A quantized table holds the rest positions, uvs and weights in the Q
+// arrays instead, they are read through the accessors in either state.
+struct CaptureTable
+{
+	// corner slots of a quad, all the batched deform handles
+	static constexpr exint theMaxCornerStride = 4;
+
+	CaptureTable() = default;
+	~CaptureTable();
+
+	CaptureTable(const CaptureTable &) = delete;
+	CaptureTable &operator=(const CaptureTable &) = delete;
+
+	// Deep copy of the other table, owning its data.
+	void copy(const CaptureTable &other);
+	void reset(GA_Size numptoffsets, exint stride, exint cornerstride, bool xform_required, bool instanced);
+	// Keeps the bindings of the existing point offsets, new points have none.
+	void resize(GA_Size numptoffsets);
+	void clear();
+	void buildReferencedPrims(GA_Size numprims);
+
+	// A table without the rest rotations the deform reads is not valid
+	// for it, whatever capture key it was made for.
+	bool isValid(GA_Size numptoffsets, bool xform_required) const
+	{
+		return Stride > 0 && NumPointOffsets == numptoffsets && (HasXform || !xform_required);
+	}
+	// Whether every binding, corner, instance and referenced primitive
+	// index is in range of the limits, so a table read from a damaged
+	// file can't index out of bounds.
+	bool checkIndices(const CaptureTableLimits &limits) const;
+	bool hasCorners() const { return CornerStride > 0; }
+	exint bindingStart(GA_Offset ptoff) const { return exint(ptoff) * Stride; }
+	exint cornerStart(exint binding) const { return binding * CornerStride; }
+	int64 getMemoryUsage() const;
+	bool isMapped() const { return Mapping != nullptr; }
+	// Copies the arrays out of the mapped capture file.
+	void ownData();
+
+	// Converts the bindings to the quantized storage: uvs and corner weights
+	// to normalized uint16, binding weights to uint8 renormalized to sum to
+	// one, rest rotations to int16 quaternions and rest positions to int16
+	// scaled per point page. Single binding
+	// tables store no binding weights. Tables with more than 255 corner
+	// slots are not quantized. The float arrays are kept until
+	// releaseUnquantized() so that discardQuantized() can revert it.
+	void quantize();
+	void releaseUnquantized();
+	void discardQuantized();
+	// Converts the quantized bindings back to the float arrays.
+	void dequantize();
+
+	UT_Vector3F restP(GA_Offset ptoff) const
+	{
+		if (!Quantized)
+			return RestP[ptoff];
+		const UT_FixedVector<int16, 3> &q = QRestP[ptoff];
+		const fpreal32 scale = QRestPScales[GAgetPageNum(ptoff)];
+		return UT_Vector3F(q[0] * scale, q[1] * scale, q[2] * scale);
+	}
+	// Inverse rest rotation of the point, only stored when HasXform.
+	UT_Matrix3F xform(GA_Offset ptoff) const
+	{
+		UT_QuaternionF quat;
+		if (Quantized)
+		{
+			const UT_FixedVector<int16, 4> &q = QXform[ptoff];
+			quat.assign(q[0] * theInt16Scale, q[1] * theInt16Scale, q[2] * theInt16Scale, q[3] * theInt16Scale);
+			quat.normalize();
+		}
+		else
+			quat = Xform[ptoff];
+
+		UT_Matrix3F rot;
+		quat.getRotationMatrix(rot);
+		return rot;
+	}
+	UT_Vector2F uv(exint binding) const
+	{
+		if (!Quantized)
+			return UVs[binding];
+		const UT_FixedVector<uint16, 2> &q = QUVs[binding];
+		return UT_Vector2F(q[0] * theUInt16Scale, q[1] * theUInt16Scale);
+	}
+	fpreal32 weight(exint binding) const
+	{
+		if (!Quantized)
+			return Weights[binding];
+		return Stride == 1 ? 1.f : QWeights[binding] * theUInt8Scale;
+	}
+	int32 cornerCount(exint binding) const
+	{
+		return Quantized ? int32(QCornerCounts[binding]) : CornerCounts[binding];
+	}
+	fpreal32 cornerWeight(exint corner) const
+	{
+		return Quantized ? QCornerWeights[corner] * theUInt16Scale : CornerWeights[corner];
+	}
+
+	GA_Size NumPointOffsets = 0;
+	exint Stride = 0;
+	exint CornerStride = 0;
+	bool HasXform = false;
+	bool Instanced = false;
+	bool Quantized = false;
+	// largest distance between a captured point and its rest position
+	// rebuilt from the quantized bindings
+	fpreal32 QuantizeError = 0.f;
+
+	// per point
+	UT_Array<int32> BindingCounts;
+	UT_Array<UT_Vector3F> RestP;
+	UT_Array<UT_QuaternionF> Xform;
+	// packed lattice instance of the bindings, only stored when Instanced
+	UT_Array<int32> Instances;
+
+	// per binding
+	UT_Array<int32> Prims;
+	UT_Array<UT_Vector2F> UVs;
+	UT_Array<fpreal32> Weights;
+	UT_Array<int32> CornerCounts;
+
+	// per binding corner
+	UT_Array<int32> CornerPts;
+	UT_Array<fpreal32> CornerWeights;
+
+	// sorted indices of the lattice primitives used by any binding
+	UT_Array<int32> ReferencedPrims;
+
+	// quantized per point, per point page and per binding
+	UT_Array<UT_FixedVector<int16, 3>> QRestP;
+	UT_Array<UT_FixedVector<int16, 4>> QXform;
+	UT_Array<fpreal32> QRestPScales;
+	UT_Array<UT_FixedVector<uint16, 2>> QUVs;
+	UT_Array<uint8> QWeights;
+	UT_Array<uint8> QCornerCounts;
+
+	// quantized per binding corner
+	UT_Array<uint16> QCornerWeights;
+
+	UT_UniquePtr<MappedFile> Mapping;
+
+private:
+	static constexpr fpreal32 theUInt16Scale = 1.f / 65535.f;
+	static constexpr fpreal32 theUInt8Scale = 1.f / 255.f;
+	static constexpr fpreal32 theInt16Scale = 1.f / 32767.f;
+
+	void releaseMapping();
+	void clearQuantized();
+};
+
+} // end AKA
+
+#endif
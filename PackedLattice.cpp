@@ -0,0 +1,273 @@
+#include <GA/GA_ATITopology.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_PrimPacked.h>
+#include <UT/UT_Map.h>
+#include <UT/UT_SmallArray.h>
+
+#include "PackedLattice.h"
+
+#include <algorithm>
+
+using namespace AKA;
+
+namespace
+{
+
+// instances per leaf of the bounds BVH
+constexpr exint theBoundsLeafSize = 4;
+
+inline fpreal32
+boundsDist2(const UT_BoundingBox &bounds, const UT_Vector3F &pos)
+{
+	fpreal32 dist2 = 0.f;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const fpreal32 d = SYSmax(bounds.getMin()[axis] - pos[axis], pos[axis] - bounds.getMax()[axis], 0.f);
+		dist2 += d * d;
+	}
+	return dist2;
+}
+
+} // end anonymous namespace
+
+bool
+PackedLattice::isPacked(const GU_Detail *gdp)
+{
+	if (!gdp->getNumPrimitives())
+		return false;
+
+	for (GA_Iterator primitr(gdp->getPrimitiveRange()); !primitr.atEnd(); ++primitr)
+	{
+		if (!GU_PrimPacked::isPackedPrimitive(gdp->getPrimitive(*primitr)->getTypeId()))
+			return false;
+	}
+	return true;
+}
+
+bool
+PackedLattice::build(const GU_Detail *gdp, UT_WorkBuffer &errmsg)
+{
+	Shapes.clear();
+	Instances.clear();
+	Instances.setCapacity(gdp->getNumPrimitives());
+
+	// instances sharing a packed detail share its shape
+	UT_Map<exint, int32> shape_ids;
+	for (GA_Iterator primitr(gdp->getPrimitiveRange()); !primitr.atEnd(); ++primitr)
+	{
+		const GA_Primitive *prim = gdp->getPrimitive(*primitr);
+		if (!GU_PrimPacked::isPackedPrimitive(prim->getTypeId()))
+		{
+			errmsg.sprintf("Primitive %" SYS_PRId64 " of the packed lattice is not a packed primitive!\n",
+						   int64(gdp->primitiveIndex(*primitr)));
+			return false;
+		}
+
+		const GU_PrimPacked *packed_prim = static_cast<const GU_PrimPacked *>(prim);
+		GU_ConstDetailHandle packed_gdh = packed_prim->getPackedDetail();
+		const GU_Detail *packed_gdp = packed_gdh.gdp();
+		if (!packed_gdp || !packed_gdp->getNumPrimitives())
+		{
+			errmsg.sprintf("Packed primitive %" SYS_PRId64 " has no geometry to deform by, unpack agents to packed geometry first!\n",
+						   int64(gdp->primitiveIndex(*primitr)));
+			return false;
+		}
+
+		Instance &instance = Instances[Instances.append()];
+		auto shape_it = shape_ids.find(packed_gdp->getUniqueId());
+		if (shape_it == shape_ids.end())
+		{
+			instance.Shape = int32(Shapes.size());
+			shape_ids[packed_gdp->getUniqueId()] = instance.Shape;
+
+			Shape &shape = Shapes[Shapes.append()];
+			shape.Handle = packed_gdh;
+			shape.Gdp = packed_gdp;
+			shape.Ph.bind(packed_gdp->getP());
+			shape.TopologyHash = topologyHash(packed_gdp);
+		}
+		else
+			instance.Shape = shape_it->second;
+
+		UT_Matrix4D xform;
+		packed_prim->getFullTransform4(xform);
+		instance.Xform = UT_Matrix4F(xform);
+		instance.InverseXform = instance.Xform;
+		instance.InverseXform.invert();
+
+		Shapes[instance.Shape].Gdp->getBBox(&instance.Bounds);
+		instance.Bounds.transform(instance.Xform);
+	}
+
+	myBoundsNodes.clear();
+	myInstanceOrder.setSizeNoInit(Instances.size());
+	for (exint idx = 0; idx < Instances.size(); ++idx)
+		myInstanceOrder[idx] = int32(idx);
+	if (Instances.size())
+	{
+		myBoundsNodes.append();
+		buildBoundsNode(0, 0, Instances.size());
+	}
+	return true;
+}
+
+void
+PackedLattice::buildBoundsNode(exint node, exint start, exint end)
+{
+	UT_BoundingBox bounds, centers;
+	bounds.initBounds();
+	centers.initBounds();
+	for (exint i = start; i < end; ++i)
+	{
+		const UT_BoundingBox &instance_bounds = Instances[myInstanceOrder[i]].Bounds;
+		bounds.enlargeBounds(instance_bounds);
+		centers.enlargeBounds(instance_bounds.center());
+	}
+	myBoundsNodes[node].Bounds = bounds;
+
+	if (end - start <= theBoundsLeafSize)
+	{
+		myBoundsNodes[node].Start = int32(start);
+		myBoundsNodes[node].Count = int32(end - start);
+		return;
+	}
+
+	// median split along the widest axis of the centers keeps the tree
+	// balanced for any instance layout
+	const UT_Vector3 size = centers.size();
+	const int axis = size[0] >= size[1] && size[0] >= size[2] ? 0 : size[1] >= size[2] ? 1 : 2;
+	const exint mid = (start + end) / 2;
+	std::nth_element(myInstanceOrder.array() + start, myInstanceOrder.array() + mid, myInstanceOrder.array() + end, 
+					 [&](int32 a, int32 b) { return Instances[a].Bounds.center()[axis] < Instances[b].Bounds.center()[axis]; });
+
+	const exint child = myBoundsNodes.size();
+	myBoundsNodes.append();
+	myBoundsNodes.append();
+	myBoundsNodes[node].Start = int32(child);
+	myBoundsNodes[node].Count = 0;
+	buildBoundsNode(child, start, mid);
+	buildBoundsNode(child + 1, mid, end);
+}
+
+SYS_HashType
+PackedLattice::topologyHash(const GU_Detail *gdp)
+{
+	SYS_HashType hash = 0;
+	SYShashCombine(hash, exint(gdp->getNumPoints()));
+	SYShashCombine(hash, exint(gdp->getNumPrimitives()));
+	for (GA_Iterator primitr(gdp->getPrimitiveRange()); !primitr.atEnd(); ++primitr)
+	{
+		const GA_Primitive *prim = gdp->getPrimitive(*primitr);
+		const GA_Size vtxcount = prim->getVertexCount();
+		SYShashCombine(hash, prim->getTypeId().get());
+		SYShashCombine(hash, exint(vtxcount));
+		for (GA_Size i = 0; i < vtxcount; ++i)
+			SYShashCombine(hash, exint(gdp->pointIndex(prim->getPointOffset(i))));
+	}
+	return hash;
+}
+
+bool
+PackedLattice::matches(const PackedLattice &other) const
+{
+	if (Instances.size() != other.Instances.size())
+		return false;
+
+	for (exint idx = 0; idx < Instances.size(); ++idx)
+	{
+		const Shape &shape = Shapes[Instances[idx].Shape];
+		const Shape &other_shape = other.Shapes[other.Instances[idx].Shape];
+		if (shape.Gdp != other_shape.Gdp && shape.TopologyHash != other_shape.TopologyHash)
+			return false;
+	}
+	return true;
+}
+
+exint
+PackedLattice::findInstance(const UT_Vector3F &pos) const
+{
+	exint nearest = -1;
+	fpreal32 nearest_dist2 = 0.f;
+	if (myBoundsNodes.isEmpty())
+		return nearest;
+
+	// the median splits keep the depth at log2 of the instance count
+	UT_SmallArray<int32, 64 * sizeof(int32)> stack;
+	stack.append(0);
+	while (stack.size())
+	{
+		const BoundsNode &node = myBoundsNodes[stack.last()];
+		stack.removeLast();
+		// nodes at the same distance may still hold a lower index
+		if (nearest >= 0 && boundsDist2(node.Bounds, pos) > nearest_dist2)
+			continue;
+
+		if (node.Count)
+		{
+			for (exint i = node.Start; i < node.Start + node.Count; ++i)
+			{
+				const exint idx = myInstanceOrder[i];
+				const fpreal32 dist2 = boundsDist2(Instances[idx].Bounds, pos);
+				if (nearest < 0 || dist2 < nearest_dist2 || (dist2 == nearest_dist2 && idx < nearest))
+				{
+					nearest = idx;
+					nearest_dist2 = dist2;
+				}
+			}
+			continue;
+		}
+
+		// the nearer child is visited first
+		const fpreal32 dist2_0 = boundsDist2(myBoundsNodes[node.Start].Bounds, pos);
+		const fpreal32 dist2_1 = boundsDist2(myBoundsNodes[node.Start + 1].Bounds, pos);
+		const int32 first = dist2_0 <= dist2_1 ? node.Start : node.Start + 1;
+		stack.append(first == node.Start ? node.Start + 1 : node.Start);
+		stack.append(first);
+	}
+	return nearest;
+}
+
+SYS_HashType
+PackedLattice::dataHash() const
+{
+	SYS_HashType hash = 0;
+	for (const Shape &shape : Shapes)
+	{
+		SYShashCombine(hash, shape.Gdp->getUniqueId());
+		SYShashCombine(hash, shape.Gdp->getTopology().getPointRef()->getDataId());
+		SYShashCombine(hash, shape.Gdp->getPrimitiveList().getDataId());
+		SYShashCombine(hash, shape.Gdp->getP()->getDataId());
+	}
+	for (const Instance &instance : Instances)
+	{
+		SYShashCombine(hash, instance.Shape);
+		for (int i = 0; i < 16; ++i)
+			SYShashCombine(hash, instance.Xform.data()[i]);
+	}
+	return hash;
+}
+
+SYS_HashType
+PackedLattice::contentHash() const
+{
+	SYS_HashType hash = 0;
+	for (const Shape &shape : Shapes)
+	{
+		const GU_Detail *gdp = shape.Gdp;
+		SYShashCombine(hash, shape.TopologyHash);
+		for (GA_Iterator ptitr(gdp->getPointRange()); !ptitr.atEnd(); ++ptitr)
+		{
+			const UT_Vector3F pos = shape.Ph.get(*ptitr);
+			SYShashCombine(hash, pos.x());
+			SYShashCombine(hash, pos.y());
+			SYShashCombine(hash, pos.z());
+		}
+	}
+	for (const Instance &instance : Instances)
+	{
+		SYShashCombine(hash, instance.Shape);
+		for (int i = 0; i < 16; ++i)
+			SYShashCombine(hash, instance.Xform.data()[i]);
+	}
+	return hash;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#ifndef __PackedLattice_h__
+#define __PackedLattice_h__
+
+#include <GA/GA_Handle.h>
+#include <GU/GU_DetailHandle.h>
+#include <SYS/SYS_Hash.h>
+#include <UT/UT_Array.h>
+#include <UT/UT_BoundingBox.h>
+#include <UT/UT_Matrix4.h>
+#include <UT/UT_WorkBuffer.h>
+
+class GU_Detail;
+
+namespace AKA
+{
+
+// A lattice given as packed primitives, resolved without unpacking. Every
+// primitive is an instance of the packed detail it shares with the other
+// instances of the same shape, placed by the full transform of the
+// primitive. Bindings are computed against the shapes in their own space,
+// so all the instances of a shape share its BVH and rest frames.
+struct PackedLattice
+{
+	struct Shape
+	{
+		// keeps the packed detail alive, packed disk details load on demand
+		GU_ConstDetailHandle Handle;
+		const GU_Detail *Gdp = nullptr;
+		GA_ROHandleV3 Ph;
+		SYS_HashType TopologyHash = 0;
+	};
+
+	struct Instance
+	{
+		int32 Shape = -1;
+		UT_Matrix4F Xform;
+		UT_Matrix4F InverseXform;
+		// bounds of the shape placed by the instance
+		UT_BoundingBox Bounds;
+	};
+
+	// Whether every primitive of the detail is a packed primitive.
+	static bool isPacked(const GU_Detail *gdp);
+
+	// Resolves the shape and transform of every packed primitive in
+	// primitive order, fails when a primitive has no packed geometry.
+	bool build(const GU_Detail *gdp, UT_WorkBuffer &errmsg);
+
+	// Hash of the point count and the primitive types and vertex lists, in
+	// index order so it is stable across sessions.
+	static SYS_HashType topologyHash(const GU_Detail *gdp);
+
+	// Whether the instances of both lattices pair up in order with shapes
+	// of the same topology, the bindings of one then gather the same
+	// corners on the other.
+	bool matches(const PackedLattice &other) const;
+
+	// Index of the instance whose bounds are nearest to the position, the
+	// lowest one on ties. Walks a BVH over the instance bounds.
+	exint findInstance(const UT_Vector3F &pos) const;
+
+	// Changes with any edit to the shapes or the instance transforms
+	// within the session.
+	SYS_HashType dataHash() const;
+	// Hash of the shape topology and positions and of the instance
+	// transforms, stable across sessions.
+	SYS_HashType contentHash() const;
+
+	UT_Array<Shape> Shapes;
+	UT_Array<Instance> Instances;
+
+private:
+	// Leaves hold the instances [Start, Start + Count) of myInstanceOrder,
+	// inner nodes have their two children at Start.
+	struct BoundsNode
+	{
+		UT_BoundingBox Bounds;
+		int32 Start = 0;
+		int32 Count = 0;
+	};
+
+	void buildBoundsNode(exint node, exint start, exint end);
+
+	UT_Array<BoundsNode> myBoundsNodes;
+	UT_Array<int32> myInstanceOrder;
+};
+
+} // end AKA
+
+#endif
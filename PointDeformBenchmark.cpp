@@ -0,0 +1,412 @@
+#include <GA/GA_Handle.h>
+#include <GA/GA_SplittableRange.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_PrimPoly.h>
+#include <GU/GU_RayIntersect.h>
+#include <UT/UT_Thread.h>
+#include <SYS/SYS_Math.h>
+
+#include "CaptureSetup.h"
+#include "CaptureTable.h"
+#include "RayIntersectCache.h"
+#include "ThreadedPointDeform.h"
+#include "Timer.h"
+#include "Utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace AKA;
+
+// Headless capture/deform benchmark on synthetic geometry, runs the same
+// ThreadedPointDeform passes the SOP cooks, for a list of thread counts.
+//
+// usage: pointdeformbyprim_benchmark [-points N] [-polys M] [-pieces K]
+//            [-shape grid|sphere] [-multisample 0|1]
+//            [-pattern cross|tetrahedron|octahedron|icosahedron|fibonacci]
+//            [-samples S] [-drive 0|1] [-normals 0|1] [-quantize 0|1]
+//            [-order offset|morton|hilbert] [-iterations I] [-threads 1,2,4,...]
+
+namespace
+{
+
+struct BenchmarkOptions
+{
+	exint NumPoints = 1000000;
+	exint NumPolys = 10000;
+	exint NumPieces = 1;
+	bool Sphere = false;
+	bool MultiSamples = false;
+	SamplePattern Pattern = SamplePattern::Cross;
+	exint SampleCount = 8;
+	bool Drive = false;
+	bool Normals = false;
+	bool Quantize = false;
+	CaptureOrder Order = CaptureOrder::Offset;
+	exint Iterations = 5;
+	UT_Array<int> ThreadCounts;
+};
+
+fpreal32
+latticeHeight(fpreal32 x, fpreal32 z)
+{
+	return 0.2f * SYSsin(3.f * x) * SYScos(2.f * z);
+}
+
+UT_Vector3F
+latticeNormal(fpreal32 x, fpreal32 z)
+{
+	UT_Vector3F nrm(-0.6f * SYScos(3.f * x) * SYScos(2.f * z), 1.f, 0.4f * SYSsin(3.f * x) * SYSsin(2.f * z));
+	nrm.normalize();
+	return nrm;
+}
+
+exint
+pieceOf(fpreal32 x, exint numpieces)
+{
+	return SYSclamp(exint((x + 1.f) * 0.5f * numpieces), exint(0), numpieces - 1);
+}
+
+// Mesh to deform, a grid or a sphere of points inside the lattice bounds.
+void
+buildBase(GU_Detail &gdp, const BenchmarkOptions &opts)
+{
+	const GA_Offset start_ptoff = gdp.appendPointBlock(opts.NumPoints);
+	GA_RWHandleI piece_h(gdp.addIntTuple(GA_ATTRIB_POINT, "piece", 1));
+	GA_RWHandleV3 nrm_h;
+	if (opts.Normals)
+	{
+		GA_Attribute *nrm_attrib = gdp.addFloatTuple(GA_ATTRIB_POINT, "N", 3);
+		nrm_attrib->setTypeInfo(GA_TYPE_NORMAL);
+		nrm_h.bind(nrm_attrib);
+	}
+
+	const exint rows = SYSmax(exint(SYSsqrt(fpreal64(opts.NumPoints))), exint(1));
+	for (exint i = 0; i < opts.NumPoints; ++i)
+	{
+		UT_Vector3F pos;
+		if (opts.Sphere)
+		{
+			// Fibonacci sphere
+			const fpreal32 y = 1.f - 2.f * (fpreal32(i) + 0.5f) / opts.NumPoints;
+			const fpreal32 r = SYSsqrt(SYSmax(1.f - y * y, 0.f));
+			const fpreal32 phi = fpreal32(i) * 2.39996323f;
+			pos.assign(0.8f * r * SYScos(phi), 0.3f * y, 0.8f * r * SYSsin(phi));
+		}
+		else
+		{
+			const fpreal32 u = fpreal32(i % rows) / SYSmax(rows - 1, exint(1));
+			const fpreal32 v = fpreal32(i / rows) / SYSmax(rows - 1, exint(1));
+			pos.assign(1.9f * u - 0.95f, 0.1f, 1.9f * v - 0.95f);
+		}
+
+		const GA_Offset ptoff = start_ptoff + i;
+		gdp.setPos3(ptoff, pos);
+		piece_h.set(ptoff, int32(pieceOf(pos.x(), opts.NumPieces)));
+		if (nrm_h.isValid())
+			nrm_h.set(ptoff, UT_Vector3F(0.f, 1.f, 0.f));
+	}
+}
+
+// Quad lattice over [-1, 1] in XZ, flat for the rest and displaced by a
+// wave for the deformed stream.
+void
+buildLattice(GU_Detail &gdp, const BenchmarkOptions &opts, bool deformed)
+{
+	const exint cols = SYSmax(exint(SYSsqrt(fpreal64(opts.NumPolys))), exint(1));
+	const exint numpts_side = cols + 1;
+	const GA_Offset start_ptoff = gdp.appendPointBlock(numpts_side * numpts_side);
+
+	GA_RWHandleV3 nrm_h, up_h;
+	if (opts.Drive)
+	{
+		nrm_h.bind(gdp.addFloatTuple(GA_ATTRIB_POINT, "N", 3));
+		up_h.bind(gdp.addFloatTuple(GA_ATTRIB_POINT, "up", 3));
+	}
+
+	for (exint j = 0; j < numpts_side; ++j)
+	{
+		for (exint i = 0; i < numpts_side; ++i)
+		{
+			const fpreal32 x = 2.f * fpreal32(i) / cols - 1.f;
+			const fpreal32 z = 2.f * fpreal32(j) / cols - 1.f;
+			const GA_Offset ptoff = start_ptoff + j * numpts_side + i;
+			gdp.setPos3(ptoff, UT_Vector3F(x, deformed ? latticeHeight(x, z) : 0.f, z));
+			if (nrm_h.isValid())
+			{
+				nrm_h.set(ptoff, deformed ? latticeNormal(x, z) : UT_Vector3F(0.f, 1.f, 0.f));
+				up_h.set(ptoff, UT_Vector3F(1.f, 0.f, 0.f));
+			}
+		}
+	}
+
+	GA_RWHandleI piece_h(gdp.addIntTuple(GA_ATTRIB_PRIMITIVE, "piece", 1));
+	for (exint j = 0; j < cols; ++j)
+	{
+		for (exint i = 0; i < cols; ++i)
+		{
+			GU_PrimPoly *poly = GU_PrimPoly::build(&gdp, 4, false, false);
+			const GA_Offset corner = start_ptoff + j * numpts_side + i;
+			poly->setPointOffset(0, corner);
+			poly->setPointOffset(1, corner + numpts_side);
+			poly->setPointOffset(2, corner + numpts_side + 1);
+			poly->setPointOffset(3, corner + 1);
+
+			const fpreal32 x = 2.f * (fpreal32(i) + 0.5f) / cols - 1.f;
+			piece_h.set(poly->getMapOffset(), int32(pieceOf(x, opts.NumPieces)));
+		}
+	}
+}
+
+int64
+peakMemoryUsage()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return int64(counters.PeakWorkingSetSize);
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return int64(usage.ru_maxrss);
+#else
+	return int64(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+void
+capture(const Gdps &gdps, ThreadedPointDeform &threaded_ptdeform, const BenchmarkOptions &opts, CookStats &cook_stats)
+{
+	Timer phase_timer;
+	threaded_ptdeform.buildPrimFrames(gdps.RestGdp, false);
+	cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+
+	if (opts.NumPieces > 1)
+	{
+		// the same piece capture the SOP cooks, the BVHs are released with
+		// the handles so every iteration builds them again
+		UT_Array<RayIntersectCache::Handle> rays;
+		constructRayGroups<int32, GA_ROHandleI>(gdps, GA_ROHandleI(gdps.Gdp->findPointAttribute("piece")), 
+												GA_ROHandleI(gdps.RestGdp->findPrimitiveAttribute("piece")), 
+												nullptr, threaded_ptdeform, rays, cook_stats);
+		return;
+	}
+
+	GU_RayIntersect ray_rest(gdps.RestGdp, nullptr, true, false, true);
+	cook_stats.addPhaseTime(CookPhase::BVHBuild, phase_timer);
+	threaded_ptdeform.capture(&ray_rest);
+	cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+}
+
+bool
+parseOptions(int argc, char *argv[], BenchmarkOptions &opts)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value)
+			return false;
+
+		if (!strcmp(arg, "-points"))
+			opts.NumPoints = SYSmax(std::atoll(value), 1LL);
+		else if (!strcmp(arg, "-polys"))
+			opts.NumPolys = SYSmax(std::atoll(value), 1LL);
+		else if (!strcmp(arg, "-pieces"))
+			opts.NumPieces = SYSmax(std::atoll(value), 1LL);
+		else if (!strcmp(arg, "-shape"))
+			opts.Sphere = !strcmp(value, "sphere");
+		else if (!strcmp(arg, "-multisample"))
+			opts.MultiSamples = std::atoi(value) != 0;
+		else if (!strcmp(arg, "-pattern"))
+		{
+			if (!strcmp(value, "tetrahedron"))
+				opts.Pattern = SamplePattern::Tetrahedron;
+			else if (!strcmp(value, "octahedron"))
+				opts.Pattern = SamplePattern::Octahedron;
+			else if (!strcmp(value, "icosahedron"))
+				opts.Pattern = SamplePattern::Icosahedron;
+			else if (!strcmp(value, "fibonacci"))
+				opts.Pattern = SamplePattern::FibonacciHemisphere;
+			else
+				opts.Pattern = SamplePattern::Cross;
+		}
+		else if (!strcmp(arg, "-samples"))
+			opts.SampleCount = SYSmax(std::atoll(value), 1LL);
+		else if (!strcmp(arg, "-drive"))
+			opts.Drive = std::atoi(value) != 0;
+		else if (!strcmp(arg, "-normals"))
+			opts.Normals = std::atoi(value) != 0;
+		else if (!strcmp(arg, "-quantize"))
+			opts.Quantize = std::atoi(value) != 0;
+		else if (!strcmp(arg, "-order"))
+		{
+			if (!strcmp(value, "morton"))
+				opts.Order = CaptureOrder::Morton;
+			else if (!strcmp(value, "hilbert"))
+				opts.Order = CaptureOrder::Hilbert;
+			else
+				opts.Order = CaptureOrder::Offset;
+		}
+		else if (!strcmp(arg, "-iterations"))
+			opts.Iterations = SYSmax(std::atoll(value), 1LL);
+		else if (!strcmp(arg, "-threads"))
+		{
+			opts.ThreadCounts.clear();
+			for (const char *token = value; *token; )
+			{
+				opts.ThreadCounts.append(SYSmax(std::atoi(token), 1));
+				token = strchr(token, ',');
+				if (!token)
+					break;
+				++token;
+			}
+		}
+		else
+			return false;
+		++i;
+	}
+
+	if (opts.ThreadCounts.isEmpty())
+	{
+		for (int nthreads = 1; nthreads < UT_Thread::getNumProcessors(); nthreads *= 2)
+			opts.ThreadCounts.append(nthreads);
+		opts.ThreadCounts.append(UT_Thread::getNumProcessors());
+	}
+	return true;
+}
+
+} // end anonymous namespace
+
+int
+main(int argc, char *argv[])
+{
+	BenchmarkOptions opts;
+	if (!parseOptions(argc, argv, opts))
+	{
+		fprintf(stderr, "usage: %s [-points N] [-polys M] [-pieces K] [-shape grid|sphere] "
+				"[-multisample 0|1] [-pattern cross|tetrahedron|octahedron|icosahedron|fibonacci] [-samples S] [-drive 0|1] [-normals 0|1] [-quantize 0|1] [-order offset|morton|hilbert] [-iterations I] [-threads 1,2,4,...]\n", argv[0]);
+		return 1;
+	}
+
+	GU_Detail base_gdp, rest_gdp, deformed_gdp;
+	buildBase(base_gdp, opts);
+	buildLattice(rest_gdp, opts, false);
+	buildLattice(deformed_gdp, opts, true);
+
+	printf("points %" SYS_PRId64 ", lattice polys %" SYS_PRId64 ", pieces %" SYS_PRId64 ", shape %s, multisample %d, drive %d, normals %d, quantize %d\n",
+		   int64(opts.NumPoints), int64(rest_gdp.getNumPrimitives()), int64(opts.NumPieces), opts.Sphere ? "sphere" : "grid",
+		   int(opts.MultiSamples), int(opts.Drive), int(opts.Normals), int(opts.Quantize));
+	// per phase latencies are averaged over the iterations
+	// imbalance is the busiest capture thread over the average one
+	printf("%8s %14s %14s %10s %10s %10s %10s %12s %10s\n", "threads", "capture pts/s", "deform pts/s",
+		   "bvh ms", "capture ms", "deform ms", "ids ms", "table MB", "imbalance");
+
+	UT_Array<UT_StringHolder> attribnames_to_interpolate;
+	if (opts.Normals)
+		attribnames_to_interpolate.append("N"_sh);
+
+	for (int nthreads : opts.ThreadCounts)
+	{
+		UT_Thread::configureMaxThreads(nthreads);
+
+		GU_Detail gdp;
+		gdp.replaceWith(base_gdp);
+
+		Gdps gdps;
+		gdps.Gdp = &gdp;
+		gdps.BaseGdp = &base_gdp;
+		gdps.RestGdp = &rest_gdp;
+		gdps.DeformedGdp = &deformed_gdp;
+
+		DriveAttrib_Info drive_attrib_hs;
+		if (opts.Drive)
+		{
+			drive_attrib_hs.Drive = true;
+			drive_attrib_hs.RestNormal_H.bind(rest_gdp.findPointAttribute("N"));
+			drive_attrib_hs.RestUp_H.bind(rest_gdp.findPointAttribute("up"));
+			drive_attrib_hs.DeformedNormal_H.bind(deformed_gdp.findPointAttribute("N"));
+			drive_attrib_hs.DeformedUp_H.bind(deformed_gdp.findPointAttribute("up"));
+		}
+
+		CaptureAttributes_Info captureattribs_info;
+		captureattribs_info.Order = opts.Order;
+		captureattribs_info.CaptureMultiSamples = opts.MultiSamples && !opts.Drive;
+		if (captureattribs_info.CaptureMultiSamples)
+			ThreadedPointDeform::buildSampleDirs(opts.Pattern, opts.SampleCount, captureattribs_info.CaptureSampleDirs);
+		captureattribs_info.XformRequired = opts.Normals;
+
+		GA_SplittableRange ptrange(gdp.getPointRange());
+		CaptureTable capture_table;
+		CookStats cook_stats;
+		fpreal64 phase_times[int(CookPhase::NumPhases)] = {};
+		fpreal64 imbalance = 0.0;
+
+		for (exint iteration = 0; iteration < opts.Iterations; ++iteration)
+		{
+			cook_stats.beginCook();
+
+			capture_table.reset(gdp.getNumPointOffsets(), 1 + captureattribs_info.CaptureSampleDirs.size(), 
+								polygonCornerStride(&rest_gdp), captureattribs_info.XformRequired, false);
+			ThreadedPointDeform threaded_ptdeform(
+				gdps, &ptrange, &drive_attrib_hs, &captureattribs_info, &capture_table, &cook_stats, attribnames_to_interpolate);
+
+			capture(gdps, threaded_ptdeform, opts, cook_stats);
+			capture_table.buildReferencedPrims(rest_gdp.getNumPrimitives());
+
+			Timer phase_timer;
+			if (opts.Quantize)
+			{
+				capture_table.quantize();
+				capture_table.QuantizeError = threaded_ptdeform.measureCaptureError();
+				capture_table.releaseUnquantized();
+				cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+			}
+
+			threaded_ptdeform.buildPrimFrames(&deformed_gdp, true);
+			threaded_ptdeform.deform();
+			cook_stats.addPhaseTime(CookPhase::Deform, phase_timer);
+
+			gdp.getP()->bumpDataId();
+			for (const UT_StringHolder &attribname : attribnames_to_interpolate)
+				gdp.findPointAttribute(attribname)->bumpDataId();
+			cook_stats.addPhaseTime(CookPhase::DataIdBump, phase_timer);
+
+			// beginCook() resets the timings of every iteration
+			for (int phase = 0; phase < int(CookPhase::NumPhases); ++phase)
+				phase_times[phase] += cook_stats.PhaseTimes[phase] / opts.Iterations;
+
+			exint busy_threads;
+			fpreal64 min_busy, avg_busy, max_busy;
+			cook_stats.captureBusyTimes(busy_threads, min_busy, avg_busy, max_busy);
+			imbalance += (avg_busy > 0.0 ? max_busy / avg_busy : 1.0) / opts.Iterations;
+		}
+
+		const fpreal64 capture_time = phase_times[int(CookPhase::BVHBuild)] + phase_times[int(CookPhase::Capture)];
+		const fpreal64 deform_time = phase_times[int(CookPhase::Deform)];
+		printf("%8d %14.0f %14.0f %10.3f %10.3f %10.3f %10.3f %12.2f %10.2f\n", nthreads,
+			   capture_time > 0.0 ? opts.NumPoints / capture_time : 0.0,
+			   deform_time > 0.0 ? opts.NumPoints / deform_time : 0.0,
+			   phase_times[int(CookPhase::BVHBuild)] * 1e+3,
+			   phase_times[int(CookPhase::Capture)] * 1e+3,
+			   deform_time * 1e+3,
+			   phase_times[int(CookPhase::DataIdBump)] * 1e+3,
+			   capture_table.getMemoryUsage() / (1024.0 * 1024.0),
+			   imbalance);
+		if (opts.Quantize)
+			printf("%8s max quantize error %g\n", "", capture_table.QuantizeError);
+	}
+
+	printf("peak memory %.2f MB\n", peakMemoryUsage() / (1024.0 * 1024.0));
+	return 0;
+}
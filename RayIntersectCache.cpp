@@ -0,0 +1,224 @@
+#include <GA/GA_ATITopology.h>
+#include <GEO/GEO_PrimPoly.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_RayIntersect.h>
+#include <UT/UT_Lock.h>
+#include <UT/UT_Map.h>
+#include <UT/UT_ParallelUtil.h>
+#include <UT/UT_TaskLock.h>
+#include <UT/UT_Thread.h>
+#include <UT/UT_UniquePtr.h>
+#include <SYS/SYS_Math.h>
+
+#include "RayIntersectCache.h"
+#include "core/Bvh.h"
+#include "core/ThreadPool.h"
+#include <memory>
+#include <vector>
+
+using namespace AKA;
+
+namespace
+{
+
+struct RayIntersectEntry
+{
+	// held while a BVH is built, later holders of the entry wait on it. The
+	// builds run parallel loops, a task lock lets a waiting thread that
+	// stole a task of the build help it instead of blocking on itself.
+	UT_TaskLock BuildLock;
+	UT_UniquePtr<GU_RayIntersect> Ray;
+	UT_UniquePtr<Core::Bvh> Closest;
+};
+
+// Runs the core loops on the Houdini threads.
+class UTScheduler : public Core::Scheduler
+{
+public:
+	int numThreads() const override { return UT_Thread::getNumProcessors(); }
+
+	void parallelFor(int64_t size, int64_t grain, const Body &body) override
+	{
+		UTparallelFor(UT_BlockedRange<int64>(0, size, grain), [&](const UT_BlockedRange<int64> &r)
+		{
+			body(r.begin(), r.end());
+		});
+	}
+};
+
+struct RayIntersectKeyHash
+{
+	size_t operator()(const RayIntersectKey &key) const { return key.hash(); }
+};
+
+using RayIntersectMap = UT_Map<RayIntersectKey, std::weak_ptr<RayIntersectEntry>, RayIntersectKeyHash>;
+
+UT_Lock &
+cacheLock()
+{
+	static UT_Lock theLock;
+	return theLock;
+}
+
+RayIntersectMap &
+cacheMap()
+{
+	static RayIntersectMap theMap;
+	return theMap;
+}
+
+// map size at which the expired entries are dropped next
+exint thePurgeSize = 64;
+
+UT_SharedPtr<RayIntersectEntry>
+findEntry(const RayIntersectKey &key)
+{
+	UT_AutoLock lock(cacheLock());
+	RayIntersectMap &map = cacheMap();
+
+	// an expired entry of the key is replaced in place
+	UT_SharedPtr<RayIntersectEntry> entry;
+	auto it = map.find(key);
+	if (it != map.end())
+		entry = it->second.lock();
+	if (entry)
+		return entry;
+
+	entry.reset(new RayIntersectEntry);
+	map[key] = entry;
+
+	// drop the entries nobody holds anymore, their details may be gone.
+	// Purging only when the map doubled keeps the lookups amortized O(1)
+	// when thousands of pieces are acquired at once.
+	if (exint(map.size()) >= thePurgeSize)
+	{
+		for (auto purge_it = map.begin(); purge_it != map.end();)
+		{
+			if (purge_it->second.expired())
+				purge_it = map.erase(purge_it);
+			else
+				++purge_it;
+		}
+		thePurgeSize = SYSmax(exint(64), 2 * exint(map.size()));
+	}
+	return entry;
+}
+
+} // end namespace
+
+SYS_HashType
+RayIntersectKey::hash() const
+{
+	SYS_HashType hash = SYShash(DetailUniqueId);
+	SYShashCombine(hash, TopologyId);
+	SYShashCombine(hash, PrimitiveListId);
+	SYShashCombine(hash, PId);
+	SYShashCombine(hash, GroupKey);
+	return hash;
+}
+
+RayIntersectKey
+RayIntersectCache::key(const GU_Detail *gdp, SYS_HashType group_key)
+{
+	RayIntersectKey key;
+	key.DetailUniqueId = gdp->getUniqueId();
+	key.TopologyId = gdp->getTopology().getPointRef()->getDataId();
+	key.PrimitiveListId = gdp->getPrimitiveList().getDataId();
+	key.PId = gdp->getP()->getDataId();
+	key.GroupKey = group_key;
+	return key;
+}
+
+RayIntersectCache::Handle
+RayIntersectCache::acquire(const GU_Detail *gdp,
+						   const GA_PrimitiveGroup *group,
+						   const RayIntersectKey &key,
+						   bool &built)
+{
+	UT_SharedPtr<RayIntersectEntry> entry = findEntry(key);
+
+	// build outside of the cache lock, other lattices are not held up. The
+	// build is isolated so its thread only steals tasks of the build while
+	// it holds the lock.
+	UT_TaskLock::Scope build_lock(entry->BuildLock);
+	built = !entry->Ray;
+	if (built)
+		UTisolate([&] { entry->Ray.reset(new GU_RayIntersect(gdp, group, true, false, true)); });
+
+	// the handle shares the ownership of the entry
+	return Handle(entry, entry->Ray.get());
+}
+
+bool
+RayIntersectCache::isTriangleMesh(const GU_Detail *gdp)
+{
+	if (!gdp->getNumPrimitives())
+		return false;
+
+	for (GA_Iterator primitr(gdp->getPrimitiveRange()); !primitr.atEnd(); ++primitr)
+	{
+		const GA_Primitive *prim = gdp->getPrimitive(*primitr);
+		if (prim->getTypeId() != GA_PRIMPOLY || prim->getVertexCount() != 3 ||
+			!static_cast<const GEO_PrimPoly *>(prim)->isClosed())
+			return false;
+	}
+	return true;
+}
+
+RayIntersectCache::ClosestHandle
+RayIntersectCache::acquireClosest(const GU_Detail *gdp,
+								  const RayIntersectKey &key,
+								  bool &built)
+{
+	UT_SharedPtr<RayIntersectEntry> entry = findEntry(key);
+
+	UT_TaskLock::Scope build_lock(entry->BuildLock);
+	built = !entry->Closest;
+	if (built)
+	{
+		UTisolate([&]
+		{
+			// the core mesh indexes the points and primitives by GA_Index
+			std::vector<Core::Vec3> points(gdp->getNumPoints());
+			const GA_ROHandleV3 p_h(gdp->getP());
+			for (GA_Iterator ptitr(gdp->getPointRange()); !ptitr.atEnd(); ++ptitr)
+			{
+				const UT_Vector3F pos = p_h.get(*ptitr);
+				points[gdp->pointIndex(*ptitr)] = Core::Vec3(pos.x(), pos.y(), pos.z());
+			}
+
+			std::vector<int32_t> prim_starts(1, 0);
+			std::vector<int32_t> vertices;
+			prim_starts.reserve(gdp->getNumPrimitives() + 1);
+			vertices.reserve(gdp->getNumVertices());
+			for (GA_Index primidx = 0; primidx < GA_Index(gdp->getNumPrimitives()); ++primidx)
+			{
+				const GA_Primitive *prim = gdp->getPrimitiveByIndex(primidx);
+				for (GA_Size i = 0; i < prim->getVertexCount(); ++i)
+					vertices.push_back(int32_t(gdp->pointIndex(prim->getPointOffset(i))));
+				prim_starts.push_back(int32_t(vertices.size()));
+			}
+
+			Core::MeshView mesh;
+			mesh.Points = points;
+			mesh.PrimStarts = prim_starts;
+			mesh.Vertices = vertices;
+
+			UTScheduler scheduler;
+			entry->Closest.reset(new Core::Bvh);
+			entry->Closest->build(mesh, scheduler);
+		});
+	}
+
+	return ClosestHandle(entry, entry->Closest.get());
+}
+
+exint
+RayIntersectCache::size()
+{
+	UT_AutoLock lock(cacheLock());
+	exint size = 0;
+	for (const auto &it : cacheMap())
+		size += !it.second.expired();
+	return size;
+}
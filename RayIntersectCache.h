@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef __RayIntersectCache_h__
+#define __RayIntersectCache_h__
+
+#include <GA/GA_Types.h>
+#include <SYS/SYS_Hash.h>
+#include <UT/UT_SharedPtr.h>
+
+class GA_PrimitiveGroup;
+class GU_Detail;
+class GU_RayIntersect;
+
+namespace AKA
+{
+
+namespace Core
+{
+class Bvh;
+} // end Core
+
+// Identifies the BVH of a group of primitives of a lattice, the data ids
+// change with any edit to the points, primitives or positions.
+struct RayIntersectKey
+{
+	bool operator==(const RayIntersectKey &other) const
+	{
+		return DetailUniqueId == other.DetailUniqueId &&
+			TopologyId == other.TopologyId &&
+			PrimitiveListId == other.PrimitiveListId &&
+			PId == other.PId &&
+			GroupKey == other.GroupKey;
+	}
+
+	SYS_HashType hash() const;
+
+	exint DetailUniqueId = -1;
+	GA_DataId TopologyId = GA_INVALID_DATAID;
+	GA_DataId PrimitiveListId = GA_INVALID_DATAID;
+	GA_DataId PId = GA_INVALID_DATAID;
+	// 0 for the whole detail, otherwise whatever defines the group
+	SYS_HashType GroupKey = 0;
+};
+
+// Process-wide cache of the rest lattice BVHs, shared by every node
+// capturing against the same lattice. An entry lives as long as a handle to
+// it does, the nodes keep the handles of their last capture. An entry holds
+// the intersector and the closest point BVH of its lattice, each built on
+// first use.
+class RayIntersectCache
+{
+public:
+	using Handle = UT_SharedPtr<GU_RayIntersect>;
+	using ClosestHandle = UT_SharedPtr<const Core::Bvh>;
+
+	static RayIntersectKey key(const GU_Detail *gdp, SYS_HashType group_key = 0);
+
+	// Returns the BVH over the primitives of the group, building it if no
+	// handle to it is alive. Concurrent calls with the same key wait for the
+	// first one to build it, built tells whether this call did.
+	static Handle acquire(const GU_Detail *gdp,
+						  const GA_PrimitiveGroup *group,
+						  const RayIntersectKey &key,
+						  bool &built);
+
+	// Whether every primitive of the detail is a closed triangle, the only
+	// primitives the closest point BVH serves.
+	static bool isTriangleMesh(const GU_Detail *gdp);
+
+	// Returns the closest point BVH over all the primitives of a triangle
+	// mesh, shared like the intersectors.
+	static ClosestHandle acquireClosest(const GU_Detail *gdp,
+										const RayIntersectKey &key,
+										bool &built);
+
+	// Number of BVHs alive in the cache.
+	static exint size();
+};
+
+} // end AKA
+
+#endif
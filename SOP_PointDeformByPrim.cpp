@@ -1,21 +1,34 @@
 #include "SOP_PointDeformByPrim.h"
 #include "SOP_PointDeformByPrim.proto.h"
+#include "CaptureFile.h"
+#include "CaptureSetup.h"
+#include "CaptureTable.h"
+#include "PackedLattice.h"
+#include "RayIntersectCache.h"
+#include "Timer.h"
 #include "ThreadedPointDeform.h"
 #include "Utils.h"
 
 #include <SOP/SOP_NodeVerb.h>
+#include <CH/CH_Manager.h>
 #include <GU/GU_Detail.h>
+#include <GU/GU_DetailHandle.h>
 #include <DEP/DEP_MicroNode.h>
 #include <GU/GU_RayIntersect.h>
 #include <GA/GA_Handle.h>
+#include <OP/OP_NodeInfoParms.h>
 #include <OP/OP_Operator.h>
 #include <OP/OP_OperatorTable.h>
 #include <PRM/PRM_Include.h>
 #include <PRM/PRM_TemplateBuilder.h>
 #include <UT/UT_DSOVersion.h>
 #include <UT/UT_Interrupt.h>
+#include <UT/UT_ParallelUtil.h>
+#include <UT/UT_SharedPtr.h>
 #include <UT/UT_Assert.h>
 #include <UT/UT_SysSpecific.h>
+#include <UT/UT_UniquePtr.h>
+#include <SYS/SYS_Hash.h>
 #include <SYS/SYS_Math.h>
 
 
@@ -72,6 +85,17 @@ static const char* theDsFile = R"THEDSFILE(
         parmtag { "script_action_help" "Select geometry from an available viewport.\nShift-click to turn on Select Groups." }
         parmtag { "script_action_icon" "BUTTONS_reselect" }
         help    "Which points of the model (the first input) to capture and deform using the lattice. Leave this blank to deform all points in the first input. Click the Reselect button to the right to interactively select the points in the viewer."
+    }
+	parm {
+        name    "deformgroup"
+        cppname "DeformGroup"
+        label   "Deform Group"
+        type    string
+        default { "" }
+        parmtag { "script_action" "import soputils\nkwargs['geometrytype'] = (hou.geometryType.Points,)\nkwargs['inputindex'] = 0\nsoputils.selectgroup_parm(kwargs)" }
+        parmtag { "script_action_help" "Select geometry from an available viewport.\nShift-click to turn on Select Groups." }
+        parmtag { "script_action_icon" "BUTTONS_reselect" }
+        help    "Which of the captured points to deform, e.g. the visible pieces of a render time blast or every tenth point read by a collision proxy. Every point of the Group is still captured, so changing this group only deforms other points without capturing again. The points outside it keep their input position. Leave this blank to deform all the captured points."
     }
 	groupsimple {
         name    "capture_folder"
@@ -120,7 +144,36 @@ static const char* theDsFile = R"THEDSFILE(
 			default { "0" }
 			help    "Shooting multiple samples to find an average position based on weighted distance."
 
-			disablewhen "{ drivebyattribs == 1 }"
+			disablewhen "{ drivebyattribs == 1 } { radiuscapture == 1 }"
+		}
+		parm {
+			name    "samplepattern"
+			cppname "SamplePattern"
+			label   "Sample Pattern"
+			type    ordinal
+			default { "0" }
+			menu {
+				"cross"         "Opposite and Cross (5)"
+				"tetrahedron"   "Tetrahedron (4)"
+				"octahedron"    "Octahedron (6)"
+				"icosahedron"   "Icosahedron (12)"
+				"fibonacci"     "Fibonacci Hemisphere"
+			}
+			help    "Directions of the extra rays shot around every point, relative to the direction away from the nearest lattice position. More directions find more lattice positions at the cost of capture time."
+
+			disablewhen "{ multiplesamples == 0 } { drivebyattribs == 1 }"
+		}
+		parm {
+			name    "samplecount"
+			cppname "SampleCount"
+			label   "Sample Count"
+			type    integer
+			default { "8" }
+			range   { 1! 64 }
+			help    "Number of rays spread over the hemisphere facing away from the nearest lattice position."
+
+			disablewhen "{ multiplesamples == 0 } { drivebyattribs == 1 }"
+			hidewhen "{ samplepattern != fibonacci }"
 		}
 		parm {
             name    "mindistthresh"
@@ -133,6 +186,36 @@ static const char* theDsFile = R"THEDSFILE(
 
 			disablewhen "{ multiplesamples == 0 }"
         }
+		parm {
+			name    "radiuscapture"
+			cppname "RadiusCapture"
+			label   "Radius Capture"
+			type    toggle
+			default { "0" }
+			help    "Binds every point to the nearest primitives within the capture radius, weighted by a smooth distance falloff, instead of the single nearest one. Points with no primitive within the radius are left unbound and keep their position. Needs a rest lattice of triangles without a piece attribute."
+		}
+		parm {
+			name    "captureradius"
+			cppname "CaptureRadius"
+			label   "Capture Radius"
+			type    float
+			default { "0.1" }
+			range   { 0! 1 }
+			help    "Largest distance (Houdini world units) from a point to the primitives it is bound to."
+
+			disablewhen "{ radiuscapture == 0 }"
+		}
+		parm {
+			name    "maxbindings"
+			cppname "MaxBindings"
+			label   "Max Bindings"
+			type    integer
+			default { "4" }
+			range   { 1! 16! }
+			help    "Largest number of primitives a point is bound to, the capture memory per point grows with it."
+
+			disablewhen "{ radiuscapture == 0 }"
+		}
         parm {
             name    "pieceattrib"
             cppname "PieceAttrib"
@@ -141,6 +224,99 @@ static const char* theDsFile = R"THEDSFILE(
             default { "" }
 			help    "The name of a string or integer point attribute to use to treat the geometry as separate pieces. The attribute must be present on both the mesh and rest lattice. Points with the same value in this attribute are considered part of the same 'piece'. When you specify a valid piece attribute, this node deforms each piece using only the lattice points with the same piece value. \nThis lets you deform independent objects (pieces) in a single pass. You can create a piece attribute based on connectivity with the Connectivity SOP."
         }
+		parm {
+			name    "captureorder"
+			cppname "CaptureOrder"
+			label   "Capture Order"
+			type    ordinal
+			default { "0" }
+			menu {
+				"offset"    "Point Order"
+				"morton"    "Morton Curve"
+				"hilbert"   "Hilbert Curve"
+			}
+			help    "Order the points are captured in. Imported meshes often number their points in a spatially random order, so every nearest lattice search starts on cold memory. Sorting the points along a space filling curve of their positions makes neighbouring points capture one after another, and the nearest lattice position of a point bounds the search of the next one. The bindings are the same in every order."
+		}
+		parm {
+			name    "sepparm2"
+			cppname "SepParm2"
+			type    separator
+
+			default { "" }
+		}
+		parm {
+			name    "exportcapture"
+			cppname "ExportCapture"
+			label   "Export Capture Attributes"
+			type    toggle
+			default { "0" }
+			help    "Write the capture bindings to the __rest_p, __capture_prims, __capture_uvws, __capture_weights and __capture_xform point attributes for debugging. The deformation itself always reads the capture table held by the node."
+		}
+		parm {
+			name    "exportcookstats"
+			cppname "ExportCookStats"
+			label   "Export Cook Stats"
+			type    toggle
+			default { "0" }
+			help    "Write the per phase timings and capture counters of the cook to __cook_* detail attributes. The same stats are always shown in the node info, and appended as a line of JSON to the file named by the POINTDEFORMBYPRIM_PROFILE_JSON environment variable when it is set."
+		}
+		parm {
+			name    "sepparm3"
+			cppname "SepParm3"
+			type    separator
+
+			default { "" }
+		}
+		parm {
+			name    "capturefilemode"
+			cppname "CaptureFileMode"
+			label   "Capture File"
+			type    ordinal
+			default { "0" }
+			menu {
+				"none"  "No Capture File"
+				"read"  "Read Capture File"
+				"write" "Write Capture File"
+			}
+			help    "Read the capture from a file written by an earlier cook instead of capturing, or write the capture to a file. A file is only read when it was written for the same rest lattice topology, rest positions, group and capture parameters, otherwise the node captures and warns. The file is memory mapped, processes on the same machine share one copy of it."
+		}
+		parm {
+			name    "capturefile"
+			cppname "CaptureFile"
+			label   "Capture File Path"
+			type    file
+			default { "$HIP/capture/$OS.pdbpcap" }
+			parmtag { "filechooser_mode" "read_and_write" }
+			help    "The capture file to read or write."
+
+			disablewhen "{ capturefilemode == none }"
+		}
+		parm {
+			name    "sepparm4"
+			cppname "SepParm4"
+			type    separator
+
+			default { "" }
+		}
+		parm {
+			name    "quantizecapture"
+			cppname "QuantizeCapture"
+			label   "Quantize Capture"
+			type    toggle
+			default { "0" }
+			help    "Store the capture in a compact quantized form: uvs and corner weights as 16 bit, binding weights as 8 bit and rest positions as 16 bit integers scaled per block of points. Single sample captures store no binding weights. The largest position error it introduces is shown in the node info."
+		}
+		parm {
+			name    "quantizetolerance"
+			cppname "QuantizeTolerance"
+			label   "Quantize Tolerance"
+			type    float
+			default { "0.001" }
+			range   { 0! 0.01 }
+			help    "The largest distance between a rest point and its position rebuilt from the quantized capture. When the quantized capture exceeds it, the capture is kept in full precision and the node warns."
+
+			disablewhen "{ quantizecapture == 0 }"
+		}
 	}
 	groupsimple {
         name    "deform_folder"
@@ -152,8 +328,55 @@ static const char* theDsFile = R"THEDSFILE(
             label   "Attributes to Transform"
             type    string
             default { "*" }
-            help    "A space-separated list of attribute names/patterns, specifying which attributes are transformed by the deformation. The default is *, meaning all attributes. The node modifies vector attributes according to their type info, as points, vectors, or normals."
+            help    "A space-separated list of attribute names/patterns, specifying which attributes are transformed by the deformation. The default is *, meaning all attributes except rest, which has to be named to be deformed. The node modifies vector attributes according to their type info, as points, vectors, or normals."
         }
+		parm {
+			name    "rebuildxform"
+			cppname "RebuildXform"
+			label   "Rebuild Rest Rotations"
+			type    toggle
+			default { "0" }
+			help    "Rebuild the rest rotation of every point from its bindings when transforming attributes, instead of storing a quaternion per point in the capture. Saves the capture memory of the rotations for a second frame evaluation on the rest lattice per point and cook."
+		}
+	}
+	groupsimple {
+        name    "batch_folder"
+        label   "Batch Deform"
+
+		parm {
+			name    "batchrange"
+			cppname "BatchRange"
+			label   "Frame Range"
+			type    float
+			size    3
+			default { "$FSTART" "$FEND" "1" }
+			help    "The start frame, end frame and increment of the frames deformed by Deform Frame Range."
+		}
+		parm {
+			name    "framesperpass"
+			cppname "FramesPerPass"
+			label   "Frames per Pass"
+			type    integer
+			default { "8" }
+			range   { 1! 64 }
+			help    "The number of frames deformed per pass over the capture table. Every frame of a pass holds a copy of the mesh in memory."
+		}
+		parm {
+			name    "batchfile"
+			cppname "BatchFile"
+			label   "Output File"
+			type    file
+			default { "$HIP/geo/$OS.$F4.bgeo.sc" }
+			parmtag { "filechooser_mode" "write" }
+			help    "The file every deformed frame is saved to, evaluated at the time of the frame."
+		}
+		parm {
+			name    "deformframerange"
+			label   "Deform Frame Range"
+			type    button
+			default { "0" }
+			help    "Cooks the node at the current frame, then deforms the mesh by the deformed lattice of every frame in the range and saves the results. The capture is read once per pass for all the frames of the pass instead of once per frame. Press the button from Python, e.g. from a ROP's pre-render script, with hou.parm.pressButton()."
+		}
 	}
 }
 )THEDSFILE";
@@ -200,6 +423,30 @@ queryPointAttribMenu(void *data,
 			menu_entries, menu_size, GA_ATTRIB_POINT, 0, sopApproveVectorAttribs);
 }
 
+// Points of the capture group that are deformed, null when the deform
+// group is blank and the whole capture group is deformed.
+static GA_PointGroupUPtr
+parseDeformGroup(GOP_Manager &group_parser, 
+				 const GU_Detail *gdp, 
+				 const UT_StringHolder &deformgroup, 
+				 const GA_PointGroup *point_group, 
+				 bool &success)
+{
+	success = true;
+	if (!deformgroup)
+		return nullptr;
+
+	const GA_PointGroup *parsed_group = group_parser.parsePointDetached(deformgroup, gdp, false, success);
+	if (!parsed_group)
+		return nullptr;
+
+	GA_PointGroupUPtr deform_group = gdp->createDetachedPointGroup();
+	deform_group->combine(parsed_group);
+	if (point_group)
+		*deform_group &= *point_group;
+	return deform_group;
+}
+
 PRM_ChoiceList SOP_PointDeformByPrim::s_PieceAttribMenu(
     PRM_ChoiceListType::PRM_CHOICELIST_REPLACE, &queryPointAttribMenu);
 PRM_ChoiceList SOP_PointDeformByPrim::s_AttribsMenu(
@@ -214,6 +461,7 @@ SOP_PointDeformByPrim::buildTemplates()
 		templ.setChoiceListPtr("group", &SOP_Node::pointGroupMenu);
 		templ.setChoiceListPtr("pieceattrib", &SOP_PointDeformByPrim::s_PieceAttribMenu);
 		templ.setChoiceListPtr("attribs", &SOP_PointDeformByPrim::s_AttribsMenu);
+		templ.setCallback("deformframerange", &SOP_PointDeformByPrim::onDeformFrameRange);
 	}
 	return templ.templates();
 }
@@ -224,6 +472,111 @@ SOP_PointDeformByPrim::myConstructor(OP_Network *net, const char *name, OP_Opera
 	return new SOP_PointDeformByPrim(net, name, op);
 }
 
+struct SOP_PointDeformByPrimCaptureKey
+{
+	bool operator==(const SOP_PointDeformByPrimCaptureKey &other) const
+	{
+		return BaseUniqueId == other.BaseUniqueId &&
+			BaseNumPointOffsets == other.BaseNumPointOffsets &&
+			BaseTopologyId == other.BaseTopologyId &&
+			BasePId == other.BasePId &&
+			BasePieceId == other.BasePieceId &&
+			RestUniqueId == other.RestUniqueId &&
+			RestTopologyId == other.RestTopologyId &&
+			RestPrimitiveListId == other.RestPrimitiveListId &&
+			RestPId == other.RestPId &&
+			RestPieceId == other.RestPieceId &&
+			RestNormalId == other.RestNormalId &&
+			RestUpId == other.RestUpId &&
+			RestPackedHash == other.RestPackedHash &&
+			GroupHash == other.GroupHash &&
+			XformRequired == other.XformRequired &&
+			ParmsHash == other.ParmsHash;
+	}
+	bool operator!=(const SOP_PointDeformByPrimCaptureKey &other) const { return !(*this == other); }
+
+	// Whether the bindings captured for other can be kept for the points
+	// whose rest position and group membership did not change, i.e. only
+	// the positions, points or group of input 0 differ. Primitive pieces
+	// are promoted through the topology, so it has to match then.
+	bool allowsIncrementalCapture(const SOP_PointDeformByPrimCaptureKey &other) const
+	{
+		return (BasePieceId == GA_INVALID_DATAID || BaseTopologyId == other.BaseTopologyId) &&
+			BasePieceId == other.BasePieceId &&
+			RestUniqueId == other.RestUniqueId &&
+			RestTopologyId == other.RestTopologyId &&
+			RestPrimitiveListId == other.RestPrimitiveListId &&
+			RestPId == other.RestPId &&
+			RestPieceId == other.RestPieceId &&
+			RestNormalId == other.RestNormalId &&
+			RestUpId == other.RestUpId &&
+			RestPackedHash == other.RestPackedHash &&
+			XformRequired == other.XformRequired &&
+			ParmsHash == other.ParmsHash;
+	}
+
+	exint BaseUniqueId = -1;
+	GA_Size BaseNumPointOffsets = -1;
+	GA_DataId BaseTopologyId = GA_INVALID_DATAID;
+	GA_DataId BasePId = GA_INVALID_DATAID;
+	GA_DataId BasePieceId = GA_INVALID_DATAID;
+	exint RestUniqueId = -1;
+	GA_DataId RestTopologyId = GA_INVALID_DATAID;
+	GA_DataId RestPrimitiveListId = GA_INVALID_DATAID;
+	GA_DataId RestPId = GA_INVALID_DATAID;
+	GA_DataId RestPieceId = GA_INVALID_DATAID;
+	GA_DataId RestNormalId = GA_INVALID_DATAID;
+	GA_DataId RestUpId = GA_INVALID_DATAID;
+	// shapes and instance transforms of a packed rest lattice
+	SYS_HashType RestPackedHash = 0;
+	SYS_HashType GroupHash = 0;
+	bool XformRequired = false;
+	SYS_HashType ParmsHash = 0;
+};
+
+class SOP_PointDeformByPrimCache : public SOP_NodeCache
+{
+public:
+	SOP_PointDeformByPrimCache() : SOP_NodeCache() {}
+	virtual ~SOP_PointDeformByPrimCache() {}
+
+	SOP_PointDeformByPrimCaptureKey myCaptureKey;
+	// shared with the batch deform of a frame range, which only reads it
+	UT_SharedPtr<CaptureTable> myCaptureTable = UTmakeShared<CaptureTable>();
+	// capture file written for the current capture key
+	UT_StringHolder myWrittenCaptureFile;
+	// hash of the rest positions of the captured points of every point page
+	UT_Array<SYS_HashType> myPageHashes;
+	// rest lattice BVHs of the last capture, holding them keeps them in the
+	// shared cache for recaptures and other nodes on the same lattice
+	UT_Array<RayIntersectCache::Handle> myRays;
+	RayIntersectCache::ClosestHandle myClosestBvh;
+	CookStats myCookStats;
+	// deform settings of the last successful cook, reused by the batch
+	// deform of a frame range
+	bool myDeformValid = false;
+	UT_StringHolder myDeformGroup;
+	UT_StringHolder myDeformSubsetGroup;
+	bool myDeformDriveByAttribs = false;
+	UT_StringHolder myDeformNormalAttrib;
+	UT_StringHolder myDeformUpAttrib;
+	UT_Array<UT_StringHolder> myDeformAttribs;
+
+	// Shares the capture table and copies the deform settings of the other
+	// cache.
+	void copyDeformState(const SOP_PointDeformByPrimCache &other)
+	{
+		myCaptureTable = other.myCaptureTable;
+		myDeformValid = other.myDeformValid;
+		myDeformGroup = other.myDeformGroup;
+		myDeformSubsetGroup = other.myDeformSubsetGroup;
+		myDeformDriveByAttribs = other.myDeformDriveByAttribs;
+		myDeformNormalAttrib = other.myDeformNormalAttrib;
+		myDeformUpAttrib = other.myDeformUpAttrib;
+		myDeformAttribs = other.myDeformAttribs;
+	}
+};
+
 SOP_PointDeformByPrim::SOP_PointDeformByPrim(OP_Network *net, const char *name, OP_Operator *op)
 	: SOP_Node(net, name, op)
 {
@@ -237,7 +590,14 @@ SOP_PointDeformByPrim::~SOP_PointDeformByPrim()
 OP_ERROR
 SOP_PointDeformByPrim::cookMySop(OP_Context &context)
 {
-	return cookMyselfAsVerb(context);
+	const OP_ERROR status = cookMyselfAsVerb(context);
+
+	// the batch deform of a frame range takes its share of the capture from
+	// the cook it forces, it never reads the verb cache outside of a cook
+	const SOP_PointDeformByPrimCache *sopcache = dynamic_cast<const SOP_PointDeformByPrimCache *>(myNodeVerbCache);
+	if (myFrameRangeCache && sopcache && sopcache->myDeformValid && status < UT_ERROR_ABORT)
+		myFrameRangeCache->copyDeformState(*sopcache);
+	return status;
 }
 
 int SOP_PointDeformByPrim::isRefInput(unsigned i) const
@@ -252,26 +612,51 @@ public:
 	virtual ~SOP_PointDeformByPrimVerb() {}
 
 	virtual SOP_NodeParms *allocParms() const { return new SOP_PointDeformByPrimParms(); }
+	virtual SOP_NodeCache *allocCache() const { return new SOP_PointDeformByPrimCache(); }
 	virtual UT_StringHolder name() const { return SOP_PointDeformByPrim::theSOPTypeName; }
 
-	virtual CookMode cookMode(const SOP_NodeParms *parms) const { return COOK_GENERIC; }
+	// the output starts as a copy of input 0 sharing its attribute pages,
+	// only P and the transformed attributes are hardened and written
+	virtual CookMode cookMode(const SOP_NodeParms *parms) const { return COOK_DUPLICATE; }
 	virtual void cook(const CookParms &cookparms) const;
 
 	static const SOP_NodeVerb::Register<SOP_PointDeformByPrimVerb> theVerb;
 
 private:
-	const char *currentParmsValue(const CookParms &cookparms) const;
-
-	template<typename T, typename V>
-	void constructRayGroups(const Gdps &gdps,
-							V pieceattrib_h, 
-							V rest_prim_pieceattrib_h, 
-							ThreadedPointDeform &threaded_ptdeform) const;
-
-	void findPieceAttrib(const Gdps &gdps,
+	SYS_HashType captureParmsHash(const CookParms &cookparms) const;
+
+	static void pointPageHashes(const GU_Detail *gdp, 
+								const GA_SplittableRange &ptrange, 
+								UT_Array<SYS_HashType> &page_hashes);
+
+	// Piece attribute of input 0, primitive or point, and of the rest
+	// lattice's primitives, null when they are missing.
+	static void findPieceAttribs(const Gdps &gdps,
+								 const UT_StringHolder &piece_parm,
+								 const GA_Attribute *&base_pieceattrib,
+								 const GA_Attribute *&rest_pieceattrib);
+
+	static CaptureFileFingerprint captureFileFingerprint(const Gdps &gdps,
+														 const PackedLattice *rest_lattice,
+														 const UT_StringHolder &piece_parm,
+														 const DriveAttrib_Info &drive_attrib_hs,
+														 const SOP_PointDeformByPrimCaptureKey &capture_key,
+														 const UT_Array<SYS_HashType> &page_hashes);
+
+	SOP_PointDeformByPrimCaptureKey captureKey(const Gdps &gdps,
+											   const PackedLattice *rest_lattice,
+											   const CookParms &cookparms,
+											   const GA_PointGroup *point_group,
+											   const DriveAttrib_Info &drive_attrib_hs,
+											   bool xform_required) const;
+
+	bool findPieceAttrib(const Gdps &gdps,
 						 const CookParms &cookparms, 
 						 const GA_AttributeOwner &attrib_owner, 
-						 ThreadedPointDeform &threaded_ptdeform) const;
+						 const PackedLattice *rest_lattice,
+						 ThreadedPointDeform &threaded_ptdeform,
+						 UT_Array<RayIntersectCache::Handle> &rays,
+						 CookStats &cook_stats) const;
 
 };
 
@@ -283,69 +668,462 @@ SOP_PointDeformByPrim::cookVerb() const
 	return SOP_PointDeformByPrimVerb::theVerb.get();
 }
 
-const char*
-SOP_PointDeformByPrimVerb::currentParmsValue(const CookParms &cookparms) const
+void
+SOP_PointDeformByPrim::getNodeSpecificInfoText(OP_Context &context, OP_NodeInfoParms &iparms)
+{
+	SOP_Node::getNodeSpecificInfoText(context, iparms);
+
+	const SOP_PointDeformByPrimCache *sopcache = dynamic_cast<const SOP_PointDeformByPrimCache *>(myNodeVerbCache);
+	if (!sopcache || !sopcache->myCookStats.Cooks)
+		return;
+
+	UT_WorkBuffer buf;
+	sopcache->myCookStats.appendText(buf);
+	iparms.append(buf.buffer());
+}
+
+int
+SOP_PointDeformByPrim::onDeformFrameRange(void *data, int index, fpreal t, const PRM_Template *)
+{
+	SOP_PointDeformByPrim *sop = static_cast<SOP_PointDeformByPrim *>(data);
+
+	UT_WorkBuffer error;
+	if (!sop->deformFrameRange(t, error))
+		sop->opError(OP_ERR_ANYTHING, error.buffer());
+	return 0;
+}
+
+// Copies the deformed lattice of a frame to the detail of its slot. Every
+// frame shares the topology of the rest lattice, so a slot holding an earlier
+// frame only takes the positions and drive attributes. Packed lattices are
+// duplicated, their instance transforms live on the primitives.
+static void
+copyDeformedFrame(const GU_Detail *deformed_gdp, 
+				  bool packed, 
+				  const SOP_PointDeformByPrimCache &sopcache, 
+				  UT_UniquePtr<GU_Detail> &slot_gdp)
+{
+	if (packed || !slot_gdp ||
+		slot_gdp->getNumPointOffsets() != deformed_gdp->getNumPointOffsets() ||
+		slot_gdp->getNumPoints() != deformed_gdp->getNumPoints() ||
+		slot_gdp->getNumPrimitives() != deformed_gdp->getNumPrimitives() ||
+		slot_gdp->getNumVertices() != deformed_gdp->getNumVertices())
+	{
+		if (!slot_gdp)
+			slot_gdp = UTmakeUnique<GU_Detail>();
+		slot_gdp->duplicate(*deformed_gdp);
+		return;
+	}
+
+	UT_Array<const GA_Attribute *> attribs;
+	attribs.append(deformed_gdp->getP());
+	if (sopcache.myDeformDriveByAttribs)
+	{
+		attribs.append(deformed_gdp->findPointAttribute(sopcache.myDeformNormalAttrib));
+		attribs.append(deformed_gdp->findPointAttribute(sopcache.myDeformUpAttrib));
+	}
+	for (const GA_Attribute *attrib : attribs)
+	{
+		const GA_ROHandleV3 src_h(attrib);
+		GA_RWHandleV3 dst_h(slot_gdp->findPointAttribute(attrib->getName()));
+		if (!dst_h.isValid())
+		{
+			slot_gdp->duplicate(*deformed_gdp);
+			return;
+		}
+		UTparallelFor(GA_SplittableRange(deformed_gdp->getPointRange()), [&](const GA_SplittableRange &r)
+		{
+			GA_Offset start, end;
+			for (GA_Iterator it(r); it.blockAdvance(start, end);)
+			{
+				for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+					dst_h.set(ptoff, src_h.get(ptoff));
+			}
+		});
+		dst_h.bumpDataId();
+	}
+}
+
+bool
+SOP_PointDeformByPrim::deformFrameRange(fpreal t, UT_WorkBuffer &errmsg)
+{
+	// a regular cook brings the capture table and deform settings up to date
+	// and shares them with the cache of the pass, later cooks of the node
+	// recapture into a table of their own while the pass holds it
+	OP_Context context(t);
+	myFrameRangeCache = UTmakeUnique<SOP_PointDeformByPrimCache>();
+	forceRecook();
+	const bool cooked = getCookedGeo(context) && error() < UT_ERROR_ABORT;
+	UT_UniquePtr<SOP_PointDeformByPrimCache> sopcache(std::move(myFrameRangeCache));
+	if (!cooked)
+	{
+		errmsg.strcpy("The node failed to cook.");
+		return false;
+	}
+
+	SOP_Node *base_sop = CAST_SOP(getInput(0));
+	SOP_Node *rest_sop = CAST_SOP(getInput(1));
+	SOP_Node *deformed_sop = CAST_SOP(getInput(2));
+	if (!sopcache->myDeformValid || !base_sop || !rest_sop || !deformed_sop)
+	{
+		errmsg.strcpy("The node has no deformed lattice or capture to deform by.");
+		return false;
+	}
+
+	const fpreal start = evalFloat("batchrange", 0, t);
+	const fpreal end = evalFloat("batchrange", 1, t);
+	const fpreal inc = evalFloat("batchrange", 2, t);
+	if (inc <= 0.0 || end < start)
+	{
+		errmsg.strcpy("The frame range is empty.");
+		return false;
+	}
+
+	UT_Array<fpreal> frames;
+	const exint numframes_total = exint(SYSfloor((end - start) / inc + 1e-4)) + 1;
+	for (exint i = 0; i < numframes_total; ++i)
+		frames.append(start + i * inc);
+	const exint frames_per_pass = SYSmax(exint(evalInt("framesperpass", 0, t)), exint(1));
+
+	// inputs 0 and 1 cannot be time dependent, only input 2 is cooked per frame
+	GU_DetailHandleAutoReadLock base_lock(base_sop->getCookedGeoHandle(context));
+	GU_DetailHandleAutoReadLock rest_lock(rest_sop->getCookedGeoHandle(context));
+	if (!base_lock.getGdp() || !rest_lock.getGdp())
+	{
+		errmsg.strcpy("The first/second input failed to cook.");
+		return false;
+	}
+
+	PackedLattice rest_lattice;
+	const bool packed = PackedLattice::isPacked(rest_lock.getGdp());
+	if (packed && !rest_lattice.build(rest_lock.getGdp(), errmsg))
+		return false;
+
+	GOP_Manager group_parser;
+	bool success = false;
+	const GA_PointGroup *point_group = group_parser.parsePointDetached(
+		sopcache->myDeformGroup, base_lock.getGdp(), false, success);
+	const GA_PointGroupUPtr deform_group = parseDeformGroup(
+		group_parser, base_lock.getGdp(), sopcache->myDeformSubsetGroup, point_group, success);
+
+	CaptureAttributes_Info captureattribs_info;
+	captureattribs_info.XformRequired = sopcache->myDeformAttribs.size() > 0;
+	CookStats cook_stats;
+
+	// every pass writes its frames to the same slots, the output slots only
+	// differ from input 0 in the deformed points and attributes, which every
+	// pass overwrites
+	const exint numslots = SYSmin(frames_per_pass, frames.size());
+	UT_Array<UT_UniquePtr<GU_Detail>> output_slots;
+	UT_Array<UT_UniquePtr<GU_Detail>> deformed_slots;
+	output_slots.setSize(numslots);
+	deformed_slots.setSize(numslots);
+
+	UT_AutoInterrupt progress("Deforming frame range");
+	for (exint pass_start = 0; pass_start < frames.size(); pass_start += frames_per_pass)
+	{
+		const exint numframes = SYSmin(frames_per_pass, frames.size() - pass_start);
+
+		UT_Array<const GU_Detail *> deformed_gdps;
+		UT_Array<GU_Detail *> gdps;
+		for (exint i = 0; i < numframes; ++i)
+		{
+			if (progress.wasInterrupted())
+			{
+				errmsg.strcpy("Interrupted.");
+				return false;
+			}
+
+			const OP_Context frame_context(CHgetManager()->getTime(frames[pass_start + i]));
+			GU_DetailHandleAutoReadLock deformed_lock(deformed_sop->getCookedGeoHandle(frame_context));
+			const GU_Detail *deformed_gdp = deformed_lock.getGdp();
+			if (!deformed_gdp || deformed_gdp->getNumPrimitives() != rest_lock.getGdp()->getNumPrimitives())
+			{
+				errmsg.sprintf("The deformed lattice of frame %g does not match the rest lattice.", frames[pass_start + i]);
+				return false;
+			}
+
+			if (packed)
+			{
+				PackedLattice deformed_lattice;
+				if (!deformed_lattice.build(deformed_gdp, errmsg))
+					return false;
+				if (!rest_lattice.matches(deformed_lattice))
+				{
+					errmsg.sprintf("The deformed lattice of frame %g does not match the rest lattice.", frames[pass_start + i]);
+					return false;
+				}
+			}
+
+			if (sopcache->myDeformDriveByAttribs &&
+				(!deformed_gdp->findPointAttribute(sopcache->myDeformNormalAttrib) ||
+				 !deformed_gdp->findPointAttribute(sopcache->myDeformUpAttrib)))
+			{
+				errmsg.sprintf("The deformed lattice of frame %g doesn't have Normal/Up vector.", frames[pass_start + i]);
+				return false;
+			}
+
+			// the input's detail is reused by its next cook
+			copyDeformedFrame(deformed_gdp, packed, *sopcache, deformed_slots[i]);
+			deformed_gdps.append(deformed_slots[i].get());
+
+			if (!output_slots[i])
+			{
+				output_slots[i] = UTmakeUnique<GU_Detail>();
+				output_slots[i]->duplicate(*base_lock.getGdp());
+			}
+			gdps.append(output_slots[i].get());
+		}
+
+		Gdps pass_gdps;
+		pass_gdps.Gdp = gdps[0];
+		pass_gdps.BaseGdp = base_lock.getGdp();
+		pass_gdps.RestGdp = rest_lock.getGdp();
+		pass_gdps.DeformedGdp = deformed_gdps[0];
+
+		DriveAttrib_Info drive_attrib_hs;
+		if (sopcache->myDeformDriveByAttribs)
+		{
+			drive_attrib_hs.RestNormal_H.bind(pass_gdps.RestGdp->findPointAttribute(sopcache->myDeformNormalAttrib));
+			drive_attrib_hs.RestUp_H.bind(pass_gdps.RestGdp->findPointAttribute(sopcache->myDeformUpAttrib));
+			drive_attrib_hs.DeformedNormal_H.bind(pass_gdps.DeformedGdp->findPointAttribute(sopcache->myDeformNormalAttrib));
+			drive_attrib_hs.DeformedUp_H.bind(pass_gdps.DeformedGdp->findPointAttribute(sopcache->myDeformUpAttrib));
+			drive_attrib_hs.Drive = true;
+		}
+
+		GA_SplittableRange ptrange(pass_gdps.Gdp->getPointRange(deform_group ? deform_group.get() : point_group));
+		ThreadedPointDeform threaded_ptdeform(pass_gdps, &ptrange, &drive_attrib_hs, &captureattribs_info, 
+			sopcache->myCaptureTable.get(), &cook_stats, sopcache->myDeformAttribs);
+		if (packed)
+			threaded_ptdeform.setPackedLattices(&rest_lattice, nullptr);
+		if (!threaded_ptdeform.deformFrames(deformed_gdps, gdps, errmsg))
+			return false;
+
+		// every frame is written as soon as its pass is done
+		for (exint i = 0; i < numframes; ++i)
+		{
+			UT_String filename;
+			evalString(filename, "batchfile", 0, CHgetManager()->getTime(frames[pass_start + i]));
+			if (!gdps[i]->save(filename.c_str(), nullptr).success())
+			{
+				errmsg.sprintf("Cannot write %s.", filename.c_str());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+SYS_HashType
+SOP_PointDeformByPrimVerb::captureParmsHash(const CookParms &cookparms) const
 {
 	const SOP_PointDeformByPrimParms &sopparms = cookparms.parms<SOP_PointDeformByPrimParms>();
 
-	UT_OStringStream oss;
-	oss << 
-		sopparms.getGroup() <<
-		sopparms.getDriveByAttribs() <<
-		sopparms.getNormalAttrib() <<
-		sopparms.getUpAttrib() <<
-		sopparms.getMultipleSamples() <<
-		sopparms.getMinDistThresh() <<
-		sopparms.getPieceAttrib() <<
-		sopparms.getAttribs();
-
-	return oss.str().buffer();
+	SYS_HashType hash = 0;
+	SYShashCombine(hash, sopparms.getGroup().hash());
+	SYShashCombine(hash, sopparms.getDriveByAttribs());
+	SYShashCombine(hash, sopparms.getNormalAttrib().hash());
+	SYShashCombine(hash, sopparms.getUpAttrib().hash());
+	SYShashCombine(hash, sopparms.getMultipleSamples());
+	SYShashCombine(hash, int(sopparms.getSamplePattern()));
+	// only the fibonacci pattern has a sample count
+	if (SamplePattern(sopparms.getSamplePattern()) == SamplePattern::FibonacciHemisphere)
+		SYShashCombine(hash, sopparms.getSampleCount());
+	SYShashCombine(hash, sopparms.getMinDistThresh());
+	SYShashCombine(hash, sopparms.getRadiusCapture());
+	SYShashCombine(hash, sopparms.getCaptureRadius());
+	SYShashCombine(hash, sopparms.getMaxBindings());
+	SYShashCombine(hash, sopparms.getPieceAttrib().hash());
+	SYShashCombine(hash, sopparms.getExportCapture());
+	SYShashCombine(hash, sopparms.getAttribs().hash());
+	SYShashCombine(hash, sopparms.getRebuildXform());
+	SYShashCombine(hash, sopparms.getQuantizeCapture());
+	SYShashCombine(hash, sopparms.getQuantizeTolerance());
+
+	return hash;
 }
 
-template<typename T, typename V>
+// Hashes the offsets and positions of the points in the range page by
+// page, a page without points in the range hashes to 0.
 void
-SOP_PointDeformByPrimVerb::constructRayGroups(const Gdps &gdps,
-											  V pieceattrib_h,
-											  V rest_prim_pieceattrib_h,
-											  ThreadedPointDeform &threaded_ptdeform) const
+SOP_PointDeformByPrimVerb::pointPageHashes(const GU_Detail *gdp, 
+										   const GA_SplittableRange &ptrange, 
+										   UT_Array<SYS_HashType> &page_hashes)
 {
-	MapPrimGroup<T> primgrp_map;
-	GA_Range rest_primrange(std::move(gdps.RestGdp->getPrimitiveRange()));
+	const GA_Size numptoffsets = gdp->getNumPointOffsets();
+	page_hashes.setSizeNoInit((numptoffsets + GA_PAGE_SIZE - 1) / GA_PAGE_SIZE);
+	page_hashes.constant(0);
 
-	T attrib_value;
-	for (GA_Iterator primitr(rest_primrange.begin()); primitr != rest_primrange.end(); ++primitr)
+	// the range splits on page boundaries, so every page has a single writer
+	const GA_ROHandleV3 p_h(gdp->getP());
+	UTparallelFor(ptrange, [&](const GA_SplittableRange &r)
 	{
-		attrib_value = rest_prim_pieceattrib_h.get(*primitr);
-		if (primgrp_map.Map.find(attrib_value) == primgrp_map.Map.end())
+		GA_Offset start, end;
+		for (GA_Iterator it(r); it.blockAdvance(start, end);)
 		{
-			primgrp_map.Map[attrib_value] = gdps.RestGdp->newDetachedPrimitiveGroup();
-			primgrp_map.Map.at(attrib_value)->addOffset(gdps.RestGdp->primitiveOffset(*primitr));
+			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			{
+				const UT_Vector3F pos = p_h.get(ptoff);
+				SYS_HashType &page_hash = page_hashes[GAgetPageNum(ptoff)];
+				SYShashCombine(page_hash, exint(ptoff));
+				SYShashCombine(page_hash, pos.x());
+				SYShashCombine(page_hash, pos.y());
+				SYShashCombine(page_hash, pos.z());
+			}
 		}
-		else
-			primgrp_map.Map.at(attrib_value)->addOffset(*primitr);
+	});
+}
+
+// Hashes the values of a piece or drive attribute in index order, unlike
+// its data id they are the same in every session.
+static void
+hashAttribValues(const GA_Attribute *attrib, SYS_HashType &hash)
+{
+	if (!attrib)
+		return;
+
+	const GA_ROHandleS str_h(attrib);
+	const GA_ROHandleI int_h(attrib);
+	const GA_ROHandleV3 vec_h(attrib);
+	const GA_Range range(attrib->getIndexMap());
+	for (GA_Iterator it(range); !it.atEnd(); ++it)
+	{
+		if (str_h.isValid())
+			SYShashCombine(hash, str_h.get(*it).hash());
+		else if (vec_h.isValid())
+		{
+			const UT_Vector3F value = vec_h.get(*it);
+			SYShashCombine(hash, value.x());
+			SYShashCombine(hash, value.y());
+			SYShashCombine(hash, value.z());
+		}
+		else if (int_h.isValid())
+			SYShashCombine(hash, int_h.get(*it));
+	}
+}
+
+void
+SOP_PointDeformByPrimVerb::findPieceAttribs(const Gdps &gdps,
+											const UT_StringHolder &piece_parm,
+											const GA_Attribute *&base_pieceattrib,
+											const GA_Attribute *&rest_pieceattrib)
+{
+	base_pieceattrib = nullptr;
+	rest_pieceattrib = nullptr;
+	if (!piece_parm)
+		return;
+
+	base_pieceattrib = gdps.BaseGdp->findPrimitiveAttribute(piece_parm);
+	if (!base_pieceattrib)
+		base_pieceattrib = gdps.BaseGdp->findPointAttribute(piece_parm);
+	rest_pieceattrib = gdps.RestGdp->findPrimitiveAttribute(piece_parm);
+}
+
+CaptureFileFingerprint
+SOP_PointDeformByPrimVerb::captureFileFingerprint(const Gdps &gdps,
+												  const PackedLattice *rest_lattice,
+												  const UT_StringHolder &piece_parm,
+												  const DriveAttrib_Info &drive_attrib_hs,
+												  const SOP_PointDeformByPrimCaptureKey &capture_key,
+												  const UT_Array<SYS_HashType> &page_hashes)
+{
+	CaptureFileFingerprint fingerprint;
+
+	const GU_Detail *rest_gdp = gdps.RestGdp;
+	SYShashCombine(fingerprint.Topology, PackedLattice::topologyHash(rest_gdp));
+	if (rest_lattice)
+		SYShashCombine(fingerprint.Topology, rest_lattice->contentHash());
+
+	SYShashCombine(fingerprint.Inputs, capture_key.ParmsHash);
+	SYShashCombine(fingerprint.Inputs, capture_key.XformRequired);
+	SYShashCombine(fingerprint.Inputs, exint(gdps.BaseGdp->getNumPointOffsets()));
+	for (SYS_HashType page_hash : page_hashes)
+		SYShashCombine(fingerprint.Inputs, page_hash);
+
+	const GA_ROHandleV3 rest_p_h(rest_gdp->getP());
+	for (GA_Iterator ptitr(rest_gdp->getPointRange()); !ptitr.atEnd(); ++ptitr)
+	{
+		const UT_Vector3F pos = rest_p_h.get(*ptitr);
+		SYShashCombine(fingerprint.Inputs, pos.x());
+		SYShashCombine(fingerprint.Inputs, pos.y());
+		SYShashCombine(fingerprint.Inputs, pos.z());
 	}
 
-	MapRay<T> restprim_rays;
-	for (auto &kv : primgrp_map.Map)
+	// the pieces and drive attributes pick and orient the bindings too
+	const GA_Attribute *base_pieceattrib, *rest_pieceattrib;
+	findPieceAttribs(gdps, piece_parm, base_pieceattrib, rest_pieceattrib);
+	hashAttribValues(base_pieceattrib, fingerprint.Inputs);
+	hashAttribValues(rest_pieceattrib, fingerprint.Inputs);
+	if (drive_attrib_hs.Drive)
 	{
-		GU_RayIntersect *ray = new GU_RayIntersect(gdps.RestGdp, kv.second, true, false, true);
-		restprim_rays.Map[kv.first] = ray;
+		hashAttribValues(drive_attrib_hs.RestNormal_H.getAttribute(), fingerprint.Inputs);
+		hashAttribValues(drive_attrib_hs.RestUp_H.getAttribute(), fingerprint.Inputs);
 	}
 
-	threaded_ptdeform.captureByPieceAttrib(pieceattrib_h, restprim_rays);
+	return fingerprint;
+}
+
+SOP_PointDeformByPrimCaptureKey
+SOP_PointDeformByPrimVerb::captureKey(const Gdps &gdps,
+									  const PackedLattice *rest_lattice,
+									  const CookParms &cookparms,
+									  const GA_PointGroup *point_group,
+									  const DriveAttrib_Info &drive_attrib_hs,
+									  bool xform_required) const
+{
+	auto &&sopparms = cookparms.parms<SOP_PointDeformByPrimParms>();
+
+	SOP_PointDeformByPrimCaptureKey key;
+	key.BaseUniqueId = gdps.BaseGdp->getUniqueId();
+	key.BaseNumPointOffsets = gdps.BaseGdp->getNumPointOffsets();
+	key.BaseTopologyId = gdps.BaseGdp->getTopology().getPointRef()->getDataId();
+	key.BasePId = gdps.BaseGdp->getP()->getDataId();
+	key.RestUniqueId = gdps.RestGdp->getUniqueId();
+	key.RestTopologyId = gdps.RestGdp->getTopology().getPointRef()->getDataId();
+	key.RestPrimitiveListId = gdps.RestGdp->getPrimitiveList().getDataId();
+	key.RestPId = gdps.RestGdp->getP()->getDataId();
+	if (rest_lattice)
+		key.RestPackedHash = rest_lattice->dataHash();
+
+	const GA_Attribute *base_pieceattrib, *rest_pieceattrib;
+	findPieceAttribs(gdps, sopparms.getPieceAttrib(), base_pieceattrib, rest_pieceattrib);
+	if (base_pieceattrib)
+		key.BasePieceId = base_pieceattrib->getDataId();
+	if (rest_pieceattrib)
+		key.RestPieceId = rest_pieceattrib->getDataId();
+
+	if (drive_attrib_hs.Drive)
+	{
+		key.RestNormalId = drive_attrib_hs.RestNormal_H.getAttribute()->getDataId();
+		key.RestUpId = drive_attrib_hs.RestUp_H.getAttribute()->getDataId();
+	}
 
-	for (auto &kv : restprim_rays.Map)
-		delete restprim_rays.Map.at(kv.first);
+	// ad-hoc group patterns can depend on anything, so key on the membership itself
+	if (point_group)
+	{
+		GA_Range group_range(gdps.BaseGdp->getPointRange(point_group));
+		GA_Offset start, end;
+		for (GA_Iterator it(group_range); it.blockAdvance(start, end);)
+		{
+			SYShashCombine(key.GroupHash, exint(start));
+			SYShashCombine(key.GroupHash, exint(end));
+		}
+	}
 
-	for (auto &kv : primgrp_map.Map)
-		primgrp_map.Map.at(kv.first)->clearEntries();
+	key.XformRequired = xform_required;
+	key.ParmsHash = captureParmsHash(cookparms);
+	return key;
 }
 
-void
+bool
 SOP_PointDeformByPrimVerb::findPieceAttrib(const Gdps &gdps, 
 										   const CookParms &cookparms, 
 										   const GA_AttributeOwner &attrib_owner, 
-										   ThreadedPointDeform &threaded_ptdeform) const
+										   const PackedLattice *rest_lattice,
+										   ThreadedPointDeform &threaded_ptdeform,
+										   UT_Array<RayIntersectCache::Handle> &rays,
+										   CookStats &cook_stats) const
 {
 	auto &&sopparms = cookparms.parms<SOP_PointDeformByPrimParms>();
 
@@ -360,11 +1138,11 @@ SOP_PointDeformByPrimVerb::findPieceAttrib(const Gdps &gdps,
 		GA_ROHandleS rest_prim_pieceattrib_h(restprim_pieceattrib);
 
 		if (pieceattrib_h.isValid() && rest_prim_pieceattrib_h.isValid())
-			constructRayGroups<UT_StringHolder, GA_ROHandleS>(gdps, pieceattrib_h, rest_prim_pieceattrib_h, threaded_ptdeform);
+			constructRayGroups<UT_StringHolder, GA_ROHandleS>(gdps, pieceattrib_h, rest_prim_pieceattrib_h, rest_lattice, threaded_ptdeform, rays, cook_stats);
 		else
 		{
 			cookparms.sopAddError(SOP_MESSAGE, "Only string/integer type is allowed for Piece attribute!\n");
-			return;
+			return false;
 		}
 	}
 	else if (restprim_pieceattribtype.getTypeName() == "numeric")
@@ -374,18 +1152,20 @@ SOP_PointDeformByPrimVerb::findPieceAttrib(const Gdps &gdps,
 		GA_ROHandleI rest_prim_pieceattrib_h(restprim_pieceattrib);
 
 		if (pieceattrib_h.isValid() && rest_prim_pieceattrib_h.isValid())
-			constructRayGroups<int32, GA_ROHandleI>(gdps, pieceattrib_h, rest_prim_pieceattrib_h, threaded_ptdeform);
+			constructRayGroups<int32, GA_ROHandleI>(gdps, pieceattrib_h, rest_prim_pieceattrib_h, rest_lattice, threaded_ptdeform, rays, cook_stats);
 		else
 		{
 			cookparms.sopAddError(SOP_MESSAGE, "Only string/integer type is allowed for Piece attribute!\n");
-			return;
+			return false;
 		}
 	}
 	else
 	{
 		cookparms.sopAddError(SOP_MESSAGE, "Only string/integer type is allowed for Piece attribute!\n");
-		return;
+		return false;
 	}
+
+	return true;
 }
 
 void
@@ -396,6 +1176,21 @@ SOP_PointDeformByPrimVerb::cook(const CookParms &cookparms) const
 	gdps.RestGdp = cookparms.inputGeo(1);
 	gdps.DeformedGdp = cookparms.inputGeo(2);
 
+	auto &&sopcache = static_cast<SOP_PointDeformByPrimCache *>(cookparms.cache());
+	// a batch deform of a frame range still reading the table keeps it, the
+	// cook updates a copy
+	if (sopcache->myCaptureTable.use_count() > 1)
+	{
+		UT_SharedPtr<CaptureTable> table = UTmakeShared<CaptureTable>();
+		table->copy(*sopcache->myCaptureTable);
+		sopcache->myCaptureTable = table;
+	}
+	CaptureTable &capture_table = *sopcache->myCaptureTable;
+	CookStats &cook_stats = sopcache->myCookStats;
+	cook_stats.beginCook();
+	sopcache->myDeformValid = false;
+	Timer phase_timer;
+
     if (gdps.BaseGdp->isEmpty() || gdps.RestGdp->isEmpty() || !gdps.RestGdp->getNumPrimitives())
     {
         cookparms.sopAddError(SOP_MESSAGE, "First/Second input should contain valid geometry!\n");
@@ -422,113 +1217,113 @@ SOP_PointDeformByPrimVerb::cook(const CookParms &cookparms) const
 		return;
 	}
 
-	const GA_Primitive *rest_prim = gdps.RestGdp->getPrimitive(gdps.RestGdp->primitiveOffset(0));
-	const GA_Primitive *deformed_prim = gdps.DeformedGdp->getPrimitive(gdps.DeformedGdp->primitiveOffset(0));
-	GA_Size rest_vtxcount = rest_prim->getVertexCount();
-	if (rest_vtxcount != deformed_prim->getVertexCount())
+	// packed lattices are resolved per instance instead of being unpacked
+	PackedLattice rest_lattice, deformed_lattice;
+	const bool packed = PackedLattice::isPacked(gdps.RestGdp);
+	if (packed)
 	{
-		cookparms.sopAddWarning(SOP_MESSAGE, "Rest/deformed geometry cannot have different topology!\n");
-		return;
+		UT_WorkBuffer errmsg;
+		if (!rest_lattice.build(gdps.RestGdp, errmsg) || !deformed_lattice.build(gdps.DeformedGdp, errmsg))
+		{
+			cookparms.sopAddError(SOP_MESSAGE, errmsg.buffer());
+			return;
+		}
+		if (!rest_lattice.matches(deformed_lattice))
+		{
+			cookparms.sopAddWarning(SOP_MESSAGE, "Rest/deformed geometry cannot have different topology!\n");
+			return;
+		}
 	}
-	GA_Offset rest_primvtx, deformed_primvtx;
-	for (GA_Size i = 0; i < rest_vtxcount; ++i)
+	else
 	{
-		rest_primvtx = rest_prim->getVertexOffset(i);
-		deformed_primvtx = deformed_prim->getVertexOffset(i);
-		if (rest_primvtx != deformed_primvtx)
+		const GA_Primitive *rest_prim = gdps.RestGdp->getPrimitive(gdps.RestGdp->primitiveOffset(0));
+		const GA_Primitive *deformed_prim = gdps.DeformedGdp->getPrimitive(gdps.DeformedGdp->primitiveOffset(0));
+		GA_Size rest_vtxcount = rest_prim->getVertexCount();
+		if (rest_vtxcount != deformed_prim->getVertexCount())
 		{
 			cookparms.sopAddWarning(SOP_MESSAGE, "Rest/deformed geometry cannot have different topology!\n");
 			return;
 		}
+		GA_Offset rest_primvtx, deformed_primvtx;
+		for (GA_Size i = 0; i < rest_vtxcount; ++i)
+		{
+			rest_primvtx = rest_prim->getVertexOffset(i);
+			deformed_primvtx = deformed_prim->getVertexOffset(i);
+			if (rest_primvtx != deformed_primvtx)
+			{
+				cookparms.sopAddWarning(SOP_MESSAGE, "Rest/deformed geometry cannot have different topology!\n");
+				return;
+			}
+		}
 	}
 
+	cook_stats.addPhaseTime(CookPhase::TopologyValidation, phase_timer);
+
     // get parms
 	const UT_StringHolder &group_parm = sopparms.getGroup();
+	const UT_StringHolder &deformgroup_parm = sopparms.getDeformGroup();
 	const bool drivebyattribs_parm = sopparms.getDriveByAttribs();
 	const UT_StringHolder &normalattrib_parm = sopparms.getNormalAttrib();
 	const UT_StringHolder &upattrib_parm = sopparms.getUpAttrib();
 	const bool multisamples_parm = sopparms.getMultipleSamples();
+	const SamplePattern samplepattern_parm = SamplePattern(sopparms.getSamplePattern());
+	const exint samplecount_parm = sopparms.getSampleCount();
 	const fpreal32 mindistthresh_parm = sopparms.getMinDistThresh();
+	const bool radiuscapture_parm = sopparms.getRadiusCapture();
+	const fpreal32 captureradius_parm = sopparms.getCaptureRadius();
+	const exint maxbindings_parm = sopparms.getMaxBindings();
 	const UT_StringHolder &piece_parm = sopparms.getPieceAttrib();
+	const CaptureOrder captureorder_parm = CaptureOrder(sopparms.getCaptureOrder());
+	const bool exportcapture_parm = sopparms.getExportCapture();
+	const bool exportcookstats_parm = sopparms.getExportCookStats();
+	const exint capturefilemode_parm = exint(sopparms.getCaptureFileMode());
+	const UT_StringHolder &capturefile_parm = sopparms.getCaptureFile();
+	const bool quantizecapture_parm = sopparms.getQuantizeCapture();
+	const fpreal32 quantizetolerance_parm = sopparms.getQuantizeTolerance();
     const UT_StringHolder &attribs_parm = sopparms.getAttribs();
+	const bool rebuildxform_parm = sopparms.getRebuildXform();
 
-	// evaluation for reinitialization
-	const UT_StringHolder &parms_value_name("__parms_value");
-	const UT_StringHolder &base_meta_count_name("__base_meta_count");
-	const UT_StringHolder &rest_meta_count_name("__rest_meta_count");
-	GA_Attribute *parms_value_attrib;
-	GA_Attribute *base_meta_count_attrib;
-	GA_Attribute *rest_meta_count_attrib;
-	GA_RWHandleS parms_value_h;
-	GA_RWHandleI base_meta_count_h;
-	GA_RWHandleI rest_meta_count_h;
-	parms_value_attrib = gdps.Gdp->findAttribute(GA_ATTRIB_DETAIL, parms_value_name);
-	base_meta_count_attrib = gdps.Gdp->findAttribute(GA_ATTRIB_DETAIL, base_meta_count_name);
-	rest_meta_count_attrib = gdps.Gdp->findAttribute(GA_ATTRIB_DETAIL, rest_meta_count_name);
-
-	bool reinitialize = false;
-	const UT_StringHolder &cur_parms_value = currentParmsValue(cookparms);
-	if (parms_value_attrib &&
-		base_meta_count_attrib &&
-		rest_meta_count_attrib)
-	{
-		parms_value_h.bind(parms_value_attrib);
-		base_meta_count_h.bind(base_meta_count_attrib);
-		rest_meta_count_h.bind(rest_meta_count_attrib);
-
-		reinitialize = cur_parms_value.compare(parms_value_h.get(0)) != 0 ||
-			base_meta_count_h.get(0) != gdps.BaseGdp->getMetaCacheCount() ||
-			rest_meta_count_h.get(0) != gdps.RestGdp->getMetaCacheCount();
-	}
-	else
-		reinitialize = true;
-
-	// create/get deformation attribsCaptureAttributes
-	const UT_StringHolder &rest_p_name("__rest_p");
-	const UT_StringHolder &capture_prims_name("__capture_prims");
-	const UT_StringHolder &capture_uvws_name("__capture_uvws");
-	const UT_StringHolder &capture_weights_name("__capture_weights");
-	const UT_StringHolder &capture_xform_name("__capture_xform");
+	GOP_Manager group_parser;
+	bool success = false;
+	const GA_PointGroup *point_group = group_parser.parsePointDetached(group_parm, gdps.BaseGdp, false, success);
 
-	CaptureAttributes capture_attribs;
-	CaptureAttributes_Info captureattribs_info;
-	captureattribs_info.CaptureMultiSamples = multisamples_parm;
-	captureattribs_info.CaptureMinDistThresh = mindistthresh_parm;
+	if (group_parm && !success)
+		cookparms.sopAddWarning(SOP_ERR_BADGROUP, group_parm);
 
-    if (reinitialize)
-    {
-	    gdps.Gdp->replaceWith(*gdps.BaseGdp);
-
-		parms_value_attrib = gdps.Gdp->addStringTuple(GA_ATTRIB_DETAIL, parms_value_name, 1);
-		base_meta_count_attrib = gdps.Gdp->addIntTuple(GA_ATTRIB_DETAIL, base_meta_count_name, 1);
-		rest_meta_count_attrib = gdps.Gdp->addIntTuple(GA_ATTRIB_DETAIL, rest_meta_count_name, 1);
-		parms_value_h.bind(parms_value_attrib);
-		base_meta_count_h.bind(base_meta_count_attrib);
-		rest_meta_count_h.bind(rest_meta_count_attrib);
-		parms_value_h.set(0, cur_parms_value);
-		base_meta_count_h.set(0, gdps.BaseGdp->getMetaCacheCount());
-		rest_meta_count_h.set(0, gdps.RestGdp->getMetaCacheCount());
+	// the deform group only narrows the points deformed by this cook, the
+	// bindings of the whole group are captured and kept
+	const GA_PointGroupUPtr deform_group = parseDeformGroup(group_parser, gdps.BaseGdp, deformgroup_parm, point_group, success);
+	if (!success)
+		cookparms.sopAddWarning(SOP_ERR_BADGROUP, deformgroup_parm);
 
-		capture_attribs.RestP = gdps.Gdp->addFloatTuple(GA_ATTRIB_POINT, rest_p_name, 3, (GA_Defaults)0.f, nullptr, nullptr, GA_STORE_REAL32);
-		capture_attribs.RestP->setTypeInfo(GA_TYPE_POINT);
-		capture_attribs.Prims = gdps.Gdp->addIntArray(GA_ATTRIB_POINT, capture_prims_name, 1);
-		capture_attribs.Prims->setTypeInfo(GA_TYPE_NONARITHMETIC_INTEGER);
-		capture_attribs.UVWs = gdps.Gdp->addFloatArray(GA_ATTRIB_POINT, capture_uvws_name, 2, nullptr, nullptr, GA_STORE_REAL16);
-		capture_attribs.UVWs->setTypeInfo(GA_TYPE_VECTOR);
-		capture_attribs.Weights = gdps.Gdp->addFloatArray(GA_ATTRIB_POINT, capture_weights_name, 1, nullptr, nullptr, GA_STORE_REAL16);
-    }
-    else
-    {
-		capture_attribs.RestP = gdps.Gdp->findAttribute(GA_ATTRIB_POINT, rest_p_name);
-		capture_attribs.Prims = gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_prims_name);
-		capture_attribs.UVWs = gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_uvws_name);
-		capture_attribs.Weights = gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_weights_name);
-    }
+	DriveAttrib_Info drive_attrib_hs;
+	if (drivebyattribs_parm && packed)
+	{
+		cookparms.sopAddError(SOP_MESSAGE, "Drive by attributes is not supported with a packed lattice!\n");
+		return;
+	}
+	if (drivebyattribs_parm)
+	{
+		const GA_Attribute *rest_normal_attrib = gdps.RestGdp->findAttribute(GA_ATTRIB_POINT, normalattrib_parm);
+		const GA_Attribute *rest_up_attrib = gdps.RestGdp->findAttribute(GA_ATTRIB_POINT, upattrib_parm);
+		const GA_Attribute *deformed_normal_attrib = gdps.DeformedGdp->findAttribute(GA_ATTRIB_POINT, normalattrib_parm);
+		const GA_Attribute *deformed_up_attrib = gdps.DeformedGdp->findAttribute(GA_ATTRIB_POINT, upattrib_parm);
 
-	captureattribs_info.RestP_H.bind(capture_attribs.RestP);
-	captureattribs_info.CapturePrims_H.bind(capture_attribs.Prims);
-	captureattribs_info.CaptureUVWs_H.bind(capture_attribs.UVWs);
-	captureattribs_info.CaptureWeights_H.bind(capture_attribs.Weights);
+		if (rest_normal_attrib && rest_up_attrib &&
+			deformed_normal_attrib && deformed_up_attrib)
+		{
+			drive_attrib_hs.Drive = true;
+			drive_attrib_hs.RestNormal_H.bind(rest_normal_attrib);
+			drive_attrib_hs.RestUp_H.bind(rest_up_attrib);
+			drive_attrib_hs.DeformedNormal_H.bind(deformed_normal_attrib);
+			drive_attrib_hs.DeformedUp_H.bind(deformed_up_attrib);
+		}
+		else
+		{
+			cookparms.sopAddError(SOP_MESSAGE, "Rest or Deformed geometry stream doesn't have Normal/Up vector!\n");
+			return;
+		}
+	}
 
 	// based on the attribs parameter,
 	// find any vector attribs to interpolate
@@ -536,15 +1331,17 @@ SOP_PointDeformByPrimVerb::cook(const CookParms &cookparms) const
 
 	if (attribs_parm)
 	{
-		UT_Array<GA_TypeInfo> types{ GA_TYPE_VECTOR, GA_TYPE_NORMAL };
+		UT_Array<GA_TypeInfo> types{ GA_TYPE_POINT, GA_TYPE_VECTOR, GA_TYPE_NORMAL };
 
 		if (attribs_parm == "*")
 		{
 			const GA_AttributeDict &base_point_attribs = gdps.BaseGdp->getAttributes().getDict(GA_ATTRIB_POINT);
 			for (GA_AttributeDict::iterator pit(base_point_attribs.begin()); pit != base_point_attribs.end(); ++pit)
 			{
+				// rest keeps the undeformed positions, it is only translated
+				// when named
 				const GA_Attribute *cur_attrib = pit.attrib();
-				if (cur_attrib && cur_attrib->getFullName() != "P" && 
+				if (cur_attrib && cur_attrib->getFullName() != "P" && cur_attrib->getFullName() != "rest" && 
 					cur_attrib->getTupleSize() == 3 && types.find(cur_attrib->getTypeInfo()) != -1)
 					attribnames_to_interpolate.emplace_back(cur_attrib->getFullName());
 			}
@@ -565,92 +1362,206 @@ SOP_PointDeformByPrimVerb::cook(const CookParms &cookparms) const
 				}
 			}
 		}
+	}
 
-		if (attribnames_to_interpolate.size())
-		{
-			captureattribs_info.XformRequired = true;
+	// evaluation for reinitialization
+	const SOP_PointDeformByPrimCaptureKey capture_key = 
+		captureKey(gdps, packed ? &rest_lattice : nullptr, cookparms, point_group, drive_attrib_hs, attribnames_to_interpolate.size() > 0);
 
-			if (reinitialize)
-			{
-				capture_attribs.Xform = gdps.Gdp->addFloatTuple(
-					GA_ATTRIB_POINT, capture_xform_name, 9, (GA_Defaults)0.f, nullptr, nullptr, GA_STORE_REAL16);
-				capture_attribs.Xform->setTypeInfo(GA_TYPE_TRANSFORM);
-			}
-			else
-				capture_attribs.Xform = gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_xform_name);
+	bool reinitialize = capture_key != sopcache->myCaptureKey ||
+		!capture_table.isValid(gdps.BaseGdp->getNumPointOffsets(), attribnames_to_interpolate.size() > 0 && !rebuildxform_parm);
 
-			capture_attribs.Xform->bumpDataId();
-			captureattribs_info.Xform_H.bind(capture_attribs.Xform);
-		}
-		else
-		{
-			if (gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_xform_name))
-				gdps.Gdp->destroyAttribute(GA_ATTRIB_POINT, capture_xform_name);
-		}
-	}
-	else
+	// when only the points of input 0 changed, only the pages whose rest
+	// positions or group membership changed are recaptured
+	const bool incremental = reinitialize && capture_table.Stride > 0 &&
+		capture_key.allowsIncrementalCapture(sopcache->myCaptureKey);
+
+	// create debug capture attributes
+	const UT_StringHolder &rest_p_name("__rest_p");
+	const UT_StringHolder &capture_prims_name("__capture_prims");
+	const UT_StringHolder &capture_uvws_name("__capture_uvws");
+	const UT_StringHolder &capture_weights_name("__capture_weights");
+	const UT_StringHolder &capture_xform_name("__capture_xform");
+
+	CaptureAttributes capture_attribs;
+	CaptureAttributes_Info captureattribs_info;
+	if (radiuscapture_parm)
 	{
-		if (gdps.Gdp->findAttribute(GA_ATTRIB_POINT, capture_xform_name))
-			gdps.Gdp->destroyAttribute(GA_ATTRIB_POINT, capture_xform_name);
+		// the nearest primitives come from the closest point BVH of the
+		// whole rest lattice
+		captureattribs_info.RadiusCapture = !piece_parm && !packed && RayIntersectCache::isTriangleMesh(gdps.RestGdp);
+		if (!captureattribs_info.RadiusCapture)
+			cookparms.sopAddWarning(SOP_MESSAGE, "Radius capture needs a rest lattice of triangles without a piece attribute, capturing the nearest primitive instead.\n");
+		captureattribs_info.CaptureRadius = captureradius_parm;
+		captureattribs_info.MaxBindings = SYSclamp(maxbindings_parm, exint(1), ThreadedPointDeform::theMaxRadiusBindings);
 	}
+	captureattribs_info.CaptureMultiSamples = multisamples_parm && !drive_attrib_hs.Drive && !captureattribs_info.RadiusCapture;
+	if (captureattribs_info.CaptureMultiSamples)
+		ThreadedPointDeform::buildSampleDirs(samplepattern_parm, samplecount_parm, captureattribs_info.CaptureSampleDirs);
+	captureattribs_info.CaptureMinDistThresh = mindistthresh_parm;
+	captureattribs_info.Order = captureorder_parm;
+	captureattribs_info.XformRequired = attribnames_to_interpolate.size() > 0;
 
-	parms_value_attrib->bumpDataId();
-	base_meta_count_attrib->bumpDataId();
-	rest_meta_count_attrib->bumpDataId();
-	capture_attribs.RestP->bumpDataId();
-	capture_attribs.Prims->bumpDataId();
-	capture_attribs.UVWs->bumpDataId();
-	capture_attribs.Weights->bumpDataId();
+	if (exportcapture_parm)
+	{
+		capture_attribs.RestP = gdps.Gdp->addFloatTuple(GA_ATTRIB_POINT, rest_p_name, 3, (GA_Defaults)0.f, nullptr, nullptr, GA_STORE_REAL32);
+		capture_attribs.RestP->setTypeInfo(GA_TYPE_POINT);
+		capture_attribs.Prims = gdps.Gdp->addIntArray(GA_ATTRIB_POINT, capture_prims_name, 1);
+		capture_attribs.Prims->setTypeInfo(GA_TYPE_NONARITHMETIC_INTEGER);
+		capture_attribs.UVWs = gdps.Gdp->addFloatArray(GA_ATTRIB_POINT, capture_uvws_name, 2, nullptr, nullptr, GA_STORE_REAL16);
+		capture_attribs.UVWs->setTypeInfo(GA_TYPE_VECTOR);
+		capture_attribs.Weights = gdps.Gdp->addFloatArray(GA_ATTRIB_POINT, capture_weights_name, 1, nullptr, nullptr, GA_STORE_REAL16);
 
-	GOP_Manager group_parser;
-	bool success = false;
-	const GA_PointGroup *point_group = group_parser.parsePointDetached(group_parm, gdps.BaseGdp, false, success);
+		captureattribs_info.RestP_H.bind(capture_attribs.RestP);
+		captureattribs_info.CapturePrims_H.bind(capture_attribs.Prims);
+		captureattribs_info.CaptureUVWs_H.bind(capture_attribs.UVWs);
+		captureattribs_info.CaptureWeights_H.bind(capture_attribs.Weights);
 
-	if (group_parm && !success)
-		cookparms.sopAddWarning(SOP_ERR_BADGROUP, group_parm);
+		if (captureattribs_info.XformRequired)
+		{
+			capture_attribs.Xform = gdps.Gdp->addFloatTuple(
+				GA_ATTRIB_POINT, capture_xform_name, 9, (GA_Defaults)0.f, nullptr, nullptr, GA_STORE_REAL16);
+			capture_attribs.Xform->setTypeInfo(GA_TYPE_TRANSFORM);
+			captureattribs_info.Xform_H.bind(capture_attribs.Xform);
+		}
+	}
 
-	DriveAttrib_Info drive_attrib_hs;
-	if (drivebyattribs_parm)
+	GA_SplittableRange ptrange(std::move(gdps.Gdp->getPointRange(point_group)));
+	GA_SplittableRange capture_ptrange(ptrange);
+	GA_SplittableRange deform_ptrange(gdps.Gdp->getPointRange(deform_group ? deform_group.get() : point_group));
+
+	const bool read_capturefile = capturefilemode_parm == 1 && capturefile_parm.isstring();
+	const bool write_capturefile = capturefilemode_parm == 2 && capturefile_parm.isstring();
+	bool capturefile_loaded = false;
+	// error of the quantized bindings kept by an incremental recapture
+	const fpreal32 kept_quantize_error = capture_table.QuantizeError;
+
+	if (reinitialize)
 	{
-		const GA_Attribute *rest_normal_attrib = gdps.RestGdp->findAttribute(GA_ATTRIB_POINT, normalattrib_parm);
-		const GA_Attribute *rest_up_attrib = gdps.RestGdp->findAttribute(GA_ATTRIB_POINT, upattrib_parm);
-		const GA_Attribute *deformed_normal_attrib = gdps.DeformedGdp->findAttribute(GA_ATTRIB_POINT, normalattrib_parm);
-		const GA_Attribute *deformed_up_attrib = gdps.DeformedGdp->findAttribute(GA_ATTRIB_POINT, upattrib_parm);
+		sopcache->myCaptureKey = SOP_PointDeformByPrimCaptureKey();
+		sopcache->myWrittenCaptureFile.clear();
 
-		if (rest_normal_attrib && rest_up_attrib &&
-			deformed_normal_attrib && deformed_up_attrib)
+		UT_Array<SYS_HashType> page_hashes;
+		pointPageHashes(gdps.BaseGdp, ptrange, page_hashes);
+
+		if (read_capturefile)
 		{
-			drive_attrib_hs.Drive = true;
-			drive_attrib_hs.RestNormal_H.bind(rest_normal_attrib);
-			drive_attrib_hs.RestUp_H.bind(rest_up_attrib);
-			drive_attrib_hs.DeformedNormal_H.bind(deformed_normal_attrib);
-			drive_attrib_hs.DeformedUp_H.bind(deformed_up_attrib);
+			// bindings to a packed lattice index the shape of their instance
+			CaptureTableLimits limits;
+			limits.NumPrims = gdps.RestGdp->getNumPrimitives();
+			limits.NumPoints = gdps.RestGdp->getNumPoints();
+			if (packed)
+			{
+				limits.NumPrims = 0;
+				for (const PackedLattice::Instance &instance : rest_lattice.Instances)
+				{
+					const GU_Detail *shape_gdp = rest_lattice.Shapes[instance.Shape].Gdp;
+					limits.InstancePrims.append(shape_gdp->getNumPrimitives());
+					limits.InstancePoints.append(shape_gdp->getNumPoints());
+					limits.NumPrims = SYSmax(limits.NumPrims, limits.InstancePrims.last());
+				}
+			}
+
+			UT_WorkBuffer error;
+			capturefile_loaded = CaptureFile::read(capturefile_parm, capture_table, 
+				captureFileFingerprint(gdps, packed ? &rest_lattice : nullptr, piece_parm, drive_attrib_hs, capture_key, page_hashes), 
+				limits, error);
+			if (!capturefile_loaded)
+				cookparms.sopAddWarning(SOP_MESSAGE, error.buffer());
+		}
+
+		if (capturefile_loaded)
+			cook_stats.CaptureFileRead = true;
+		else if (incremental)
+		{
+			capture_table.resize(gdps.BaseGdp->getNumPointOffsets());
+
+			// drop the bindings of the dirty pages, their points in the
+			// range are captured again
+			const UT_Array<SYS_HashType> &cached_page_hashes = sopcache->myPageHashes;
+			UT_Array<uint8> dirty_pages;
+			dirty_pages.setSizeNoInit(page_hashes.size());
+			for (exint page = 0; page < page_hashes.size(); ++page)
+			{
+				dirty_pages[page] = page >= cached_page_hashes.size() || page_hashes[page] != cached_page_hashes[page];
+				if (!dirty_pages[page])
+					continue;
+
+				const exint page_end = SYSmin((page + 1) * GA_PAGE_SIZE, exint(capture_table.NumPointOffsets));
+				for (exint ptoff = page * GA_PAGE_SIZE; ptoff < page_end; ++ptoff)
+					capture_table.BindingCounts[ptoff] = 0;
+				++cook_stats.DirtyPages;
+			}
+
+			GA_OffsetList dirty_ptoffs;
+			GA_Offset start, end;
+			for (GA_Iterator it(ptrange); it.blockAdvance(start, end);)
+			{
+				for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+				{
+					if (dirty_pages[GAgetPageNum(ptoff)])
+						dirty_ptoffs.append(ptoff);
+				}
+			}
+			capture_ptrange = GA_SplittableRange(GA_Range(gdps.Gdp->getPointMap(), dirty_ptoffs));
 		}
 		else
 		{
-			cookparms.sopAddError(SOP_MESSAGE, "Rest or Deformed geometry stream doesn't have Normal/Up vector!\n");
-			return;
+			const exint stride = captureattribs_info.RadiusCapture ? captureattribs_info.MaxBindings : 
+								 1 + captureattribs_info.CaptureSampleDirs.size();
+			capture_table.reset(gdps.BaseGdp->getNumPointOffsets(), stride, 
+								packed ? polygonCornerStride(rest_lattice) : polygonCornerStride(gdps.RestGdp), 
+								captureattribs_info.XformRequired && !rebuildxform_parm, packed);
+			cook_stats.DirtyPages = page_hashes.size();
 		}
+
+		sopcache->myPageHashes = std::move(page_hashes);
 	}
 
-	GA_SplittableRange ptrange(std::move(gdps.Gdp->getPointRange(point_group)));
-    ThreadedPointDeform threaded_ptdeform(gdps, &ptrange, &drive_attrib_hs, &captureattribs_info, attribnames_to_interpolate);
+    ThreadedPointDeform threaded_ptdeform(
+		gdps, &deform_ptrange, &drive_attrib_hs, &captureattribs_info, &capture_table, &cook_stats, attribnames_to_interpolate);
+	if (packed)
+		threaded_ptdeform.setPackedLattices(&rest_lattice, &deformed_lattice);
+
+	cook_stats.addPhaseTime(CookPhase::AttributeSetup, phase_timer);
 	
-    if (reinitialize)
+	if (capturefile_loaded)
+	{
+		sopcache->myCaptureKey = capture_key;
+		sopcache->myWrittenCaptureFile = capturefile_parm;
+		cook_stats.Reinitialized = true;
+		++cook_stats.Reinitializations;
+		cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+	}
+    else if (reinitialize)
     {
+		ThreadedPointDeform threaded_ptcapture(
+			gdps, &capture_ptrange, &drive_attrib_hs, &captureattribs_info, &capture_table, &cook_stats, attribnames_to_interpolate);
+
+		if (packed)
+			threaded_ptcapture.setPackedLattices(&rest_lattice, nullptr);
+		else
+			threaded_ptcapture.buildPrimFrames(gdps.RestGdp, false);
+		cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+
+		sopcache->myClosestBvh.reset();
         if (piece_parm)
         {
 			if (gdps.RestGdp->findPrimitiveAttribute(piece_parm))
 			{
+				bool found = false;
 				if (gdps.Gdp->findAttribute(GA_ATTRIB_PRIMITIVE, piece_parm))
-					findPieceAttrib(gdps, cookparms, GA_ATTRIB_PRIMITIVE, threaded_ptdeform);
+					found = findPieceAttrib(gdps, cookparms, GA_ATTRIB_PRIMITIVE, packed ? &rest_lattice : nullptr, threaded_ptcapture, sopcache->myRays, cook_stats);
 				else if (gdps.Gdp->findAttribute(GA_ATTRIB_POINT, piece_parm))
-					findPieceAttrib(gdps, cookparms, GA_ATTRIB_POINT, threaded_ptdeform);
+					found = findPieceAttrib(gdps, cookparms, GA_ATTRIB_POINT, packed ? &rest_lattice : nullptr, threaded_ptcapture, sopcache->myRays, cook_stats);
 				else
-				{
 					cookparms.sopAddError(SOP_MESSAGE, "Cannot find the Piece attribute on the first input!\n");
+
+				if (!found)
 					return;
-				}
+
+				// the piece capture times its own phases
+				phase_timer.start();
 			}
 			else
 			{
@@ -658,26 +1569,137 @@ SOP_PointDeformByPrimVerb::cook(const CookParms &cookparms) const
 				return;
 			}
         }
+		else if (packed)
+		{
+			// without pieces every point takes the nearest instance
+			UT_Array<GU_RayIntersect *> instance_rays;
+			acquireShapeRays(rest_lattice, sopcache->myRays, instance_rays, cook_stats);
+			cook_stats.addPhaseTime(CookPhase::BVHBuild, phase_timer);
+
+			UT_Array<int32> point_instances;
+			threaded_ptcapture.findPointInstances(point_instances);
+			threaded_ptcapture.captureByPieceAttrib(point_instances, instance_rays);
+		}
         else
         {
-            GU_RayIntersect ray_rest(gdps.RestGdp, nullptr, true, false, true);
-            threaded_ptdeform.capture(&ray_rest);
+			// all-triangle lattices find the nearest hit in the closest point
+			// BVH, the intersector is only built for the multi-sample rays
+			bool built;
+			const RayIntersectKey rest_key = RayIntersectCache::key(gdps.RestGdp);
+			const bool triangles = RayIntersectCache::isTriangleMesh(gdps.RestGdp);
+			if (triangles)
+			{
+				sopcache->myClosestBvh = RayIntersectCache::acquireClosest(gdps.RestGdp, rest_key, built);
+				++(built ? cook_stats.BVHsBuilt : cook_stats.BVHsShared);
+				threaded_ptcapture.setClosestBvh(sopcache->myClosestBvh.get());
+			}
+
+			sopcache->myRays.clear();
+			if (!triangles || captureattribs_info.CaptureMultiSamples)
+			{
+				sopcache->myRays.setSize(1);
+				sopcache->myRays[0] = RayIntersectCache::acquire(gdps.RestGdp, nullptr, rest_key, built);
+				++(built ? cook_stats.BVHsBuilt : cook_stats.BVHsShared);
+			}
+			cook_stats.addPhaseTime(CookPhase::BVHBuild, phase_timer);
+            threaded_ptcapture.capture(sopcache->myRays.size() ? sopcache->myRays[0].get() : nullptr);
         }
-	
-		capture_attribs.RestP->bumpDataId();
-		capture_attribs.Prims->bumpDataId();
-		capture_attribs.UVWs->bumpDataId();
-		capture_attribs.Weights->bumpDataId();
-		if (captureattribs_info.XformRequired)
-			capture_attribs.Xform->bumpDataId();
-	
-		for (UT_StringHolder &attribname : attribnames_to_interpolate)
-			gdps.Gdp->findAttribute(GA_ATTRIB_POINT, attribname)->bumpDataId();
+
+		// bindings to a packed lattice index the primitives of their shape
+		GA_Size numprims = gdps.RestGdp->getNumPrimitives();
+		if (packed)
+		{
+			numprims = 0;
+			for (const PackedLattice::Shape &shape : rest_lattice.Shapes)
+				numprims = SYSmax(numprims, shape.Gdp->getNumPrimitives());
+		}
+		capture_table.buildReferencedPrims(numprims);
+		sopcache->myCaptureKey = capture_key;
+
+		if (quantizecapture_parm)
+		{
+			capture_table.quantize();
+			if (!capture_table.Quantized)
+				cookparms.sopAddWarning(SOP_MESSAGE, "The capture has too many corners per binding to be quantized, keeping the full precision capture.\n");
+			const fpreal32 quantize_error = SYSmax(threaded_ptcapture.measureCaptureError(), 
+												   incremental ? kept_quantize_error : 0.f);
+			if (quantize_error <= quantizetolerance_parm)
+			{
+				capture_table.releaseUnquantized();
+				capture_table.QuantizeError = quantize_error;
+			}
+			else
+			{
+				capture_table.discardQuantized();
+				UT_WorkBuffer warning;
+				warning.sprintf("Quantized capture error %g exceeds the tolerance, keeping the full precision capture.\n", quantize_error);
+				cookparms.sopAddWarning(SOP_MESSAGE, warning.buffer());
+			}
+		}
+
+		GA_Offset start, end;
+		for (GA_Iterator it(capture_ptrange); it.blockAdvance(start, end);)
+		{
+			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			{
+				const exint numbindings = capture_table.BindingCounts[ptoff];
+				cook_stats.Bindings += numbindings;
+				cook_stats.MaxBindings = SYSmax(cook_stats.MaxBindings, numbindings);
+				cook_stats.UnboundPoints += !numbindings;
+				++cook_stats.CapturedPoints;
+			}
+		}
+		cook_stats.Reinitialized = true;
+		cook_stats.Incremental = incremental;
+		++cook_stats.Reinitializations;
+		cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
     }
-		
+
+	if (write_capturefile && sopcache->myWrittenCaptureFile != capturefile_parm)
+	{
+		UT_WorkBuffer error;
+		if (CaptureFile::write(capturefile_parm, capture_table, 
+							   captureFileFingerprint(gdps, packed ? &rest_lattice : nullptr, piece_parm, drive_attrib_hs, capture_key, sopcache->myPageHashes), error))
+			sopcache->myWrittenCaptureFile = capturefile_parm;
+		else
+			cookparms.sopAddWarning(SOP_MESSAGE, error.buffer());
+		cook_stats.addPhaseTime(CookPhase::Capture, phase_timer);
+	}
+
+	if (!packed)
+		threaded_ptdeform.buildPrimFrames(gdps.DeformedGdp, true);
 	threaded_ptdeform.deform();
+	cook_stats.DeformedPoints = deform_ptrange.getEntries();
+	cook_stats.CaptureMemory = capture_table.getMemoryUsage();
+	cook_stats.Quantized = capture_table.Quantized;
+	cook_stats.QuantizeError = capture_table.QuantizeError;
+	cook_stats.addPhaseTime(CookPhase::Deform, phase_timer);
+
+	if (exportcapture_parm)
+	{
+		threaded_ptdeform.exportCapture();
+		cook_stats.addPhaseTime(CookPhase::AttributeSetup, phase_timer);
+	}
+
 	gdps.Gdp->getP()->bumpDataId();
 
 	for (UT_StringHolder &attribname : attribnames_to_interpolate)
 		gdps.Gdp->findAttribute(GA_ATTRIB_POINT, attribname)->bumpDataId();
-}
\ No newline at end of file
+	cook_stats.addPhaseTime(CookPhase::DataIdBump, phase_timer);
+
+	sopcache->myDeformValid = true;
+	sopcache->myDeformGroup = group_parm;
+	sopcache->myDeformSubsetGroup = deformgroup_parm;
+	sopcache->myDeformDriveByAttribs = drive_attrib_hs.Drive;
+	sopcache->myDeformNormalAttrib = normalattrib_parm;
+	sopcache->myDeformUpAttrib = upattrib_parm;
+	sopcache->myDeformAttribs = attribnames_to_interpolate;
+
+	if (exportcookstats_parm)
+		cook_stats.exportDetailAttribs(gdps.Gdp);
+
+	UT_String nodepath;
+	if (cookparms.getNode())
+		cookparms.getNode()->getFullPath(nodepath);
+	cook_stats.dumpJSON(UT_StringHolder(nodepath));
+}
@@ -5,6 +5,10 @@
 
 #include <SOP/SOP_Node.h>
 #include <UT/UT_StringHolder.h>
+#include <UT/UT_UniquePtr.h>
+#include <UT/UT_WorkBuffer.h>
+
+class SOP_PointDeformByPrimCache;
 
 namespace AKA
 {
@@ -19,6 +23,13 @@ public:
 
 	const SOP_NodeVerb *cookVerb() const override;
 
+	void getNodeSpecificInfoText(OP_Context &context, OP_NodeInfoParms &iparms) override;
+
+	// Deforms the mesh for every frame of the batch frame range and saves
+	// the results, with its own copy of the capture of a cook at time t.
+	// Several frames are deformed per pass over the capture table.
+	bool deformFrameRange(fpreal t, UT_WorkBuffer &errmsg);
+
 protected:
 	SOP_PointDeformByPrim(OP_Network *net, const char *name, OP_Operator *op);
 	~SOP_PointDeformByPrim();
@@ -33,6 +44,12 @@ private:
 	static PRM_ChoiceList s_PieceAttribMenu;
 	static PRM_ChoiceList s_AttribsMenu;
 
+	static int onDeformFrameRange(void *data, int index, fpreal t, const PRM_Template *);
+
+	// cache of the batch deform of a frame range, set while it forces the
+	// cook that fills it
+	UT_UniquePtr<SOP_PointDeformByPrimCache> myFrameRangeCache;
+
 };
 
 } // end AKA
@@ -1,191 +1,1171 @@
+#include <GA/GA_AIFSharedStringTuple.h>
+#include <GA/GA_ATINumeric.h>
 #include <GU/GU_Detail.h>
 #include <GU/GU_RayIntersect.h>
 #include <UT/UT_Assert.h>
+#include <UT/UT_ParallelUtil.h>
+#include <UT/UT_SmallArray.h>
+#include <UT/UT_ThreadSpecificValue.h>
 
 #include "ThreadedPointDeform.h"
+#include "core/Bvh.h"
+#include "core/CurveOrder.h"
+#include "core/Math.h"
+#include <algorithm>
 #include <iostream>
 
 using namespace AKA;
 
+namespace
+{
+
+// Four points worth of vectors in SoA layout for the batched deform kernel.
+struct Vector3x4
+{
+	Vector3x4() : X(0.f), Y(0.f), Z(0.f) {}
+	Vector3x4(const v4uf &x, const v4uf &y, const v4uf &z) : X(x), Y(y), Z(z) {}
+
+	Vector3x4 &operator+=(const Vector3x4 &v) { X += v.X; Y += v.Y; Z += v.Z; return *this; }
+
+	v4uf X, Y, Z;
+};
+
+inline Vector3x4 operator+(const Vector3x4 &a, const Vector3x4 &b) { return Vector3x4(a.X + b.X, a.Y + b.Y, a.Z + b.Z); }
+inline Vector3x4 operator-(const Vector3x4 &a, const Vector3x4 &b) { return Vector3x4(a.X - b.X, a.Y - b.Y, a.Z - b.Z); }
+inline Vector3x4 operator*(const Vector3x4 &a, const v4uf &s) { return Vector3x4(a.X * s, a.Y * s, a.Z * s); }
+
+inline Vector3x4
+cross(const Vector3x4 &a, const Vector3x4 &b)
+{
+	return Vector3x4(a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z, a.X * b.Y - a.Y * b.X);
+}
+
+inline Vector3x4
+normalize(const Vector3x4 &a)
+{
+	// the bias keeps degenerate lanes finite instead of dividing by zero
+	const v4uf inv_len = v4uf(1.f) / (a.X * a.X + a.Y * a.Y + a.Z * a.Z + v4uf(1e-30f)).sqrt();
+	return a * inv_len;
+}
+
+inline Core::Vec3
+toCore(const UT_Vector3F &v)
+{
+	return Core::Vec3(v.x(), v.y(), v.z());
+}
+
+// Rotation whose rows are the frame axes built from a normal and an up
+// vector. Capture and deform must use the same construction so the rest
+// and deformed frames match, the batched kernel mirrors it lane by lane.
+inline void
+buildFrame(UT_Matrix3F &rot, const UT_Vector3F &nrm, const UT_Vector3F &up)
+{
+	// the core tests check the frames of this same math
+	const Core::Mat3 frame = Core::buildFrame(toCore(nrm), toCore(up));
+	rot = UT_Matrix3F(frame.Rows[0].X, frame.Rows[0].Y, frame.Rows[0].Z,
+					  frame.Rows[1].X, frame.Rows[1].Y, frame.Rows[1].Z,
+					  frame.Rows[2].X, frame.Rows[2].Y, frame.Rows[2].Z);
+}
+
+// Whether the attribute is stored as fp32, the storage of the page handles.
+inline bool
+isReal32(const GA_Attribute *attrib)
+{
+	const GA_ATINumeric *numeric = GA_ATINumeric::cast(attrib);
+	return numeric && numeric->getStorage() == GA_STORE_REAL32;
+}
+
+// Resolves the piece id of every point from the piece id of its own element,
+// primitive pieces are promoted through the first vertex of the point.
+template<typename F>
+void
+findPointPiecesImpl(const Gdps &gdps,
+					const GA_SplittableRange &ptrange,
+					GA_AttributeOwner pieceattrib_owner,
+					const F &element_piece,
+					UT_Array<int32> &point_pieces)
+{
+	const GU_Detail *gdp = gdps.Gdp;
+
+	point_pieces.setSizeNoInit(gdp->getNumPointOffsets());
+	point_pieces.constant(-1);
+
+	UTparallelFor(ptrange, [&](const GA_SplittableRange &r)
+	{
+		GA_Offset start, end;
+		for (GA_Iterator it(r); it.blockAdvance(start, end);)
+		{
+			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			{
+				if (pieceattrib_owner == GA_ATTRIB_PRIMITIVE)
+				{
+					const GA_Offset vtxoff = gdp->pointVertex(ptoff);
+					if (GAisValid(vtxoff))
+						point_pieces[ptoff] = element_piece(gdp->vertexPrimitive(vtxoff));
+				}
+				else
+					point_pieces[ptoff] = element_piece(ptoff);
+			}
+		}
+	});
+}
+
+} // end anonymous namespace
+
 ThreadedPointDeform::ThreadedPointDeform(const Gdps &gdps,
 										 GA_SplittableRange *ptrange,
 										 DriveAttrib_Info *drive_attrib_hs,
 										 CaptureAttributes_Info *captureattribs_info,
+										 CaptureTable *capture_table,
+										 CookStats *cook_stats,
 										 const UT_Array<UT_StringHolder> &attribnames_to_interpolate)
 	: myGdps(gdps)
 	, myPtRange(ptrange)
 	, myDriveAttribHs(drive_attrib_hs)
 	, myBasePh(gdps.BaseGdp->getP())
-	, myPh(gdps.Gdp->getP())
+	, myRestPh(gdps.RestGdp->getP())
 	, myCaptureAttributes_Info(captureattribs_info)
+	, myCaptureTable(capture_table)
+	, myCookStats(cook_stats)
+	, myBatchedDeform(false)
+	, myRestLattice(nullptr)
+	, myDeformedLattice(nullptr)
+	, myClosestBvh(nullptr)
 {
 	for (const UT_StringHolder &attribname : attribnames_to_interpolate)
 	{
 		myBasePtAttribsh.emplace_back(gdps.BaseGdp->findAttribute(GA_ATTRIB_POINT, attribname));
-		myPtAttribsh.emplace_back(gdps.Gdp->findAttribute(GA_ATTRIB_POINT, attribname));
 	}
+
+	// all-triangle/quad lattices are deformed by the batched SIMD kernel
+	myBatchedDeform = !myDriveAttribHs->Drive &&
+		myCaptureTable->CornerStride >= 3 && myCaptureTable->CornerStride <= 4;
+}
+
+void
+ThreadedPointDeform::buildSampleDirs(SamplePattern pattern, exint count, UT_Array<UT_Vector3F> &dirs)
+{
+	dirs.clear();
+	switch (pattern)
+	{
+		case SamplePattern::Cross:
+			dirs = { { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f } };
+			break;
+		case SamplePattern::Tetrahedron:
+		{
+			const fpreal32 a = SYSsqrt(8.f / 9.f), b = SYSsqrt(2.f / 9.f), c = SYSsqrt(2.f / 3.f);
+			dirs = { { 0.f, 0.f, 1.f }, { a, 0.f, -1.f / 3.f }, { -b, c, -1.f / 3.f }, { -b, -c, -1.f / 3.f } };
+			break;
+		}
+		case SamplePattern::Octahedron:
+			dirs = { { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 0.f, -1.f } };
+			break;
+		case SamplePattern::Icosahedron:
+		{
+			const fpreal32 phi = 0.5f * (1.f + SYSsqrt(5.f));
+			for (fpreal32 s0 : { 1.f, -1.f })
+			{
+				for (fpreal32 s1 : { 1.f, -1.f })
+				{
+					dirs.append(UT_Vector3F(0.f, s0, s1 * phi));
+					dirs.append(UT_Vector3F(s0, s1 * phi, 0.f));
+					dirs.append(UT_Vector3F(s1 * phi, 0.f, s0));
+				}
+			}
+			break;
+		}
+		case SamplePattern::FibonacciHemisphere:
+		{
+			const fpreal32 golden_angle = M_PI * (3.f - SYSsqrt(5.f));
+			for (exint i = 0; i < count; ++i)
+			{
+				const fpreal32 dz = 1.f - (fpreal32(i) + 0.5f) / count;
+				const fpreal32 r = SYSsqrt(SYSmax(1.f - dz * dz, 0.f));
+				const fpreal32 theta = golden_angle * i;
+				dirs.append(UT_Vector3F(r * SYScos(theta), r * SYSsin(theta), dz));
+			}
+			break;
+		}
+	}
+
+	for (UT_Vector3F &dir : dirs)
+		dir.normalize();
 }
 
 void
-ThreadedPointDeform::pointCapture(GU_RayIntersect *ray_gdp, GA_Offset ptoff)
+ThreadedPointDeform::buildPrimFrames(const GU_Detail *gdp, bool referenced_only)
+{
+	computePrimFrames(gdp, referenced_only, myPrimFrames);
+}
+
+void
+ThreadedPointDeform::setPackedLattices(const PackedLattice *rest_lattice, const PackedLattice *deformed_lattice)
+{
+	myRestLattice = rest_lattice;
+	myDeformedLattice = deformed_lattice;
+
+	// the batched kernel gathers from a single lattice
+	myBatchedDeform = myBatchedDeform && !rest_lattice;
+
+	if (rest_lattice)
+		computeShapeFrames(*rest_lattice, myRestShapeFrames);
+	if (deformed_lattice)
+		computeShapeFrames(*deformed_lattice, myDeformedShapeFrames);
+}
+
+void
+ThreadedPointDeform::computeShapeFrames(const PackedLattice &lattice, UT_Array<PrimFrames> &shape_frames) const
+{
+	// the bindings of different instances use different primitives of a
+	// shape, so all of them get frames
+	shape_frames.setSize(lattice.Shapes.size());
+	UTparallelForEachNumber(lattice.Shapes.size(), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint shape = r.begin(); shape != r.end(); ++shape)
+			computePrimFrames(lattice.Shapes[shape].Gdp, false, shape_frames[shape]);
+	});
+}
+
+ThreadedPointDeform::RestLattice
+ThreadedPointDeform::restLattice(GA_Offset ptoff, const PrimFrames &frames) const
 {
+	if (!myRestLattice)
+		return { myGdps.RestGdp, &myRestPh, &frames, nullptr };
+
+	const PackedLattice::Instance &instance = myRestLattice->Instances[myCaptureTable->Instances[ptoff]];
+	const PackedLattice::Shape &shape = myRestLattice->Shapes[instance.Shape];
+	return { shape.Gdp, &shape.Ph, &myRestShapeFrames[instance.Shape], &instance };
+}
+
+void
+ThreadedPointDeform::computePrimFrames(const GU_Detail *gdp, bool referenced_only, PrimFrames &frames) const
+{
+	if (!myCaptureTable->hasCorners() || myDriveAttribHs->Drive)
+		return;
+
+	const GA_ROHandleV3 p_attrib_h(gdp->getP());
+	const GA_Size numprims = gdp->getNumPrimitives();
+	frames.Normals.setSizeNoInit(numprims);
+	frames.Anchors.setSizeNoInit(numprims);
+
+	const UT_Array<int32> &referenced_prims = myCaptureTable->ReferencedPrims;
+	const exint numitems = referenced_only ? referenced_prims.size() : exint(numprims);
+
+	UTparallelForLightItems(UT_BlockedRange<exint>(0, numitems), [&](const UT_BlockedRange<exint> &r)
+	{
+		for (exint item = r.begin(); item != r.end(); ++item)
+		{
+			const exint primidx = referenced_only ? exint(referenced_prims[item]) : item;
+			const GA_Primitive *prim = gdp->getPrimitive(gdp->primitiveOffset(GA_Index(primidx)));
+			const GA_Size vtxcount = prim->getVertexCount();
+
+			// Newell's method relative to the first corner, which also anchors the up vector
+			const UT_Vector3F first_pos = p_attrib_h.get(prim->getPointOffset(0));
+			UT_Vector3F prim_nrm(0.f), prev_edge(0.f);
+			for (GA_Size k = 1; k < vtxcount; ++k)
+			{
+				const UT_Vector3F edge = p_attrib_h.get(prim->getPointOffset(k)) - first_pos;
+				prim_nrm += cross(edge, prev_edge);
+				prev_edge = edge;
+			}
+			prim_nrm.normalize();
+
+			frames.Normals[primidx] = prim_nrm;
+			frames.Anchors[primidx] = first_pos;
+		}
+	});
+}
+
+void
+ThreadedPointDeform::pointCapture(GU_RayIntersect *ray_gdp, GA_Offset ptoff, CaptureSeed &seed, CaptureCounters &counters)
+{
+	CaptureTable &table = *myCaptureTable;
+	const exint binding_start = table.bindingStart(ptoff);
+	int32 *capture_prims = table.Prims.array() + binding_start;
+	UT_Vector2F *capture_uvs = table.UVs.array() + binding_start;
+	fpreal32 *capture_weights = table.Weights.array() + binding_start;
+	int32 capture_count = 0;
+
+	// bindings to a packed lattice are made in the space of the shape
+	const RestLattice lattice = restLattice(ptoff, myPrimFrames);
+	UT_Vector3F pos = myBasePh.get(ptoff);
+	if (lattice.Instance)
+		pos *= lattice.Instance->InverseXform;
+
 	TransformInfo trn_info;
-	trn_info.Pos = myBasePh.get(ptoff);
+	trn_info.Pos = pos;
+
+	if (myClosestBvh && myCaptureAttributes_Info->RadiusCapture)
+	{
+		// the nearest primitives within the radius, weighted by their
+		// distance falloff, points with none are left unbound
+		const fpreal32 radius2 = SYSsquare(myCaptureAttributes_Info->CaptureRadius);
+		Core::Bvh::Hit hits[theMaxRadiusBindings];
+		const int numhits = myClosestBvh->nearestPrims(toCore(trn_info.Pos), radius2, 
+													   int(SYSmin(table.Stride, theMaxRadiusBindings)), hits);
+		++counters.MinimumPointQueries;
+		if (!numhits)
+		{
+			table.BindingCounts[ptoff] = 0;
+			return;
+		}
 
-	GU_MinInfo min_info;
-	ray_gdp->minimumPoint(trn_info.Pos, min_info);
+		fpreal32 total_weight = 0.f;
+		for (int idx = 0; idx < numhits; ++idx)
+		{
+			capture_prims[idx] = hits[idx].Prim;
+			capture_uvs[idx].assign(hits[idx].Weights.Y, hits[idx].Weights.Z);
+			capture_weights[idx] = Core::falloffWeight(hits[idx].Dist2, radius2);
+			total_weight += capture_weights[idx];
+		}
+		// hits right at the radius all fall off to 0
+		for (int idx = 0; idx < numhits; ++idx)
+			capture_weights[idx] = total_weight > 0.f ? capture_weights[idx] / total_weight : 1.f / numhits;
+		capture_count = numhits;
+		trn_info.PrimPosition.assign(hits[0].Pos.X, hits[0].Pos.Y, hits[0].Pos.Z, 1.f);
+	}
+	else if (myClosestBvh)
+	{
+		// the parametric uv of a triangle are the weights of its last two corners
+		Core::Bvh::Hit hit;
+		if (seed.Valid)
+			myClosestBvh->closestPoint(toCore(trn_info.Pos), toCore(seed.Pos), hit);
+		else
+			myClosestBvh->closestPoint(toCore(trn_info.Pos), hit);
+		capture_prims[capture_count] = hit.Prim;
+		capture_uvs[capture_count].assign(hit.Weights.Y, hit.Weights.Z);
+		trn_info.PrimPosition.assign(hit.Pos.X, hit.Pos.Y, hit.Pos.Z, 1.f);
+		capture_weights[capture_count] = 1.f;
+		++capture_count;
+		++counters.MinimumPointQueries;
+	}
+	else
+	{
+		// the previous nearest position is on the lattice, nothing nearer
+		// lies beyond it, the slack keeps its primitive inside the bound
+		GU_MinInfo min_info(0.f, seed.Valid ? (seed.Pos - trn_info.Pos).length() * theSeedSlack + 1e-6f : 1e18f);
+		if (ray_gdp->minimumPoint(trn_info.Pos, min_info) < 1)
+		{
+			min_info = GU_MinInfo();
+			ray_gdp->minimumPoint(trn_info.Pos, min_info);
+		}
+		capture_prims[capture_count] = min_info.prim->getMapIndex();
+		capture_uvs[capture_count].assign(min_info.u1, min_info.v1);
+		min_info.prim->evaluateInteriorPoint(trn_info.PrimPosition, min_info.u1, min_info.v1);
+		capture_weights[capture_count] = 1.f;
+		++capture_count;
+		++counters.MinimumPointQueries;
+	}
 
-	trn_info.CapturePrims.emplace_back(min_info.prim->getMapIndex());
-	trn_info.CaptureUVWs.emplace_back(min_info.u1);
-	trn_info.CaptureUVWs.emplace_back(min_info.v1);
-	trn_info.CaptureWeights.emplace_back(1.f);
+	if (myCaptureAttributes_Info->Order != CaptureOrder::Offset)
+	{
+		seed.Pos.assign(trn_info.PrimPosition[0], trn_info.PrimPosition[1], trn_info.PrimPosition[2]);
+		seed.Valid = true;
+	}
 
-	min_info.prim->evaluateInteriorPoint(trn_info.PrimPosition, min_info.u1, min_info.v1);
 	UT_Vector3F min_dir = trn_info.PrimPosition - trn_info.Pos;
 	fpreal32 min_dist = min_dir.length();
 	min_dir.normalize();
 
+	const UT_Array<UT_Vector3F> &sample_dirs = myCaptureAttributes_Info->CaptureSampleDirs;
 	if (min_dist > myCaptureAttributes_Info->CaptureMinDistThresh && 
 		myCaptureAttributes_Info->CaptureMultiSamples && !myDriveAttribHs->Drive)
 	{
-		UT_Vector3F x, y;
-		fpreal32 max_ray_dist, max_dist;
-
+		// sample frame of the point, z points away from the nearest hit
+		UT_Vector3F x, y, z;
+		z = -min_dir;
 		y = { 0.f, 1.f, 0.f };
-		if (min_dir.dot(UT_Vector3H(0.f, 1.f, 0.f)) > 0.99f)
+		if (SYSabs(min_dir.dot(y)) > 0.99f)
 			y = { 1.f, 0.f, 0.f };
 		y = cross(y, min_dir);
+		y.normalize();
 		x = cross(y, min_dir);
-		UT_Array<UT_Vector3F> dirs{ -min_dir, y, -y, x, -x };
 
-		max_dist = 1.f;
-		max_ray_dist = SYSmax(min_dist, 0.001f) * 1e+3f;
-		for (UT_Vector3F &dir : dirs)
+		// all the samples share the origin and the ray extent, the hit
+		// distance is the ray parameter of the unit length directions
+		fpreal32 max_dist = 1.f;
+		const fpreal32 max_ray_dist = SYSmax(min_dist, 0.001f) * 1e+3f;
+		const exint numsamples = SYSmin(sample_dirs.size(), table.Stride - 1);
+		for (exint sample = 0; sample < numsamples; ++sample)
 		{
+			const UT_Vector3F &local_dir = sample_dirs[sample];
+			const UT_Vector3F dir = x * local_dir.x() + y * local_dir.y() + z * local_dir.z();
+
 			GU_RayInfo ray_info(max_ray_dist, min_dist);
 			int32 hit = ray_gdp->sendRay(trn_info.Pos, dir, ray_info);
+			++counters.RaysSent;
 			if (hit < 1)
 				continue;
 
-			ray_info.myPrim->evaluateInteriorPoint(trn_info.PrimPosition, ray_info.myU, ray_info.myV);
-			fpreal32 hit_dist = (trn_info.PrimPosition - trn_info.Pos).length();
-			fpreal32 dist_ratio = min_dist / hit_dist;
+			fpreal32 dist_ratio = min_dist / SYSmax(fpreal32(ray_info.myT), min_dist);
 			max_dist += dist_ratio;
 
-			trn_info.CapturePrims.emplace_back(ray_info.myPrim->getMapIndex());
-			trn_info.CaptureUVWs.emplace_back(ray_info.myU);
-			trn_info.CaptureUVWs.emplace_back(ray_info.myV);
-			trn_info.CaptureWeights.emplace_back(dist_ratio);
+			capture_prims[capture_count] = ray_info.myPrim->getMapIndex();
+			capture_uvs[capture_count].assign(ray_info.myU, ray_info.myV);
+			capture_weights[capture_count] = dist_ratio;
+			++capture_count;
 		}
 
 		fpreal32 delta = 1.f / max_dist;
-		for (int i = 0; i < trn_info.CaptureWeights.size(); ++i)
-			trn_info.CaptureWeights[i] *= delta;
+		for (int32 i = 0; i < capture_count; ++i)
+			capture_weights[i] *= delta;
 	}
 
-	buildXform(trn_info, myGdps.RestGdp, myDriveAttribHs->RestNormal_H, myDriveAttribHs->RestUp_H);
+	table.BindingCounts[ptoff] = capture_count;
+	if (table.hasCorners())
+		resolveCorners(ptoff, lattice.Gdp);
+	bindCapture(trn_info, ptoff);
+
+	buildXform(trn_info, lattice.Gdp, *lattice.Ph, myDriveAttribHs->RestNormal_H, myDriveAttribHs->RestUp_H, *lattice.Frames);
 	trn_info.Rot.invert();
 
-	trn_info.Pos = myBasePh.get(ptoff);
+	trn_info.Pos = pos;
 	trn_info.Pos -= trn_info.WeightedPos;
 	trn_info.Pos.rowVecMult(trn_info.Rot);
 
-	myCaptureAttributes_Info->RestP_H.set(ptoff, trn_info.Pos);
-	myCaptureAttributes_Info->CapturePrims_H.set(ptoff, trn_info.CapturePrims);
-	myCaptureAttributes_Info->CaptureUVWs_H.set(ptoff, trn_info.CaptureUVWs);
-	myCaptureAttributes_Info->CaptureWeights_H.set(ptoff, trn_info.CaptureWeights);
-	if (myCaptureAttributes_Info->XformRequired)
-		myCaptureAttributes_Info->Xform_H.set(ptoff, trn_info.Rot);
+	table.RestP[ptoff] = trn_info.Pos;
+	if (table.HasXform)
+		table.Xform[ptoff].updateFromRotationMatrix(trn_info.Rot);
 }
 
 void
-ThreadedPointDeform::capturePartial(GU_RayIntersect *ray_gdp, const UT_JobInfo &info)
+ThreadedPointDeform::resolveCorners(GA_Offset ptoff, const GU_Detail *rest_gdp)
 {
-	for (GA_PageIterator pit = myPtRange->beginPages(info); !pit.atEnd(); ++pit)
+	CaptureTable &table = *myCaptureTable;
+	const GA_IndexMap &prim_map = rest_gdp->getIndexMap(GA_ATTRIB_PRIMITIVE);
+	const exint binding_start = table.bindingStart(ptoff);
+	const int32 capture_count = table.BindingCounts[ptoff];
+
+	UT_SmallArray<GA_Offset> vtxoffsets;
+	UT_SmallArray<fpreal32> weightlist;
+
+	for (int32 idx = 0; idx < capture_count; ++idx)
 	{
-		GA_Offset start, end;
+		const exint binding = binding_start + idx;
+		const exint corner_start = table.cornerStart(binding);
+		const UT_Vector2F &uv = table.UVs[binding];
+		const GEO_Primitive *geo_prim = rest_gdp->getGEOPrimitive(prim_map.offsetFromIndex(table.Prims[binding]));
 
-		for (GA_Iterator it(pit.begin()); it.blockAdvance(start, end);)
+		// polygons with more corners than the stride are evaluated through
+		// the primitive
+		const GA_Size vtxcount = geo_prim->getVertexCount();
+		if (vtxcount > table.CornerStride)
 		{
-			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
-				pointCapture(ray_gdp, ptoff);
+			table.CornerCounts[binding] = 0;
+			continue;
+		}
+
+		table.CornerCounts[binding] = int32(vtxcount);
+		for (GA_Size k = 0; k < vtxcount; ++k)
+		{
+			table.CornerPts[corner_start + k] = int32(rest_gdp->pointIndex(geo_prim->getPointOffset(k)));
+			table.CornerWeights[corner_start + k] = 0.f;
 		}
+
+		// spread the interpolation weights over the corners in vertex order
+		geo_prim->computeInteriorPointWeights(vtxoffsets, weightlist, uv[0], uv[1], 0.f);
+		for (exint j = 0; j < vtxoffsets.size(); ++j)
+		{
+			for (GA_Size k = 0; k < vtxcount; ++k)
+			{
+				if (geo_prim->getVertexOffset(k) == vtxoffsets[j])
+				{
+					table.CornerWeights[corner_start + k] += weightlist[j];
+					break;
+				}
+			}
+		}
+	}
+}
+
+void
+ThreadedPointDeform::bindCapture(TransformInfo &trn_info, GA_Offset ptoff) const
+{
+	const exint binding_start = myCaptureTable->bindingStart(ptoff);
+	trn_info.CapturePrims = myCaptureTable->Prims.array() + binding_start;
+	trn_info.BindingStart = binding_start;
+	trn_info.CaptureCount = myCaptureTable->BindingCounts[ptoff];
+
+	if (myCaptureTable->hasCorners())
+	{
+		trn_info.CornerStart = myCaptureTable->cornerStart(binding_start);
+		trn_info.CornerPts = myCaptureTable->CornerPts.array() + trn_info.CornerStart;
+	}
+}
+
+void
+ThreadedPointDeform::sortByCaptureOrder(GA_Offset *ptoffs, exint count) const
+{
+	const CaptureOrder order = myCaptureAttributes_Info->Order;
+	if (order == CaptureOrder::Offset || count < 2)
+		return;
+
+	std::vector<Core::Vec3> positions(count);
+	for (exint idx = 0; idx < count; ++idx)
+		positions[idx] = toCore(myBasePh.get(ptoffs[idx]));
+
+	std::vector<int64_t> curve_order;
+	Core::curveOrder(positions, order == CaptureOrder::Hilbert ? Core::Curve::Hilbert : Core::Curve::Morton, curve_order);
+
+	GA_OffsetArray sorted_ptoffs;
+	sorted_ptoffs.setSizeNoInit(count);
+	for (exint idx = 0; idx < count; ++idx)
+		sorted_ptoffs[idx] = ptoffs[curve_order[idx]];
+	std::copy(sorted_ptoffs.begin(), sorted_ptoffs.end(), ptoffs);
+}
+
+void
+ThreadedPointDeform::capture(GU_RayIntersect *ray_gdp)
+{
+	// the bindings are written by offset, whatever order they are made in
+	GA_OffsetArray ptoffs;
+	GA_Offset start, end;
+	for (GA_Iterator it(*myPtRange); it.blockAdvance(start, end);)
+	{
+		for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			ptoffs.append(ptoff);
 	}
+	sortByCaptureOrder(ptoffs.array(), ptoffs.size());
+
+	UTparallelFor(UT_BlockedRange<exint>(0, ptoffs.size(), theCaptureGrainSize), [&](const UT_BlockedRange<exint> &r)
+	{
+		Timer busy_timer;
+		CaptureCounters counters;
+		CaptureSeed seed;
+		for (exint idx = r.begin(); idx != r.end(); ++idx)
+			pointCapture(ray_gdp, ptoffs[idx], seed, counters);
+		myCookStats->addCaptureCounters(counters);
+		myCookStats->addCaptureBusyTime(busy_timer.elapsed());
+	});
 }
 
 void
-ThreadedPointDeform::captureByPieceAttribPartial(GA_ROHandleI pieceattrib_h, 
-												 MapRay<int32> rest_prim_rays, 
-												 const UT_JobInfo &info)
+ThreadedPointDeform::findPointPieces(GA_ROHandleI pieceattrib_h, 
+									 const MapPieceId<int32> &piece_ids, 
+									 UT_Array<int32> &point_pieces) const
 {
+	findPointPiecesImpl(myGdps, *myPtRange, pieceattrib_h.getAttribute()->getOwner(), 
+		[&](GA_Offset elemoff)
+		{
+			auto piece_it = piece_ids.Map.find(pieceattrib_h.get(elemoff));
+			return piece_it != piece_ids.Map.end() ? piece_it->second : -1;
+		}, point_pieces);
+}
+
+void
+ThreadedPointDeform::findPointPieces(GA_ROHandleS pieceattrib_h, 
+									 const MapPieceId<UT_StringHolder> &piece_ids, 
+									 UT_Array<int32> &point_pieces) const
+{
+	// map every string of the table to its piece once so that points are
+	// resolved by string index without hashing their value
 	const GA_Attribute *pieceattrib = pieceattrib_h.getAttribute();
-	const GA_AttributeOwner &pieceattrib_owner = pieceattrib->getOwner();
+	const GA_AIFSharedStringTuple *pieceattrib_stuple = pieceattrib->getAIFSharedStringTuple();
 
-	for (GA_PageIterator pit = myPtRange->beginPages(info); !pit.atEnd(); ++pit)
+	UT_Array<int32> stridx_pieces;
+	for (GA_AIFSharedStringTuple::iterator it = pieceattrib_stuple->begin(pieceattrib); !it.atEnd(); ++it)
+	{
+		const exint stridx = exint(it.getIndex());
+		if (stridx >= stridx_pieces.size())
+		{
+			const exint oldsize = stridx_pieces.size();
+			stridx_pieces.setSizeNoInit(stridx + 1);
+			for (exint i = oldsize; i < stridx_pieces.size(); ++i)
+				stridx_pieces[i] = -1;
+		}
+
+		auto piece_it = piece_ids.Map.find(UT_StringHolder(it.getString()));
+		if (piece_it != piece_ids.Map.end())
+			stridx_pieces[stridx] = piece_it->second;
+	}
+
+	findPointPiecesImpl(myGdps, *myPtRange, pieceattrib->getOwner(), 
+		[&](GA_Offset elemoff)
+		{
+			const exint stridx = exint(pieceattrib_h.getIndex(elemoff));
+			return stridx >= 0 && stridx < stridx_pieces.size() ? stridx_pieces[stridx] : -1;
+		}, point_pieces);
+}
+
+void
+ThreadedPointDeform::findPointInstances(UT_Array<int32> &point_instances) const
+{
+	point_instances.setSizeNoInit(myGdps.Gdp->getNumPointOffsets());
+	point_instances.constant(-1);
+
+	UTparallelFor(*myPtRange, [&](const GA_SplittableRange &r)
 	{
 		GA_Offset start, end;
+		for (GA_Iterator it(r); it.blockAdvance(start, end);)
+		{
+			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+				point_instances[ptoff] = int32(myRestLattice->findInstance(myBasePh.get(ptoff)));
+		}
+	});
+}
+
+void
+ThreadedPointDeform::captureByPieceAttrib(const UT_Array<int32> &point_pieces, 
+										  const UT_Array<GU_RayIntersect *> &piece_rays)
+{
+	// counting sort of the points by piece
+	const exint numpieces = piece_rays.size();
+	UT_Array<exint> piece_starts;
+	piece_starts.setSizeNoInit(numpieces + 1);
+	piece_starts.constant(0);
+
+	GA_Offset start, end;
+	for (GA_Iterator it(*myPtRange); it.blockAdvance(start, end);)
+	{
+		for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+		{
+			if (point_pieces[ptoff] >= 0)
+				++piece_starts[point_pieces[ptoff] + 1];
+		}
+	}
+
+	for (exint piece = 0; piece < numpieces; ++piece)
+		piece_starts[piece + 1] += piece_starts[piece];
+
+	GA_OffsetArray bucketed_ptoffs;
+	bucketed_ptoffs.setSizeNoInit(piece_starts[numpieces]);
+	UT_Array<exint> piece_cursors(piece_starts);
+	for (GA_Iterator it(*myPtRange); it.blockAdvance(start, end);)
+	{
+		for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+		{
+			if (point_pieces[ptoff] < 0)
+				continue;
+			bucketed_ptoffs[piece_cursors[point_pieces[ptoff]]++] = ptoff;
+			if (myRestLattice)
+				myCaptureTable->Instances[ptoff] = point_pieces[ptoff];
+		}
+	}
+
+	if (myCaptureAttributes_Info->Order != CaptureOrder::Offset)
+	{
+		UTparallelFor(UT_BlockedRange<exint>(0, numpieces), [&](const UT_BlockedRange<exint> &r)
+		{
+			for (exint piece = r.begin(); piece != r.end(); ++piece)
+				sortByCaptureOrder(bucketed_ptoffs.array() + piece_starts[piece], piece_starts[piece + 1] - piece_starts[piece]);
+		});
+	}
 
+	UTparallelFor(UT_BlockedRange<exint>(0, bucketed_ptoffs.size(), theCaptureGrainSize), [&](const UT_BlockedRange<exint> &r)
+	{
+		Timer busy_timer;
+		CaptureCounters counters;
+		CaptureSeed seed;
+		exint piece = std::upper_bound(piece_starts.begin(), piece_starts.end(), r.begin()) - piece_starts.begin() - 1;
+		for (exint idx = r.begin(); idx != r.end(); ++idx)
+		{
+			// seeds do not carry over to the lattice of another piece
+			for (; idx >= piece_starts[piece + 1]; ++piece)
+				seed.Valid = false;
+			pointCapture(piece_rays[piece], bucketed_ptoffs[idx], seed, counters);
+		}
+		myCookStats->addCaptureCounters(counters);
+		myCookStats->addCaptureBusyTime(busy_timer.elapsed());
+	});
+}
+
+void
+ThreadedPointDeform::deform()
+{
+	buildRestFrames();
+
+	UT_Array<DeformTarget> targets;
+	DeformTarget &target = targets[targets.append()];
+	bindTarget(target, myGdps.DeformedGdp, myGdps.Gdp, &myPrimFrames);
+	if (myDeformedLattice)
+	{
+		target.Lattice = myDeformedLattice;
+		target.ShapeFrames = &myDeformedShapeFrames;
+	}
+	deformTargets(&targets);
+}
+
+bool
+ThreadedPointDeform::deformFrames(const UT_Array<const GU_Detail *> &deformed_gdps, 
+								  const UT_Array<GU_Detail *> &gdps, 
+								  UT_WorkBuffer &errmsg)
+{
+	UT_ASSERT(deformed_gdps.size() == gdps.size());
+	buildRestFrames();
+
+	UT_Array<PrimFrames> frames;
+	UT_Array<DeformTarget> targets;
+	UT_Array<PackedLattice> lattices;
+	UT_Array<UT_Array<PrimFrames>> shape_frames;
+	frames.setSize(deformed_gdps.size());
+	targets.setSize(deformed_gdps.size());
+	if (myRestLattice)
+	{
+		lattices.setSize(deformed_gdps.size());
+		shape_frames.setSize(deformed_gdps.size());
+	}
+	for (exint frame = 0; frame < deformed_gdps.size(); ++frame)
+	{
+		bindTarget(targets[frame], deformed_gdps[frame], gdps[frame], &frames[frame]);
+		if (!myRestLattice)
+		{
+			computePrimFrames(deformed_gdps[frame], true, frames[frame]);
+			continue;
+		}
+
+		if (!lattices[frame].build(deformed_gdps[frame], errmsg))
+			return false;
+		if (!lattices[frame].matches(*myRestLattice))
+		{
+			errmsg.sprintf("Deformed packed lattice of frame %d doesn't match the rest lattice.", int(frame));
+			return false;
+		}
+		computeShapeFrames(lattices[frame], shape_frames[frame]);
+		targets[frame].Lattice = &lattices[frame];
+		targets[frame].ShapeFrames = &shape_frames[frame];
+	}
+
+	deformTargets(&targets);
+	return true;
+}
+
+void
+ThreadedPointDeform::bindTarget(DeformTarget &target, 
+								const GU_Detail *deformed_gdp, 
+								GU_Detail *gdp, 
+								const PrimFrames *frames) const
+{
+	target.DeformedGdp = deformed_gdp;
+	target.DeformedPh.bind(deformed_gdp->getP());
+	if (myDriveAttribHs->Drive)
+	{
+		target.DeformedNormal_H.bind(deformed_gdp->findPointAttribute(myDriveAttribHs->DeformedNormal_H.getAttribute()->getName()));
+		target.DeformedUp_H.bind(deformed_gdp->findPointAttribute(myDriveAttribHs->DeformedUp_H.getAttribute()->getName()));
+	}
+	target.Frames = frames;
+
+	target.Ph.bind(gdp->getP());
+	target.PtAttribs.clear();
+	for (const GA_ROHandleV3 &base_attrib_h : myBasePtAttribsh)
+		target.PtAttribs.append(gdp->findPointAttribute(base_attrib_h.getAttribute()->getName()));
+}
+
+void
+ThreadedPointDeform::deformTargetsPartial(const UT_Array<DeformTarget> *targets, const UT_JobInfo &info)
+{
+	const CaptureTable &table = *myCaptureTable;
+	const exint numtargets = targets->size();
+	const bool transform_attribs = myCaptureAttributes_Info->XformRequired;
+	GA_Offset batch[theBatchSize];
+	PointXform batch_xforms[theBatchSize];
+	UT_Matrix3F batch_inverse_rests[theBatchSize];
+	exint batch_size = 0;
+
+	// transforms of the points of the current page for every target, the
+	// attributes are transformed from them after the P pass of the page
+	UT_Array<PointXform> page_xforms;
+	UT_Array<uint8> page_bound;
+	if (transform_attribs)
+	{
+		page_xforms.setSizeNoInit(numtargets * GA_PAGE_SIZE);
+		page_bound.setSizeNoInit(GA_PAGE_SIZE);
+	}
+
+	auto flushBatch = [&](GA_Offset page_start)
+	{
+		// the rest frames are shared by all the targets
+		if (transform_attribs)
+		{
+			for (exint i = 0; i < batch_size; ++i)
+				batch_inverse_rests[i] = inverseRestXform(batch[i]);
+		}
+		for (exint target = 0; target < numtargets; ++target)
+		{
+			deformBatch(batch, batch_size, (*targets)[target], batch_inverse_rests, transform_attribs ? batch_xforms : nullptr);
+			if (!transform_attribs)
+				continue;
+			for (exint i = 0; i < batch_size; ++i)
+				page_xforms[target * GA_PAGE_SIZE + (batch[i] - page_start)] = batch_xforms[i];
+		}
+		batch_size = 0;
+	};
+
+	// every batch of points is deformed for all the targets while its
+	// bindings are still in cache
+	for (GA_PageIterator pit = myPtRange->beginPages(info); !pit.atEnd(); ++pit)
+	{
+		const GA_Offset page_start = GA_Offset(exint(GAgetPageNum(pit.getFirstOffsetInPage())) * GA_PAGE_SIZE);
+		if (transform_attribs)
+			page_bound.constant(0);
+
+		GA_Offset start, end;
 		for (GA_Iterator it(pit.begin()); it.blockAdvance(start, end);)
 		{
 			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
 			{
-				int32 pieceattrib_val;
-				if (pieceattrib_owner == GA_ATTRIB_PRIMITIVE)
+				if (!table.BindingCounts[ptoff])
+					continue;
+				if (transform_attribs)
+					page_bound[ptoff - page_start] = 1;
+
+				// the kernel gathers the corners of every binding, points
+				// with a binding without corners take the scalar path
+				if (myBatchedDeform && hasAllCorners(ptoff))
 				{
-					GA_OffsetArray prims;
-					myGdps.Gdp->getPrimitivesReferencingPoint(prims, ptoff);
-					pieceattrib_val = pieceattrib_h.get(prims[0]);
+					batch[batch_size++] = ptoff;
+					if (batch_size == theBatchSize)
+						flushBatch(page_start);
+					continue;
 				}
-				else
-					pieceattrib_val = pieceattrib_h.get(ptoff);
 
-				if (rest_prim_rays.Map.find(pieceattrib_val) == rest_prim_rays.Map.end())
-					continue;
+				TransformInfo trn_info;
+				bindCapture(trn_info, ptoff);
+				const UT_Matrix3F inverse_rest = transform_attribs ? inverseRestXform(ptoff) : UT_Matrix3F(1.f);
 
-				pointCapture(rest_prim_rays.Map.at(pieceattrib_val), ptoff);
+				for (exint target = 0; target < numtargets; ++target)
+				{
+					const DeformTarget &deform_target = (*targets)[target];
+					buildTargetXform(trn_info, ptoff, deform_target);
+					deform_target.Ph.set(ptoff, trn_info.Pos);
+					if (transform_attribs)
+						buildPointXform(ptoff, inverse_rest, trn_info.Rot, trn_info.Pos, page_xforms[target * GA_PAGE_SIZE + (ptoff - page_start)]);
+				}
 			}
 		}
+
+		if (batch_size)
+			flushBatch(page_start);
+
+		if (transform_attribs)
+			transformPageAttribs(pit, page_start, *targets, page_xforms, page_bound);
 	}
 }
 
 void
-ThreadedPointDeform::captureByPieceAttribPartial(GA_ROHandleS pieceattrib_h, 
-												 MapRay<UT_StringHolder> rest_prim_rays, 
-												 const UT_JobInfo &info)
+ThreadedPointDeform::buildTargetXform(TransformInfo &trn_info, GA_Offset ptoff, const DeformTarget &target) const
 {
-	const GA_Attribute* pieceattrib = pieceattrib_h.getAttribute();
-	const GA_AttributeOwner& pieceattrib_owner = pieceattrib->getOwner();
+	if (!target.Lattice)
+	{
+		buildXform(trn_info, target.DeformedGdp, target.DeformedPh, 
+				   target.DeformedNormal_H, target.DeformedUp_H, *target.Frames);
+		trn_info.Pos = myCaptureTable->restP(ptoff);
+		trn_info.Pos.rowVecMult(trn_info.Rot);
+		trn_info.Pos += trn_info.WeightedPos;
+		return;
+	}
 
-	for (GA_PageIterator pit = myPtRange->beginPages(info); !pit.atEnd(); ++pit)
+	// deformed instances pair up with the rest instances in primitive order
+	const PackedLattice::Instance &instance = target.Lattice->Instances[myCaptureTable->Instances[ptoff]];
+	const PackedLattice::Shape &shape = target.Lattice->Shapes[instance.Shape];
+	buildXform(trn_info, shape.Gdp, shape.Ph, 
+			   target.DeformedNormal_H, target.DeformedUp_H, (*target.ShapeFrames)[instance.Shape]);
+	trn_info.Pos = myCaptureTable->restP(ptoff);
+	trn_info.Pos.rowVecMult(trn_info.Rot);
+	trn_info.Pos += trn_info.WeightedPos;
+	trn_info.Pos *= instance.Xform;
+	trn_info.Rot *= UT_Matrix3F(instance.Xform);
+}
+
+void
+ThreadedPointDeform::buildPointXform(GA_Offset ptoff, 
+									 const UT_Matrix3F &inverse_rest, 
+									 const UT_Matrix3F &rot, 
+									 const UT_Vector3F &deformed_pos, 
+									 PointXform &xform) const
+{
+	xform.Rot = inverse_rest;
+	xform.Rot *= rot;
+
+	UT_Vector3F base_pos = myBasePh.get(ptoff);
+	base_pos.rowVecMult(xform.Rot);
+	xform.Translate = deformed_pos - base_pos;
+}
+
+void
+ThreadedPointDeform::transformPageAttribs(const GA_PageIterator &pit,
+										  GA_Offset page_start,
+										  const UT_Array<DeformTarget> &targets,
+										  const UT_Array<PointXform> &page_xforms,
+										  const UT_Array<uint8> &page_bound) const
+{
+	// one attribute at a time through page handles, so every pass streams
+	// a single source and destination page. The page handles are fp32,
+	// attributes of other storages are converted by element handles.
+	GA_ROPageHandleV3 base_ph;
+	GA_RWPageHandleV3 ph;
+	for (exint idx = 0; idx < myBasePtAttribsh.size(); ++idx)
 	{
-		GA_Offset start, end;
+		const GA_ROHandleV3 &base_h = myBasePtAttribsh[idx];
+		const bool base_real32 = isReal32(base_h.getAttribute());
+		if (base_real32)
+		{
+			base_ph.bind(base_h.getAttribute());
+			base_ph.setPage(page_start);
+		}
 
-		for (GA_Iterator it(pit.begin()); it.blockAdvance(start, end);)
+		// the frames are orthonormal so the inverse transpose of the linear
+		// part is the part itself, normals are rotated like vectors and
+		// only points are translated. Instance transforms may scale or shear,
+		// normals on packed targets take the inverse transpose and keep
+		// their length.
+		const GA_TypeInfo typeinfo = base_h.getAttribute()->getTypeInfo();
+		const bool translate = typeinfo == GA_TYPE_POINT;
+		const bool normal = typeinfo == GA_TYPE_NORMAL;
+
+		for (exint target = 0; target < targets.size(); ++target)
 		{
-			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			const PointXform *xforms = page_xforms.array() + target * GA_PAGE_SIZE;
+			const bool inverse_transpose = normal && targets[target].Lattice;
+			GA_Attribute *attrib = targets[target].PtAttribs[idx];
+			const bool real32 = base_real32 && isReal32(attrib);
+			GA_RWHandleV3 h;
+			if (real32)
 			{
-				UT_StringHolder pieceattrib_val;
-				if (pieceattrib_owner == GA_ATTRIB_PRIMITIVE)
+				ph.bind(attrib);
+				ph.setPage(page_start);
+			}
+			else
+				h.bind(attrib);
+
+			GA_Offset start, end;
+			for (GA_Iterator it(pit.begin()); it.blockAdvance(start, end);)
+			{
+				for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
 				{
-					GA_OffsetArray prims;
-					myGdps.Gdp->getPrimitivesReferencingPoint(prims, ptoff);
-					pieceattrib_val = pieceattrib_h.get(prims[0]);
+					const exint i = ptoff - page_start;
+					if (!page_bound[i])
+						continue;
+
+					UT_Vector3F value = real32 ? base_ph.get(ptoff) : base_h.get(ptoff);
+					UT_Matrix3F normal_xform;
+					if (inverse_transpose && !xforms[i].Rot.invert(normal_xform))
+					{
+						const fpreal32 length = value.length();
+						normal_xform.transpose();
+						value.rowVecMult(normal_xform);
+						value.normalize();
+						value *= length;
+					}
+					else
+						value.rowVecMult(xforms[i].Rot);
+					if (translate)
+						value += xforms[i].Translate;
+					if (real32)
+						ph.set(ptoff, value);
+					else
+						h.set(ptoff, value);
 				}
-				else
-					pieceattrib_val = pieceattrib_h.get(ptoff);
+			}
+		}
+	}
+}
+
+void
+ThreadedPointDeform::deformBatch(const GA_Offset *ptoffs, 
+								 exint numpts, 
+								 const DeformTarget &target, 
+								 const UT_Matrix3F *inverse_rests, 
+								 PointXform *xforms)
+{
+	const CaptureTable &table = *myCaptureTable;
+	const GU_Detail *gdp = target.DeformedGdp;
+	const PrimFrames &frames = *target.Frames;
 
-				if (rest_prim_rays.Map.find(pieceattrib_val) == rest_prim_rays.Map.end())
+	for (exint lane_start = 0; lane_start < numpts; lane_start += theSIMDLanes)
+	{
+		// pad a partial group by repeating its last point, padded lanes are not written
+		const exint numlanes = SYSmin(numpts - lane_start, theSIMDLanes);
+		GA_Offset lane_ptoffs[theSIMDLanes];
+		for (exint lane = 0; lane < theSIMDLanes; ++lane)
+			lane_ptoffs[lane] = ptoffs[lane_start + SYSmin(lane, numlanes - 1)];
+
+		Vector3x4 weighted_pos, weighted_nrm, weighted_up;
+		for (exint slot = 0; slot < table.Stride; ++slot)
+		{
+			// gather the corners and primitive frame of every lane's binding
+			// in this slot, triangles repeat their last corner with a zero weight
+			fpreal32 pos[4][3][theSIMDLanes];
+			fpreal32 weights[4][theSIMDLanes];
+			fpreal32 nrm[3][theSIMDLanes];
+			fpreal32 anchor[3][theSIMDLanes];
+			fpreal32 binding_weights[theSIMDLanes];
+			bool any_bound = false;
+
+			for (exint lane = 0; lane < theSIMDLanes; ++lane)
+			{
+				const GA_Offset ptoff = lane_ptoffs[lane];
+				if (slot >= table.BindingCounts[ptoff])
+				{
+					binding_weights[lane] = 0.f;
+					for (int k = 0; k < 4; ++k)
+					{
+						pos[k][0][lane] = pos[k][1][lane] = pos[k][2][lane] = 0.f;
+						weights[k][lane] = 0.f;
+					}
+					for (int c = 0; c < 3; ++c)
+						nrm[c][lane] = anchor[c][lane] = 0.f;
 					continue;
+				}
+
+				any_bound = true;
+				const exint binding = table.bindingStart(ptoff) + slot;
+				const exint corner_start = table.cornerStart(binding);
+				const int32 corner_count = table.cornerCount(binding);
+				binding_weights[lane] = table.weight(binding);
+
+				const int32 primidx = table.Prims[binding];
+				for (int c = 0; c < 3; ++c)
+				{
+					nrm[c][lane] = frames.Normals[primidx][c];
+					anchor[c][lane] = frames.Anchors[primidx][c];
+				}
 
-				pointCapture(rest_prim_rays.Map.at(pieceattrib_val), ptoff);
+				UT_ASSERT_P(corner_count > 0);
+				for (int k = 0; k < 4; ++k)
+				{
+					const int32 corner = SYSmin(k, corner_count - 1);
+					const UT_Vector3F corner_pos = target.DeformedPh.get(gdp->pointOffset(GA_Index(table.CornerPts[corner_start + corner])));
+					pos[k][0][lane] = corner_pos[0];
+					pos[k][1][lane] = corner_pos[1];
+					pos[k][2][lane] = corner_pos[2];
+					weights[k][lane] = (k < corner_count) ? table.cornerWeight(corner_start + k) : 0.f;
+				}
+			}
+
+			if (!any_bound)
+				break;
+
+			Vector3x4 corners[4];
+			v4uf corner_weights[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				corners[k] = Vector3x4(v4uf(pos[k][0]), v4uf(pos[k][1]), v4uf(pos[k][2]));
+				corner_weights[k] = v4uf(weights[k]);
+			}
+
+			const Vector3x4 prim_pos = corners[0] * corner_weights[0] + corners[1] * corner_weights[1] +
+				corners[2] * corner_weights[2] + corners[3] * corner_weights[3];
+
+			const Vector3x4 prim_nrm(v4uf(nrm[0]), v4uf(nrm[1]), v4uf(nrm[2]));
+			const Vector3x4 prim_anchor(v4uf(anchor[0]), v4uf(anchor[1]), v4uf(anchor[2]));
+			const Vector3x4 prim_up = cross(prim_nrm, normalize(prim_pos - prim_anchor));
+
+			const v4uf binding_weight(binding_weights);
+			weighted_pos += prim_pos * binding_weight;
+			weighted_nrm += prim_nrm * binding_weight;
+			weighted_up += prim_up * binding_weight;
+		}
+
+		const Vector3x4 zaxis = normalize(weighted_nrm);
+		const Vector3x4 xaxis = normalize(cross(weighted_up, zaxis));
+		const Vector3x4 yaxis = cross(zaxis, xaxis);
+
+		fpreal32 rest_pos[3][theSIMDLanes];
+		for (exint lane = 0; lane < theSIMDLanes; ++lane)
+		{
+			const UT_Vector3F restp = table.restP(lane_ptoffs[lane]);
+			rest_pos[0][lane] = restp[0];
+			rest_pos[1][lane] = restp[1];
+			rest_pos[2][lane] = restp[2];
+		}
+
+		const Vector3x4 deformed_pos = xaxis * v4uf(rest_pos[0]) + yaxis * v4uf(rest_pos[1]) +
+			zaxis * v4uf(rest_pos[2]) + weighted_pos;
+
+		for (exint lane = 0; lane < numlanes; ++lane)
+		{
+			const GA_Offset ptoff = lane_ptoffs[lane];
+			const UT_Vector3F pos(deformed_pos.X[lane], deformed_pos.Y[lane], deformed_pos.Z[lane]);
+			target.Ph.set(ptoff, pos);
+
+			if (xforms)
+			{
+				const UT_Matrix3F rot(xaxis.X[lane], xaxis.Y[lane], xaxis.Z[lane],
+									  yaxis.X[lane], yaxis.Y[lane], yaxis.Z[lane],
+									  zaxis.X[lane], zaxis.Y[lane], zaxis.Z[lane]);
+				buildPointXform(ptoff, inverse_rests[lane_start + lane], rot, pos, xforms[lane_start + lane]);
 			}
 		}
 	}
 }
 
 void
-ThreadedPointDeform::deformPartial(const UT_JobInfo &info)
+ThreadedPointDeform::buildRestFrames()
+{
+	// without stored rotations the rest frames are rebuilt for every point
+	// packed lattices have the frames of their shapes already
+	if (myCaptureAttributes_Info->XformRequired && !myCaptureTable->HasXform && !myRestLattice)
+		computePrimFrames(myGdps.RestGdp, true, myRestFrames);
+}
+
+UT_Matrix3F
+ThreadedPointDeform::inverseRestXform(GA_Offset ptoff) const
+{
+	const RestLattice lattice = restLattice(ptoff, myRestFrames);
+	UT_Matrix3F rot;
+	if (myCaptureTable->HasXform)
+		rot = myCaptureTable->xform(ptoff);
+	else
+	{
+		// the rest frame is orthonormal, its inverse is the transpose
+		TransformInfo trn_info;
+		bindCapture(trn_info, ptoff);
+		buildXform(trn_info, lattice.Gdp, *lattice.Ph, myDriveAttribHs->RestNormal_H, myDriveAttribHs->RestUp_H, *lattice.Frames);
+		rot = trn_info.Rot;
+		rot.transpose();
+	}
+	if (!lattice.Instance)
+		return rot;
+
+	// the rest frame is in the space of the shape, leave the instance first
+	UT_Matrix3F inverse_instance(lattice.Instance->InverseXform);
+	inverse_instance *= rot;
+	return inverse_instance;
+}
+
+fpreal32
+ThreadedPointDeform::measureCaptureError() const
 {
+	UT_ThreadSpecificValue<fpreal32> thread_errors;
+	UTparallelFor(*myPtRange, [&](const GA_SplittableRange &r)
+	{
+		fpreal32 &max_error = thread_errors.get();
+		GA_Offset start, end;
+		for (GA_Iterator it(r); it.blockAdvance(start, end);)
+		{
+			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
+			{
+				TransformInfo trn_info;
+				bindCapture(trn_info, ptoff);
+				if (!trn_info.CaptureCount)
+					continue;
+
+				const RestLattice lattice = restLattice(ptoff, myPrimFrames);
+				buildXform(trn_info, lattice.Gdp, *lattice.Ph, myDriveAttribHs->RestNormal_H, myDriveAttribHs->RestUp_H, *lattice.Frames);
+				trn_info.Pos = myCaptureTable->restP(ptoff);
+				trn_info.Pos.rowVecMult(trn_info.Rot);
+				trn_info.Pos += trn_info.WeightedPos;
+				if (lattice.Instance)
+					trn_info.Pos *= lattice.Instance->Xform;
+				max_error = SYSmax(max_error, (trn_info.Pos - myBasePh.get(ptoff)).length());
+			}
+		}
+	});
+
+	fpreal32 max_error = 0.f;
+	for (auto it = thread_errors.begin(); it != thread_errors.end(); ++it)
+		max_error = SYSmax(max_error, it.get());
+	return max_error;
+}
+
+void
+ThreadedPointDeform::exportCapturePartial(const UT_JobInfo &info)
+{
+	const CaptureTable &table = *myCaptureTable;
+	UT_ValArray<int32> capture_prims;
+	UT_ValArray<fpreal16> capture_uvws;
+	UT_ValArray<fpreal16> capture_weights;
+
 	for (GA_PageIterator pit = myPtRange->beginPages(info); !pit.atEnd(); ++pit)
 	{
 		GA_Offset start, end;
@@ -194,30 +1174,26 @@ ThreadedPointDeform::deformPartial(const UT_JobInfo &info)
 			for (GA_Offset ptoff = start; ptoff < end; ++ptoff)
 			{
 				TransformInfo trn_info;
-				myCaptureAttributes_Info->CapturePrims_H.get(ptoff, trn_info.CapturePrims);
-				myCaptureAttributes_Info->CaptureUVWs_H.get(ptoff, trn_info.CaptureUVWs);
-				myCaptureAttributes_Info->CaptureWeights_H.get(ptoff, trn_info.CaptureWeights);
+				bindCapture(trn_info, ptoff);
 
-				buildXform(trn_info, myGdps.DeformedGdp, myDriveAttribHs->DeformedNormal_H, myDriveAttribHs->DeformedUp_H);
-				if (myCaptureAttributes_Info->XformRequired)
+				capture_prims.clear();
+				capture_uvws.clear();
+				capture_weights.clear();
+				for (int32 idx = 0; idx < trn_info.CaptureCount; ++idx)
 				{
-					UT_Matrix3F final_xform = myCaptureAttributes_Info->Xform_H.get(ptoff);
-					final_xform *= trn_info.Rot;
-
-					for (size_t idx = 0; idx < myBasePtAttribsh.size(); ++idx)
-					{
-						UT_Vector3F vectorattrib;
-						vectorattrib = myBasePtAttribsh[idx].get(ptoff);
-						vectorattrib.rowVecMult(final_xform);
-						myPtAttribsh[idx].set(ptoff, vectorattrib);
-					}
+					const UT_Vector2F uv = table.uv(trn_info.BindingStart + idx);
+					capture_prims.emplace_back(trn_info.CapturePrims[idx]);
+					capture_uvws.emplace_back(uv[0]);
+					capture_uvws.emplace_back(uv[1]);
+					capture_weights.emplace_back(table.weight(trn_info.BindingStart + idx));
 				}
 
-				trn_info.Pos = myCaptureAttributes_Info->RestP_H.get(ptoff);
-				trn_info.Pos.rowVecMult(trn_info.Rot);
-				trn_info.Pos += trn_info.WeightedPos;
-				
-				myPh.set(ptoff, trn_info.Pos);
+				myCaptureAttributes_Info->RestP_H.set(ptoff, table.restP(ptoff));
+				myCaptureAttributes_Info->CapturePrims_H.set(ptoff, capture_prims);
+				myCaptureAttributes_Info->CaptureUVWs_H.set(ptoff, capture_uvws);
+				myCaptureAttributes_Info->CaptureWeights_H.set(ptoff, capture_weights);
+				if (myCaptureAttributes_Info->XformRequired && trn_info.CaptureCount)
+					myCaptureAttributes_Info->Xform_H.set(ptoff, inverseRestXform(ptoff));
 			}
 		}
 	}
@@ -226,55 +1202,151 @@ ThreadedPointDeform::deformPartial(const UT_JobInfo &info)
 void
 ThreadedPointDeform::buildXform(TransformInfo &trn_info,
 								const GU_Detail *gdp,
+								const GA_ROHandleV3 &p_attrib_h,
 								const GA_ROHandleV3 &normal_attrib_h,
-								const GA_ROHandleV3 &up_attrib_h)
+								const GA_ROHandleV3 &up_attrib_h,
+								const PrimFrames &frames) const
+{
+	if (trn_info.CornerPts)
+	{
+		buildXformFromCorners(trn_info, gdp, p_attrib_h, normal_attrib_h, up_attrib_h, frames);
+		return;
+	}
+
+	const CaptureTable &table = *myCaptureTable;
+
+	trn_info.WeightedPos = 0.f;
+	UT_Vector3F weighted_nrm(0.f), weighted_up(0.f);
+
+	for (int32 idx = 0; idx < trn_info.CaptureCount; ++idx)
+	{
+		evalPrimBinding(trn_info, idx, gdp, p_attrib_h, normal_attrib_h, up_attrib_h);
+
+		const fpreal32 weight = table.weight(trn_info.BindingStart + idx);
+		trn_info.WeightedPos += trn_info.Pos * weight;
+		weighted_nrm += trn_info.PrimNormal * weight;
+		weighted_up += trn_info.Up * weight;
+	}
+
+	buildFrame(trn_info.Rot, weighted_nrm, weighted_up);
+}
+
+void
+ThreadedPointDeform::evalPrimBinding(TransformInfo &trn_info,
+									 int32 idx,
+									 const GU_Detail *gdp,
+									 const GA_ROHandleV3 &p_attrib_h,
+									 const GA_ROHandleV3 &normal_attrib_h,
+									 const GA_ROHandleV3 &up_attrib_h) const
 {
-	GA_ROHandleV3 temp_ph(gdp->getP());
 	const GA_IndexMap &prim_map = gdp->getIndexMap(GA_ATTRIB_PRIMITIVE);
+	const UT_Vector2F uv = myCaptureTable->uv(trn_info.BindingStart + idx);
+	const GEO_Primitive *geo_prim = gdp->getGEOPrimitive(prim_map.offsetFromIndex(trn_info.CapturePrims[idx]));
+	geo_prim->evaluateInteriorPoint(trn_info.PrimPosition, uv[0], uv[1]);
+	trn_info.Pos[0] = trn_info.PrimPosition[0];
+	trn_info.Pos[1] = trn_info.PrimPosition[1];
+	trn_info.Pos[2] = trn_info.PrimPosition[2];
+
+	if (myDriveAttribHs->Drive)
+	{
+		UT_SmallArray<GA_Offset> vtxoffsets;
+		UT_SmallArray<fpreal32> weightlist;
+		geo_prim->computeInteriorPointWeights(vtxoffsets, weightlist, uv[0], uv[1], 0.f);
+
+		trn_info.PrimNormal = 0.f;
+		trn_info.Up = 0.f;
+		for (GA_Offset j = 0; j < vtxoffsets.size(); ++j)
+		{
+			trn_info.PrimNormal += normal_attrib_h.get(gdp->vertexPoint(vtxoffsets[j])) * weightlist[j];
+			trn_info.Up += up_attrib_h.get(gdp->vertexPoint(vtxoffsets[j])) * weightlist[j];
+		}
+	}
+	else
+	{
+		geo_prim->evaluateNormalVector(trn_info.PrimNormal, uv[0], uv[1]);
+		GA_Offset primpt_off = geo_prim->getPointOffset(0);
+		UT_Vector3F primpt_pos = p_attrib_h.get(primpt_off);
+		trn_info.Up = trn_info.Pos - primpt_pos;
+		trn_info.Up.normalize();
+		trn_info.Up = cross(trn_info.PrimNormal, trn_info.Up);
+	}
+}
+
+bool
+ThreadedPointDeform::hasAllCorners(GA_Offset ptoff) const
+{
+	const CaptureTable &table = *myCaptureTable;
+	const exint binding_start = table.bindingStart(ptoff);
+	for (exint binding = binding_start; binding < binding_start + table.BindingCounts[ptoff]; ++binding)
+	{
+		if (!table.cornerCount(binding))
+			return false;
+	}
+	return true;
+}
+
+void
+ThreadedPointDeform::buildXformFromCorners(TransformInfo &trn_info,
+										   const GU_Detail *gdp,
+										   const GA_ROHandleV3 &p_attrib_h,
+										   const GA_ROHandleV3 &normal_attrib_h,
+										   const GA_ROHandleV3 &up_attrib_h,
+										   const PrimFrames &frames) const
+{
+	const CaptureTable &table = *myCaptureTable;
+	const exint corner_stride = table.CornerStride;
+	const bool drive = myDriveAttribHs->Drive;
 
 	trn_info.WeightedPos = 0.f;
 	UT_Vector3F weighted_nrm(0.f), weighted_up(0.f);
 
-	for (exint idx = 0; idx < trn_info.CapturePrims.size(); ++idx)
+	for (int32 idx = 0; idx < trn_info.CaptureCount; ++idx)
 	{
-		const exint vec2off = idx * 2;
-		const GEO_Primitive *geo_prim = gdp->getGEOPrimitive(prim_map.offsetFromIndex(trn_info.CapturePrims[idx]));
-		geo_prim->evaluateInteriorPoint(
-			trn_info.PrimPosition, trn_info.CaptureUVWs[vec2off], trn_info.CaptureUVWs[vec2off + 1]);
-		trn_info.Pos[0] = trn_info.PrimPosition[0];
-		trn_info.Pos[1] = trn_info.PrimPosition[1];
-		trn_info.Pos[2] = trn_info.PrimPosition[2];
+		const int32 *corner_pts = trn_info.CornerPts + idx * corner_stride;
+		const exint corner_start = trn_info.CornerStart + idx * corner_stride;
+		const int32 corner_count = table.cornerCount(trn_info.BindingStart + idx);
+		if (!corner_count)
+		{
+			// bindings without corners are evaluated through their primitive
+			evalPrimBinding(trn_info, idx, gdp, p_attrib_h, normal_attrib_h, up_attrib_h);
+			const fpreal32 weight = table.weight(trn_info.BindingStart + idx);
+			trn_info.WeightedPos += trn_info.Pos * weight;
+			weighted_nrm += trn_info.PrimNormal * weight;
+			weighted_up += trn_info.Up * weight;
+			continue;
+		}
+
+		trn_info.Pos = 0.f;
+		trn_info.PrimNormal = 0.f;
+		trn_info.Up = 0.f;
 
-		if (myDriveAttribHs->Drive)
+		for (int32 k = 0; k < corner_count; ++k)
 		{
-			UT_Array<GA_Offset> vtxoffsets;
-			UT_Array<fpreal32> weightlist;
-			geo_prim->computeInteriorPointWeights(
-				vtxoffsets, weightlist, trn_info.CaptureUVWs[vec2off], trn_info.CaptureUVWs[vec2off + 1], 0.f);
+			const GA_Offset ptoff = gdp->pointOffset(GA_Index(corner_pts[k]));
+			const fpreal32 corner_weight = table.cornerWeight(corner_start + k);
+			trn_info.Pos += p_attrib_h.get(ptoff) * corner_weight;
 
-			trn_info.PrimNormal = 0.f;
-			trn_info.Up = 0.f;
-			for (GA_Offset j = 0; j < vtxoffsets.size(); ++j)
+			if (drive)
 			{
-				trn_info.PrimNormal += normal_attrib_h.get(gdp->vertexPoint(vtxoffsets[j])) * weightlist[j];
-				trn_info.Up += up_attrib_h.get(gdp->vertexPoint(vtxoffsets[j])) * weightlist[j];
+				trn_info.PrimNormal += normal_attrib_h.get(ptoff) * corner_weight;
+				trn_info.Up += up_attrib_h.get(ptoff) * corner_weight;
 			}
 		}
-		else
+
+		if (!drive)
 		{
-			geo_prim->evaluateNormalVector(
-				trn_info.PrimNormal, trn_info.CaptureUVWs[vec2off], trn_info.CaptureUVWs[vec2off + 1]);
-			GA_Offset primpt_off = geo_prim->getPointOffset(0);
-			UT_Vector3F primpt_pos = temp_ph.get(primpt_off);
-			trn_info.Up = trn_info.Pos - primpt_pos;
+			const int32 primidx = trn_info.CapturePrims[idx];
+			trn_info.PrimNormal = frames.Normals[primidx];
+			trn_info.Up = trn_info.Pos - frames.Anchors[primidx];
 			trn_info.Up.normalize();
 			trn_info.Up = cross(trn_info.PrimNormal, trn_info.Up);
 		}
 
-		trn_info.WeightedPos += trn_info.Pos * trn_info.CaptureWeights[idx];
-		weighted_nrm += trn_info.PrimNormal * trn_info.CaptureWeights[idx];
-		weighted_up += trn_info.Up * trn_info.CaptureWeights[idx];
+		const fpreal32 weight = table.weight(trn_info.BindingStart + idx);
+		trn_info.WeightedPos += trn_info.Pos * weight;
+		weighted_nrm += trn_info.PrimNormal * weight;
+		weighted_up += trn_info.Up * weight;
 	}
 
-	trn_info.Rot.lookat({ 0.f, 0.f, 0.f }, weighted_nrm, weighted_up);
-}
\ No newline at end of file
+	buildFrame(trn_info.Rot, weighted_nrm, weighted_up);
+}
@@ -7,6 +7,10 @@
 #include <GA/GA_PageIterator.h>
 #include <GA/GA_PageHandle.h>
 #include <GU/GU_RayIntersect.h>
+#include <VM/VM_SIMD.h>
+#include "CaptureTable.h"
+#include "PackedLattice.h"
+#include "Timer.h"
 #include "Utils.h"
 
 class GU_Detail;
@@ -15,19 +19,42 @@ class GU_RayIntersect;
 namespace AKA
 {
 
+namespace Core
+{
+class Bvh;
+} // end Core
+
 class ThreadedPointDeform
 {
 public:
+	// points deformed together by the batched tri/quad kernel,
+	// processed as groups of theSIMDLanes
+	static constexpr exint theBatchSize = 8;
+	static constexpr exint theSIMDLanes = 4;
+	// points per capture task
+	static constexpr exint theCaptureGrainSize = 32;
+	// slack on the nearest hit search bounded by the previous point's hit
+	static constexpr fpreal32 theSeedSlack = 1.0001f;
+	// cap on the falloff weighted bindings of a radius capture
+	static constexpr exint theMaxRadiusBindings = 16;
+
 	ThreadedPointDeform(const Gdps &gdps,
 						GA_SplittableRange *ptrange,
 						DriveAttrib_Info *drive_attrib_hs,
 						CaptureAttributes_Info *captureattribs_info,
+						CaptureTable *capture_table,
+						CookStats *cook_stats,
 						const UT_Array<UT_StringHolder> &attribnames_to_interpolate);
 
 	struct TransformInfo
 	{
 		TransformInfo()
-			: Pos(0.f)
+			: CapturePrims(nullptr)
+			, BindingStart(0)
+			, CaptureCount(0)
+			, CornerPts(nullptr)
+			, CornerStart(0)
+			, Pos(0.f)
 			, WeightedPos(0.f)
 			, Up(0.f)
 			, PrimNormal(0.f)
@@ -35,9 +62,13 @@ public:
 			, Rot(1.f)
 		{}
 
-		UT_ValArray<int32>CapturePrims;
-		UT_ValArray<fpreal16> CaptureUVWs;
-		UT_ValArray<fpreal16> CaptureWeights;
+		// uvs and weights are read through the capture table accessors from
+		// the binding and corner starts, they may be quantized
+		const int32 *CapturePrims;
+		exint BindingStart;
+		int32 CaptureCount;
+		const int32 *CornerPts;
+		exint CornerStart;
 		UT_Vector3F Pos;
 		UT_Vector3F WeightedPos;
 		UT_Vector3F Up;
@@ -46,36 +77,194 @@ public:
 		UT_Matrix3F Rot;
 	};
 
-	THREADED_METHOD1(ThreadedPointDeform, myPtRange->canMultiThread(), capture, GU_RayIntersect*, ray_gdp);
-	void capturePartial(GU_RayIntersect *ray_gdp, const UT_JobInfo &info);
+	// Normals and up anchors of the polygons of one lattice stream.
+	struct PrimFrames
+	{
+		UT_Array<UT_Vector3F> Normals;
+		UT_Array<UT_Vector3F> Anchors;
+	};
+
+	// A deformed lattice and the detail its deformed points are written to.
+	struct DeformTarget
+	{
+		const GU_Detail *DeformedGdp = nullptr;
+		GA_ROHandleV3 DeformedPh;
+		GA_ROHandleV3 DeformedNormal_H;
+		GA_ROHandleV3 DeformedUp_H;
+		const PrimFrames *Frames = nullptr;
+		// set for a packed lattice, with the frames of its shapes
+		const PackedLattice *Lattice = nullptr;
+		const UT_Array<PrimFrames> *ShapeFrames = nullptr;
+		GA_RWHandleV3 Ph;
+		UT_Array<GA_Attribute *> PtAttribs;
+	};
+
+	// Unit length multi-sample directions of a pattern in the sample frame
+	// of a point, z points away from the nearest lattice hit.
+	static void buildSampleDirs(SamplePattern pattern, exint count, UT_Array<UT_Vector3F> &dirs);
+
+	// Computes the normal and up anchor of the lattice polygons once, either
+	// for every primitive or only the ones referenced by the capture table.
+	// Only the corner path without drive attributes reads them.
+	void buildPrimFrames(const GU_Detail *gdp, bool referenced_only);
+
+	// Captures against and deforms by the instances of packed lattices
+	// instead of the rest and deformed details, and computes the frames of
+	// their shapes. The deformed lattice may be null when only capturing.
+	void setPackedLattices(const PackedLattice *rest_lattice, const PackedLattice *deformed_lattice);
+
+	// Resolves the rest lattice instance nearest to every point to capture
+	// through the bounds BVH of the rest lattice.
+	void findPointInstances(UT_Array<int32> &point_instances) const;
+
+	// Finds the nearest hit of every point in a closest point BVH of an
+	// all-triangle rest lattice, the intersector then only sends the
+	// multi-sample rays and may be null without them. A radius capture
+	// binds the nearest primitives within the radius instead, and leaves
+	// the points with none unbound.
+	void setClosestBvh(const Core::Bvh *bvh) { myClosestBvh = bvh; }
+
+	// Captures the points of the range in small blocks stolen by idle
+	// threads, the cost per point varies with the number of rays it sends.
+	// Along a capture order curve the nearest hit of a point bounds the
+	// search of the next one in its block.
+	void capture(GU_RayIntersect *ray_gdp);
+
+	// Resolves the rest lattice piece id of every point to capture,
+	// -1 when the rest lattice has no piece with the point's value.
+	void findPointPieces(GA_ROHandleI pieceattrib_h, const MapPieceId<int32> &piece_ids, UT_Array<int32> &point_pieces) const;
+	void findPointPieces(GA_ROHandleS pieceattrib_h, const MapPieceId<UT_StringHolder> &piece_ids, UT_Array<int32> &point_pieces) const;
 
-	THREADED_METHOD2(ThreadedPointDeform, myPtRange->canMultiThread(), captureByPieceAttrib, 
-					 GA_ROHandleI, pieceattrib_h, MapRay<int32>, rest_prim_rays);
-	void captureByPieceAttribPartial(GA_ROHandleI pieceattrib_h, MapRay<int32> rest_prim_rays, const UT_JobInfo &info);
+	// Captures the points bucketed by piece against the intersector of their
+	// piece, the intersectors are shared read-only by all threads. For a
+	// packed lattice the pieces are the instances of the rest lattice.
+	void captureByPieceAttrib(const UT_Array<int32> &point_pieces, const UT_Array<GU_RayIntersect *> &piece_rays);
 
-	THREADED_METHOD2(ThreadedPointDeform, myPtRange->canMultiThread(), captureByPieceAttrib, 
-					 GA_ROHandleS, pieceattrib_h, MapRay<UT_StringHolder>, rest_prim_rays);
-	void captureByPieceAttribPartial(GA_ROHandleS pieceattrib_h, MapRay<UT_StringHolder> rest_prim_rays, const UT_JobInfo &info);
+	// Deforms the points of the output by the deformed lattice, using the
+	// frames of the last buildPrimFrames().
+	void deform();
 
-	THREADED_METHOD(ThreadedPointDeform, myPtRange->canMultiThread(), deform);
-	void deformPartial(const UT_JobInfo &info);
+	// Deforms the points once per deformed lattice frame into the detail of
+	// the same index, the bindings of every point are read once for all the
+	// frames. The details have to share the point offsets of the output.
+	// Fails when the packed lattice of a frame can't be built or doesn't
+	// match the rest lattice.
+	bool deformFrames(const UT_Array<const GU_Detail *> &deformed_gdps, 
+					  const UT_Array<GU_Detail *> &gdps, 
+					  UT_WorkBuffer &errmsg);
+
+	THREADED_METHOD1(ThreadedPointDeform, myPtRange->canMultiThread(), deformTargets, 
+					 const UT_Array<DeformTarget> *, targets);
+	void deformTargetsPartial(const UT_Array<DeformTarget> *targets, const UT_JobInfo &info);
+
+	// Largest distance between the rest position of a point of the range and
+	// the position rebuilt from its bindings on the rest lattice, uses the
+	// frames of the last buildPrimFrames().
+	fpreal32 measureCaptureError() const;
+
+	// Writes the capture to the debug attributes, rebuilt rest rotations use
+	// the rest frames of the last deform().
+	THREADED_METHOD(ThreadedPointDeform, myPtRange->canMultiThread(), exportCapture);
+	void exportCapturePartial(const UT_JobInfo &info);
 
 private:
-	void pointCapture(GU_RayIntersect *ray_gdp, GA_Offset ptoff);
+	// Rest lattice a point is bound to, the shape of its instance for
+	// packed lattices.
+	struct RestLattice
+	{
+		const GU_Detail *Gdp;
+		const GA_ROHandleV3 *Ph;
+		const PrimFrames *Frames;
+		const PackedLattice::Instance *Instance;
+	};
+
+	// Nearest lattice position of the previous point of a block, in the
+	// space of its lattice.
+	struct CaptureSeed
+	{
+		UT_Vector3F Pos;
+		bool Valid = false;
+	};
+
+	RestLattice restLattice(GA_Offset ptoff, const PrimFrames &frames) const;
+	void sortByCaptureOrder(GA_Offset *ptoffs, exint count) const;
+	void computeShapeFrames(const PackedLattice &lattice, UT_Array<PrimFrames> &shape_frames) const;
+	void pointCapture(GU_RayIntersect *ray_gdp, GA_Offset ptoff, CaptureSeed &seed, CaptureCounters &counters);
+	void resolveCorners(GA_Offset ptoff, const GU_Detail *rest_gdp);
+	void bindCapture(TransformInfo &trn_info, GA_Offset ptoff) const;
+	void computePrimFrames(const GU_Detail *gdp, bool referenced_only, PrimFrames &frames) const;
+	void bindTarget(DeformTarget &target, const GU_Detail *deformed_gdp, GU_Detail *gdp, const PrimFrames *frames) const;
 	void buildXform(TransformInfo &trn_info, 
 					const GU_Detail *gdp, 
+					const GA_ROHandleV3 &p_attrib_h, 
 					const GA_ROHandleV3 &normal_attrib_h, 
-					const GA_ROHandleV3 &up_attrib_h);
+					const GA_ROHandleV3 &up_attrib_h,
+					const PrimFrames &frames) const;
+	// Position, normal and up of a binding evaluated through its primitive
+	// at the binding's uv.
+	void evalPrimBinding(TransformInfo &trn_info,
+						 int32 idx,
+						 const GU_Detail *gdp,
+						 const GA_ROHandleV3 &p_attrib_h,
+						 const GA_ROHandleV3 &normal_attrib_h,
+						 const GA_ROHandleV3 &up_attrib_h) const;
+	// Whether every binding of the point has corners to gather.
+	bool hasAllCorners(GA_Offset ptoff) const;
+	void buildXformFromCorners(TransformInfo &trn_info, 
+							   const GU_Detail *gdp, 
+							   const GA_ROHandleV3 &p_attrib_h, 
+							   const GA_ROHandleV3 &normal_attrib_h, 
+							   const GA_ROHandleV3 &up_attrib_h,
+							   const PrimFrames &frames) const;
+	// Rest to deformed transform of a point, kept for the points of a page
+	// between the P pass and the attribute pass.
+	struct PointXform
+	{
+		UT_Matrix3F Rot;
+		UT_Vector3F Translate;
+	};
+
+	// Deformed position and frame of a point on the target, placed by its
+	// instance for packed lattices.
+	void buildTargetXform(TransformInfo &trn_info, GA_Offset ptoff, const DeformTarget &target) const;
+	void buildRestFrames();
+	UT_Matrix3F inverseRestXform(GA_Offset ptoff) const;
+	// The inverse rest rotations of the points are only read with xforms,
+	// they are built once per point for all the targets.
+	void deformBatch(const GA_Offset *ptoffs, 
+					 exint numpts, 
+					 const DeformTarget &target, 
+					 const UT_Matrix3F *inverse_rests, 
+					 PointXform *xforms);
+	void buildPointXform(GA_Offset ptoff, 
+						 const UT_Matrix3F &inverse_rest, 
+						 const UT_Matrix3F &rot, 
+						 const UT_Vector3F &deformed_pos, 
+						 PointXform &xform) const;
+	void transformPageAttribs(const GA_PageIterator &pit,
+							  GA_Offset page_start,
+							  const UT_Array<DeformTarget> &targets,
+							  const UT_Array<PointXform> &page_xforms,
+							  const UT_Array<uint8> &page_bound) const;
 
 private:
 	const Gdps &myGdps;
 	GA_SplittableRange *myPtRange;
 	DriveAttrib_Info *myDriveAttribHs;
 	CaptureAttributes_Info *myCaptureAttributes_Info;
+	CaptureTable *myCaptureTable;
+	CookStats *myCookStats;
 	GA_ROHandleV3 myBasePh;
-	GA_RWHandleV3 myPh;
+	GA_ROHandleV3 myRestPh;
 	UT_Array<GA_ROHandleV3> myBasePtAttribsh;
-	UT_Array<GA_RWHandleV3> myPtAttribsh;
+	bool myBatchedDeform;
+	PrimFrames myPrimFrames;
+	PrimFrames myRestFrames;
+	const PackedLattice *myRestLattice;
+	const PackedLattice *myDeformedLattice;
+	UT_Array<PrimFrames> myRestShapeFrames;
+	UT_Array<PrimFrames> myDeformedShapeFrames;
+	const Core::Bvh *myClosestBvh;
 
 };
 }
@@ -0,0 +1,233 @@
+#include <GA/GA_Handle.h>
+#include <GU/GU_Detail.h>
+#include <UT/UT_Lock.h>
+
+#include "Timer.h"
+#include <cstdlib>
+#include <fstream>
+#include <utility>
+
+using namespace AKA;
+
+fpreal64
+Timer::elapsed() const
+{
+	return std::chrono::duration<fpreal64>(std::chrono::steady_clock::now() - myStart).count();
+}
+
+void
+CookStats::beginCook()
+{
+	for (fpreal64 &phase_time : PhaseTimes)
+		phase_time = 0.0;
+
+	Reinitialized = false;
+	Incremental = false;
+	CaptureFileRead = false;
+	DirtyPages = 0;
+	RaysSent.store(0);
+	MinimumPointQueries.store(0);
+	for (auto it = CaptureBusyTimes.begin(); it != CaptureBusyTimes.end(); ++it)
+		it.get() = 0.0;
+	CapturedPoints = 0;
+	Bindings = 0;
+	MaxBindings = 0;
+	UnboundPoints = 0;
+	BVHsBuilt = 0;
+	BVHsShared = 0;
+	DeformedPoints = 0;
+	CaptureMemory = 0;
+	Quantized = false;
+	QuantizeError = 0.0;
+	++Cooks;
+}
+
+void
+CookStats::addCaptureCounters(const CaptureCounters &counters)
+{
+	RaysSent.add(counters.RaysSent);
+	MinimumPointQueries.add(counters.MinimumPointQueries);
+}
+
+void
+CookStats::captureBusyTimes(exint &numthreads, fpreal64 &min_time, fpreal64 &avg_time, fpreal64 &max_time) const
+{
+	numthreads = 0;
+	min_time = avg_time = max_time = 0.0;
+	for (auto it = CaptureBusyTimes.begin(); it != CaptureBusyTimes.end(); ++it)
+	{
+		const fpreal64 time = it.get();
+		if (time <= 0.0)
+			continue;
+
+		min_time = numthreads ? SYSmin(min_time, time) : time;
+		max_time = SYSmax(max_time, time);
+		avg_time += time;
+		++numthreads;
+	}
+	if (numthreads)
+		avg_time /= numthreads;
+}
+
+fpreal64
+CookStats::totalTime() const
+{
+	fpreal64 total = 0.0;
+	for (fpreal64 phase_time : PhaseTimes)
+		total += phase_time;
+	return total;
+}
+
+const char *
+CookStats::phaseName(CookPhase phase)
+{
+	switch (phase)
+	{
+		case CookPhase::TopologyValidation:
+			return "topology_validation";
+		case CookPhase::AttributeSetup:
+			return "attribute_setup";
+		case CookPhase::BVHBuild:
+			return "bvh_build";
+		case CookPhase::Capture:
+			return "capture";
+		case CookPhase::Deform:
+			return "deform";
+		case CookPhase::DataIdBump:
+			return "dataid_bump";
+		default:
+			return "unknown";
+	}
+}
+
+void
+CookStats::appendText(UT_WorkBuffer &buf) const
+{
+	buf.appendSprintf("Last cook: %s, %.3f ms\n", 
+					  !Reinitialized ? "deform" : CaptureFileRead ? "capture file read + deform" : 
+					  Incremental ? "incremental recapture + deform" : "recapture + deform", 
+					  totalTime() * 1e+3);
+	for (int phase = 0; phase < int(CookPhase::NumPhases); ++phase)
+		buf.appendSprintf("    %-20s %10.3f ms\n", phaseName(CookPhase(phase)), PhaseTimes[phase] * 1e+3);
+
+	if (Reinitialized && !CaptureFileRead)
+	{
+		buf.appendSprintf("Captured points: %" SYS_PRId64 " in %" SYS_PRId64 " dirty pages\n", int64(CapturedPoints), int64(DirtyPages));
+		buf.appendSprintf("BVHs: %" SYS_PRId64 " built, %" SYS_PRId64 " shared\n", int64(BVHsBuilt), int64(BVHsShared));
+		buf.appendSprintf("Minimum point queries: %" SYS_PRId64 "\n", int64(MinimumPointQueries.relaxedLoad()));
+		buf.appendSprintf("Rays sent: %" SYS_PRId64 "\n", int64(RaysSent.relaxedLoad()));
+		buf.appendSprintf("Bindings per point: %.2f avg, %" SYS_PRId64 " max\n", 
+						  CapturedPoints ? fpreal64(Bindings) / CapturedPoints : 0.0, int64(MaxBindings));
+		if (UnboundPoints)
+			buf.appendSprintf("Unbound points: %" SYS_PRId64 "\n", int64(UnboundPoints));
+
+		exint numthreads;
+		fpreal64 min_time, avg_time, max_time;
+		captureBusyTimes(numthreads, min_time, avg_time, max_time);
+		buf.appendSprintf("Capture threads: %" SYS_PRId64 ", busy %.3f min, %.3f avg, %.3f max ms\n", 
+						  int64(numthreads), min_time * 1e+3, avg_time * 1e+3, max_time * 1e+3);
+	}
+	buf.appendSprintf("Deformed points: %" SYS_PRId64 "\n", int64(DeformedPoints));
+	if (Quantized)
+		buf.appendSprintf("Capture memory: %.2f MB quantized, max position error %g\n", CaptureMemory / (1024.0 * 1024.0), QuantizeError);
+	else
+		buf.appendSprintf("Capture memory: %.2f MB\n", CaptureMemory / (1024.0 * 1024.0));
+	buf.appendSprintf("Reinitializations: %" SYS_PRId64 " of %" SYS_PRId64 " cooks\n", 
+					  int64(Reinitializations), int64(Cooks));
+}
+
+void
+CookStats::appendJSON(UT_WorkBuffer &buf, const UT_StringHolder &nodepath) const
+{
+	exint numthreads;
+	fpreal64 min_time, avg_time, max_time;
+	captureBusyTimes(numthreads, min_time, avg_time, max_time);
+
+	buf.appendSprintf("{\"node\":\"%s\",\"reinitialized\":%s,\"incremental\":%s,\"capture_file_read\":%s,\"dirty_pages\":%" SYS_PRId64 ",\"total\":%.9f,\"phases\":{", 
+					  nodepath.c_str(), Reinitialized ? "true" : "false", Incremental ? "true" : "false", CaptureFileRead ? "true" : "false", int64(DirtyPages), totalTime());
+	for (int phase = 0; phase < int(CookPhase::NumPhases); ++phase)
+		buf.appendSprintf("%s\"%s\":%.9f", phase ? "," : "", phaseName(CookPhase(phase)), PhaseTimes[phase]);
+
+	buf.appendSprintf("},\"captured_points\":%" SYS_PRId64 ",\"minimum_point_queries\":%" SYS_PRId64 
+					  ",\"rays_sent\":%" SYS_PRId64 ",\"bindings\":%" SYS_PRId64 ",\"max_bindings\":%" SYS_PRId64 ",\"unbound_points\":%" SYS_PRId64 
+					  ",\"bvhs_built\":%" SYS_PRId64 ",\"bvhs_shared\":%" SYS_PRId64 
+					  ",\"deformed_points\":%" SYS_PRId64 ",\"capture_memory\":%" SYS_PRId64 ",\"quantized\":%s,\"quantize_error\":%g"
+					  ",\"capture_threads\":%" SYS_PRId64 ",\"capture_busy\":{\"min\":%.9f,\"avg\":%.9f,\"max\":%.9f}"
+					  ",\"cooks\":%" SYS_PRId64 ",\"reinitializations\":%" SYS_PRId64 "}", 
+					  int64(CapturedPoints), int64(MinimumPointQueries.relaxedLoad()), int64(RaysSent.relaxedLoad()), 
+					  int64(Bindings), int64(MaxBindings), int64(UnboundPoints), int64(BVHsBuilt), int64(BVHsShared), int64(DeformedPoints), int64(CaptureMemory), Quantized ? "true" : "false", 
+					  QuantizeError, int64(numthreads), min_time, avg_time, max_time, int64(Cooks), int64(Reinitializations));
+}
+
+void
+CookStats::exportDetailAttribs(GU_Detail *gdp) const
+{
+	for (int phase = 0; phase < int(CookPhase::NumPhases); ++phase)
+	{
+		UT_WorkBuffer name;
+		name.sprintf("__cook_time_%s", phaseName(CookPhase(phase)));
+		GA_RWHandleD time_h(gdp->addFloatTuple(GA_ATTRIB_DETAIL, name.buffer(), 1, GA_Defaults(0.0), nullptr, nullptr, GA_STORE_REAL64));
+		time_h.set(GA_DETAIL_OFFSET, PhaseTimes[phase]);
+	}
+
+	const std::pair<const char *, exint> counters[] = {
+		{ "__cook_reinitialized", exint(Reinitialized) },
+		{ "__cook_incremental", exint(Incremental) },
+		{ "__cook_capture_file_read", exint(CaptureFileRead) },
+		{ "__cook_dirty_pages", DirtyPages },
+		{ "__cook_captured_points", CapturedPoints },
+		{ "__cook_minimum_point_queries", exint(MinimumPointQueries.relaxedLoad()) },
+		{ "__cook_rays_sent", exint(RaysSent.relaxedLoad()) },
+		{ "__cook_bindings", Bindings },
+		{ "__cook_max_bindings", MaxBindings },
+		{ "__cook_unbound_points", UnboundPoints },
+		{ "__cook_bvhs_built", BVHsBuilt },
+		{ "__cook_bvhs_shared", BVHsShared },
+		{ "__cook_deformed_points", DeformedPoints },
+		{ "__cook_capture_memory", exint(CaptureMemory) },
+		{ "__cook_quantized", exint(Quantized) },
+		{ "__cook_reinitializations", Reinitializations }
+	};
+	for (const auto &counter : counters)
+	{
+		GA_RWHandleID counter_h(gdp->addIntTuple(GA_ATTRIB_DETAIL, counter.first, 1, GA_Defaults(0), nullptr, nullptr, GA_STORE_INT64));
+		counter_h.set(GA_DETAIL_OFFSET, int64(counter.second));
+	}
+
+	exint numthreads;
+	fpreal64 min_time, avg_time, max_time;
+	captureBusyTimes(numthreads, min_time, avg_time, max_time);
+
+	GA_RWHandleID threads_h(gdp->addIntTuple(GA_ATTRIB_DETAIL, "__cook_capture_threads", 1, GA_Defaults(0), nullptr, nullptr, GA_STORE_INT64));
+	threads_h.set(GA_DETAIL_OFFSET, int64(numthreads));
+
+	const std::pair<const char *, fpreal64> values[] = {
+		{ "__cook_quantize_error", QuantizeError },
+		{ "__cook_capture_busy_min", min_time },
+		{ "__cook_capture_busy_avg", avg_time },
+		{ "__cook_capture_busy_max", max_time }
+	};
+	for (const auto &value : values)
+	{
+		GA_RWHandleD value_h(gdp->addFloatTuple(GA_ATTRIB_DETAIL, value.first, 1, GA_Defaults(0.0), nullptr, nullptr, GA_STORE_REAL64));
+		value_h.set(GA_DETAIL_OFFSET, value.second);
+	}
+}
+
+void
+CookStats::dumpJSON(const UT_StringHolder &nodepath) const
+{
+	const char *filename = std::getenv("POINTDEFORMBYPRIM_PROFILE_JSON");
+	if (!filename || !*filename)
+		return;
+
+	UT_WorkBuffer buf;
+	appendJSON(buf, nodepath);
+
+	// nodes may cook in parallel, keep the lines whole
+	static UT_Lock theFileLock;
+	UT_AutoLock lock(theFileLock);
+	std::ofstream file(filename, std::ios::app);
+	if (file)
+		file << buf.buffer() << "\n";
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef __Timer_h__
+#define __Timer_h__
+
+#include <SYS/SYS_AtomicInt.h>
+#include <SYS/SYS_Types.h>
+#include <UT/UT_StringHolder.h>
+#include <UT/UT_ThreadSpecificValue.h>
+#include <UT/UT_WorkBuffer.h>
+#include <chrono>
+
+class GU_Detail;
+
+namespace AKA
+{
+
+// Wall clock stopwatch in seconds.
+class Timer
+{
+public:
+	Timer() { start(); }
+
+	void start() { myStart = std::chrono::steady_clock::now(); }
+	fpreal64 elapsed() const;
+
+private:
+	std::chrono::steady_clock::time_point myStart;
+};
+
+enum class CookPhase
+{
+	TopologyValidation,
+	AttributeSetup,
+	BVHBuild,
+	Capture,
+	Deform,
+	DataIdBump,
+	NumPhases
+};
+
+// Capture query counters, accumulated privately by every capture job and
+// added to the cook stats once per job.
+struct CaptureCounters
+{
+	exint RaysSent = 0;
+	exint MinimumPointQueries = 0;
+};
+
+// Per cook phase timings and counters of the node. The timings and the
+// capture counters describe the last cook, Cooks and Reinitializations
+// accumulate over the lifetime of the node.
+struct CookStats
+{
+	void beginCook();
+	void addCaptureCounters(const CaptureCounters &counters);
+	// Adds the time the calling thread spent on a capture task.
+	void addCaptureBusyTime(fpreal64 time) { CaptureBusyTimes.get() += time; }
+	// Number of threads that ran capture tasks and their least, average
+	// and most busy time.
+	void captureBusyTimes(exint &numthreads, fpreal64 &min_time, fpreal64 &avg_time, fpreal64 &max_time) const;
+
+	// Adds the time since the timer started to the phase and restarts it.
+	void addPhaseTime(CookPhase phase, Timer &timer)
+	{
+		PhaseTimes[int(phase)] += timer.elapsed();
+		timer.start();
+	}
+
+	fpreal64 phaseTime(CookPhase phase) const { return PhaseTimes[int(phase)]; }
+	fpreal64 totalTime() const;
+
+	static const char *phaseName(CookPhase phase);
+
+	void appendText(UT_WorkBuffer &buf) const;
+	void appendJSON(UT_WorkBuffer &buf, const UT_StringHolder &nodepath) const;
+	void exportDetailAttribs(GU_Detail *gdp) const;
+
+	// Appends the stats as a single line of JSON to the file named by the
+	// POINTDEFORMBYPRIM_PROFILE_JSON environment variable, if it is set.
+	void dumpJSON(const UT_StringHolder &nodepath) const;
+
+	fpreal64 PhaseTimes[int(CookPhase::NumPhases)] = {};
+	bool Reinitialized = false;
+	bool Incremental = false;
+	bool CaptureFileRead = false;
+	exint DirtyPages = 0;
+	SYS_AtomicInt64 RaysSent;
+	SYS_AtomicInt64 MinimumPointQueries;
+	UT_ThreadSpecificValue<fpreal64> CaptureBusyTimes;
+	exint CapturedPoints = 0;
+	exint Bindings = 0;
+	exint MaxBindings = 0;
+	// captured points left without bindings by a radius capture
+	exint UnboundPoints = 0;
+	// rest lattice BVHs built by the capture and taken from the shared cache
+	exint BVHsBuilt = 0;
+	exint BVHsShared = 0;
+	exint DeformedPoints = 0;
+	int64 CaptureMemory = 0;
+	bool Quantized = false;
+	fpreal64 QuantizeError = 0.0;
+	exint Cooks = 0;
+	exint Reinitializations = 0;
+};
+
+} // end AKA
+
+#endif
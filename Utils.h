@@ -3,8 +3,10 @@
 #ifndef __Utils_h__
 #define __Utils_h__
 
+#include <UT/UT_Array.h>
 #include <UT/UT_Map.h>
 #include <UT/UT_String.h>
+#include <UT/UT_Vector3.h>
 
 class GA_ElementGroup;
 class GU_RayIntersect;
@@ -12,16 +14,11 @@ class GU_RayIntersect;
 namespace AKA
 {
 
+// Interned piece values of the rest lattice, mapped to dense piece ids.
 template<typename T>
-struct MapPrimGroup
+struct MapPieceId
 {
-	UT_Map<T, GA_PrimitiveGroup*> Map;
-};
-
-template<typename T>
-struct MapRay
-{
-	UT_Map<T, GU_RayIntersect*> Map;
+	UT_Map<T, int32> Map;
 };
 
 struct Gdps
@@ -41,10 +38,36 @@ struct CaptureAttributes
 	GA_Attribute *Xform = nullptr;
 };
 
+// Multi-sample ray directions around a captured point.
+enum class SamplePattern
+{
+	Cross,
+	Tetrahedron,
+	Octahedron,
+	Icosahedron,
+	FibonacciHemisphere
+};
+
+// Order the points are captured in, curves keep the points of a block
+// close together so their queries walk the same BVH nodes.
+enum class CaptureOrder
+{
+	Offset,
+	Morton,
+	Hilbert
+};
+
 struct CaptureAttributes_Info
 {
+	CaptureOrder Order = CaptureOrder::Offset;
 	bool CaptureMultiSamples = false;
 	fpreal32 CaptureMinDistThresh = 0.001f;
+	// bind up to MaxBindings primitives within CaptureRadius instead of
+	// the nearest one, needs the closest point BVH
+	bool RadiusCapture = false;
+	fpreal32 CaptureRadius = 0.f;
+	exint MaxBindings = 1;
+	UT_Array<UT_Vector3F> CaptureSampleDirs;
 	GA_RWHandleV3 RestP_H;
 	GA_RWHandleT<UT_ValArray<int32>> CapturePrims_H;
 	GA_RWHandleT<UT_ValArray<fpreal16>> CaptureUVWs_H;
@@ -0,0 +1,793 @@
+#include "Bvh.h"
+#include "CurveOrder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AKA_CORE_SSE2 1
+#endif
+
+using namespace AKA::Core;
+
+namespace
+{
+
+const int theNumBins = 16;
+const int32_t theMaxLeafSize = 8;
+// deeper nodes split at the median, which bounds the depth of the tree
+const int theMaxSahDepth = 32;
+// every 4-wide node pushes at most 3 more entries than it pops
+const int theStackSize = 256;
+const int64_t theParallelBinSize = 1 << 16;
+const int64_t theGrainSize = 4096;
+// cost of a node visit relative to a triangle test
+const float theTraversalCost = 1.f;
+const float theInfinity = std::numeric_limits<float>::infinity();
+const float theSeedSlack = 1e-4f;
+
+struct Bounds
+{
+	void extend(const Vec3 &p) { Min = minimum(Min, p); Max = maximum(Max, p); }
+	void extend(const Bounds &b) { Min = minimum(Min, b.Min); Max = maximum(Max, b.Max); }
+
+	float area() const
+	{
+		if (Min.X > Max.X)
+			return 0.f;
+		const Vec3 d = Max - Min;
+		return 2.f * (d.X * d.Y + d.Y * d.Z + d.Z * d.X);
+	}
+
+	Vec3 Min = Vec3(theInfinity);
+	Vec3 Max = Vec3(-theInfinity);
+};
+
+struct Bin
+{
+	Bounds Box;
+	Bounds Centroids;
+	int32_t Count = 0;
+};
+
+struct Bins
+{
+	void merge(const Bins &other)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int b = 0; b < theNumBins; ++b)
+			{
+				Axes[axis][b].Box.extend(other.Axes[axis][b].Box);
+				Axes[axis][b].Centroids.extend(other.Axes[axis][b].Centroids);
+				Axes[axis][b].Count += other.Axes[axis][b].Count;
+			}
+		}
+	}
+
+	Bin Axes[3][theNumBins];
+};
+
+// Binary node of the build, its children are at Left and Left + 1.
+struct BuildNode
+{
+	Bounds Box;
+	Bounds Centroids;
+	int32_t Begin = 0;
+	int32_t End = 0;
+	int32_t Left = -1;
+};
+
+struct StackEntry
+{
+	int32_t Child;
+	int32_t Count;
+	float Dist2;
+};
+
+inline Vec3
+binScale(const Bounds &centroids)
+{
+	Vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float extent = centroids.Max[axis] - centroids.Min[axis];
+		scale[axis] = extent > 0.f ? theNumBins / extent : 0.f;
+	}
+	return scale;
+}
+
+inline int
+binIndex(float c, float cmin, float scale)
+{
+	return std::min(int((c - cmin) * scale), theNumBins - 1);
+}
+
+// Squared distances from the position to the 4 child boxes of a node.
+inline void
+boxDist2(const float *minx, const float *miny, const float *minz,
+		 const float *maxx, const float *maxy, const float *maxz,
+		 const Vec3 &pos, float *dist2)
+{
+#ifdef AKA_CORE_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 px = _mm_set1_ps(pos.X);
+	const __m128 py = _mm_set1_ps(pos.Y);
+	const __m128 pz = _mm_set1_ps(pos.Z);
+	const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minx), px), _mm_sub_ps(px, _mm_loadu_ps(maxx))), zero);
+	const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(miny), py), _mm_sub_ps(py, _mm_loadu_ps(maxy))), zero);
+	const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minz), pz), _mm_sub_ps(pz, _mm_loadu_ps(maxz))), zero);
+	_mm_storeu_ps(dist2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+#else
+	for (int i = 0; i < 4; ++i)
+	{
+		const float dx = std::max(std::max(minx[i] - pos.X, pos.X - maxx[i]), 0.f);
+		const float dy = std::max(std::max(miny[i] - pos.Y, pos.Y - maxy[i]), 0.f);
+		const float dz = std::max(std::max(minz[i] - pos.Z, pos.Z - maxz[i]), 0.f);
+		dist2[i] = dx * dx + dy * dy + dz * dz;
+	}
+#endif
+}
+
+} // end namespace
+
+namespace AKA
+{
+namespace Core
+{
+
+// Ericson, Real-Time Collision Detection, 5.1.5
+Vec3
+closestPointOnTriangle(const Vec3 &p, const Vec3 &a, const Vec3 &b, const Vec3 &c, Vec3 &weights)
+{
+	const Vec3 ab = b - a;
+	const Vec3 ac = c - a;
+	const Vec3 ap = p - a;
+	const float d1 = dot(ab, ap);
+	const float d2 = dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f)
+	{
+		weights = Vec3(1.f, 0.f, 0.f);
+		return a;
+	}
+
+	const Vec3 bp = p - b;
+	const float d3 = dot(ab, bp);
+	const float d4 = dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3)
+	{
+		weights = Vec3(0.f, 1.f, 0.f);
+		return b;
+	}
+
+	const float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+	{
+		const float v = d1 / (d1 - d3);
+		weights = Vec3(1.f - v, v, 0.f);
+		return a + ab * v;
+	}
+
+	const Vec3 cp = p - c;
+	const float d5 = dot(ab, cp);
+	const float d6 = dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6)
+	{
+		weights = Vec3(0.f, 0.f, 1.f);
+		return c;
+	}
+
+	const float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+	{
+		const float w = d2 / (d2 - d6);
+		weights = Vec3(1.f - w, 0.f, w);
+		return a + ac * w;
+	}
+
+	const float va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+	{
+		const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		weights = Vec3(0.f, 1.f - w, w);
+		return b + (c - b) * w;
+	}
+
+	// degenerate triangles land here with a zero denominator
+	const float sum = va + vb + vc;
+	if (sum == 0.f)
+	{
+		weights = Vec3(1.f, 0.f, 0.f);
+		return a;
+	}
+	const float denom = 1.f / sum;
+	const float v = vb * denom;
+	const float w = vc * denom;
+	weights = Vec3(1.f - v - w, v, w);
+	return a + ab * v + ac * w;
+}
+
+// Builds the binary SAH tree over triangle indices and collapses it into
+// the 4-wide nodes of the BVH. The top of the tree is split serially with
+// parallel binning, the subtrees below it are built in parallel.
+struct BvhBuilder
+{
+	BvhBuilder(Bvh &bvh, Scheduler &scheduler) : myBvh(bvh), myScheduler(scheduler) {}
+
+	void run(const MeshView &mesh);
+
+private:
+	void triangulate(const MeshView &mesh);
+	void binRange(int32_t begin, int32_t end, const Bounds &centroids, const Vec3 &scale, Bins &bins) const;
+	void bin(const BuildNode &node, const Vec3 &scale, bool parallel, Bins &bins) const;
+	void computeBounds(BuildNode &node) const;
+	bool split(int32_t nodeidx, int depth, bool parallel);
+	void buildSubtree(int32_t nodeidx, int depth);
+	int32_t collapse(int32_t nodeidx);
+
+	Bvh &myBvh;
+	Scheduler &myScheduler;
+
+	std::vector<Bounds> myTriBounds;
+	std::vector<Vec3> myCentroids;
+	std::vector<int32_t> myIndices;
+
+	// sized for the largest tree up front, so subtrees allocate nodes
+	// from different threads without moving the others
+	std::vector<BuildNode> myBuildNodes;
+	std::atomic<int32_t> myNumBuildNodes{ 0 };
+};
+
+void
+BvhBuilder::triangulate(const MeshView &mesh)
+{
+	const int64_t numprims = mesh.numPrims();
+	std::vector<int32_t> tri_starts(numprims + 1);
+	tri_starts[0] = 0;
+	for (int64_t prim = 0; prim < numprims; ++prim)
+		tri_starts[prim + 1] = tri_starts[prim] + std::max(mesh.vertexCount(prim) - 2, 0);
+
+	std::vector<Bvh::Triangle> &triangles = myBvh.myTriangles;
+	triangles.resize(tri_starts[numprims]);
+	myScheduler.parallelFor(numprims, theGrainSize, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t prim = begin; prim < end; ++prim)
+		{
+			const Vec3 &p0 = mesh.Points[mesh.pointIndex(prim, 0)];
+			for (int32_t fan = 0; fan < tri_starts[prim + 1] - tri_starts[prim]; ++fan)
+			{
+				Bvh::Triangle &tri = triangles[tri_starts[prim] + fan];
+				tri.P0 = p0;
+				tri.P1 = mesh.Points[mesh.pointIndex(prim, fan + 1)];
+				tri.P2 = mesh.Points[mesh.pointIndex(prim, fan + 2)];
+				tri.Prim = int32_t(prim);
+				tri.Fan = fan;
+			}
+		}
+	});
+}
+
+void
+BvhBuilder::binRange(int32_t begin, int32_t end, const Bounds &centroids, const Vec3 &scale, Bins &bins) const
+{
+	for (int32_t i = begin; i < end; ++i)
+	{
+		const int32_t tri = myIndices[i];
+		const Vec3 &c = myCentroids[tri];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			Bin &bin = bins.Axes[axis][binIndex(c[axis], centroids.Min[axis], scale[axis])];
+			bin.Box.extend(myTriBounds[tri]);
+			bin.Centroids.extend(c);
+			++bin.Count;
+		}
+	}
+}
+
+void
+BvhBuilder::bin(const BuildNode &node, const Vec3 &scale, bool parallel, Bins &bins) const
+{
+	const int64_t count = node.End - node.Begin;
+	if (!parallel || count < 2 * theParallelBinSize || myScheduler.numThreads() < 2)
+	{
+		binRange(node.Begin, node.End, node.Centroids, scale, bins);
+		return;
+	}
+
+	const int64_t numchunks = std::min<int64_t>(count / theParallelBinSize, 4 * myScheduler.numThreads());
+	std::vector<Bins> chunk_bins(numchunks);
+	myScheduler.parallelFor(numchunks, 1, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t chunk = begin; chunk < end; ++chunk)
+		{
+			binRange(int32_t(node.Begin + count * chunk / numchunks),
+					 int32_t(node.Begin + count * (chunk + 1) / numchunks),
+					 node.Centroids, scale, chunk_bins[chunk]);
+		}
+	});
+	for (const Bins &chunk : chunk_bins)
+		bins.merge(chunk);
+}
+
+void
+BvhBuilder::computeBounds(BuildNode &node) const
+{
+	node.Box = Bounds();
+	node.Centroids = Bounds();
+	for (int32_t i = node.Begin; i < node.End; ++i)
+	{
+		node.Box.extend(myTriBounds[myIndices[i]]);
+		node.Centroids.extend(myCentroids[myIndices[i]]);
+	}
+}
+
+bool
+BvhBuilder::split(int32_t nodeidx, int depth, bool parallel)
+{
+	BuildNode &node = myBuildNodes[nodeidx];
+	const int32_t count = node.End - node.Begin;
+	if (count <= 1)
+		return false;
+
+	const Vec3 scale = binScale(node.Centroids);
+	const bool binnable = depth < theMaxSahDepth && (scale.X > 0.f || scale.Y > 0.f || scale.Z > 0.f);
+
+	int best_axis = -1, best_bin = 0;
+	float best_cost = theInfinity;
+	Bins bins;
+	if (binnable)
+	{
+		bin(node, scale, parallel, bins);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (scale[axis] <= 0.f)
+				continue;
+
+			// cost of the split after bin b is in left_costs[b]
+			const Bin *axis_bins = bins.Axes[axis];
+			float left_costs[theNumBins];
+			int32_t left_counts[theNumBins];
+			Bounds box;
+			int32_t sum = 0;
+			for (int b = 0; b < theNumBins - 1; ++b)
+			{
+				box.extend(axis_bins[b].Box);
+				sum += axis_bins[b].Count;
+				left_costs[b] = box.area() * sum;
+				left_counts[b] = sum;
+			}
+
+			box = Bounds();
+			sum = 0;
+			for (int b = theNumBins - 1; b > 0; --b)
+			{
+				box.extend(axis_bins[b].Box);
+				sum += axis_bins[b].Count;
+				if (!left_counts[b - 1] || !sum)
+					continue;
+
+				const float cost = left_costs[b - 1] + box.area() * sum;
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+
+		const float area = node.Box.area();
+		if (count <= theMaxLeafSize && theTraversalCost * area + best_cost >= area * count)
+			return false;
+	}
+
+	if (best_axis < 0 && count <= theMaxLeafSize)
+		return false;
+
+	const int32_t left = myNumBuildNodes.fetch_add(2);
+	BuildNode &left_node = myBuildNodes[left];
+	BuildNode &right_node = myBuildNodes[left + 1];
+	int32_t *indices = myIndices.data();
+	if (best_axis >= 0)
+	{
+		const float cmin = node.Centroids.Min[best_axis];
+		const float axis_scale = scale[best_axis];
+		int32_t *mid = std::partition(indices + node.Begin, indices + node.End, [&](int32_t tri)
+		{
+			return binIndex(myCentroids[tri][best_axis], cmin, axis_scale) < best_bin;
+		});
+
+		left_node.Begin = node.Begin;
+		left_node.End = int32_t(mid - indices);
+		right_node.Begin = left_node.End;
+		right_node.End = node.End;
+		for (int b = 0; b < theNumBins; ++b)
+		{
+			BuildNode &child = b < best_bin ? left_node : right_node;
+			child.Box.extend(bins.Axes[best_axis][b].Box);
+			child.Centroids.extend(bins.Axes[best_axis][b].Centroids);
+		}
+	}
+	else
+	{
+		// coincident centroids or too deep for SAH, split at the median
+		// of the widest axis
+		const Vec3 extent = node.Centroids.Max - node.Centroids.Min;
+		int axis = 0;
+		if (extent.Y > extent[axis])
+			axis = 1;
+		if (extent.Z > extent[axis])
+			axis = 2;
+
+		const int32_t mid = node.Begin + count / 2;
+		std::nth_element(indices + node.Begin, indices + mid, indices + node.End, [&](int32_t a, int32_t b)
+		{
+			return myCentroids[a][axis] < myCentroids[b][axis];
+		});
+
+		left_node.Begin = node.Begin;
+		left_node.End = mid;
+		right_node.Begin = mid;
+		right_node.End = node.End;
+		computeBounds(left_node);
+		computeBounds(right_node);
+	}
+
+	node.Left = left;
+	return true;
+}
+
+void
+BvhBuilder::buildSubtree(int32_t nodeidx, int depth)
+{
+	if (!split(nodeidx, depth, false))
+		return;
+
+	const int32_t left = myBuildNodes[nodeidx].Left;
+	buildSubtree(left, depth + 1);
+	buildSubtree(left + 1, depth + 1);
+}
+
+int32_t
+BvhBuilder::collapse(int32_t nodeidx)
+{
+	const int32_t node4idx = int32_t(myBvh.myNodes.size());
+	myBvh.myNodes.emplace_back();
+
+	// open the largest internal children until the node is full
+	int32_t children[4];
+	int numchildren = 0;
+	const BuildNode &node = myBuildNodes[nodeidx];
+	if (node.Left < 0)
+		children[numchildren++] = nodeidx;
+	else
+	{
+		children[numchildren++] = node.Left;
+		children[numchildren++] = node.Left + 1;
+		while (numchildren < 4)
+		{
+			int largest = -1;
+			float largest_area = -1.f;
+			for (int i = 0; i < numchildren; ++i)
+			{
+				const BuildNode &child = myBuildNodes[children[i]];
+				if (child.Left >= 0 && child.Box.area() > largest_area)
+				{
+					largest = i;
+					largest_area = child.Box.area();
+				}
+			}
+			if (largest < 0)
+				break;
+
+			const int32_t opened = myBuildNodes[children[largest]].Left;
+			children[largest] = opened;
+			children[numchildren++] = opened + 1;
+		}
+	}
+
+	Bvh::Node node4;
+	for (int i = 0; i < 4; ++i)
+	{
+		const Bounds box = i < numchildren ? myBuildNodes[children[i]].Box : Bounds();
+		node4.MinX[i] = box.Min.X;
+		node4.MinY[i] = box.Min.Y;
+		node4.MinZ[i] = box.Min.Z;
+		node4.MaxX[i] = box.Max.X;
+		node4.MaxY[i] = box.Max.Y;
+		node4.MaxZ[i] = box.Max.Z;
+		node4.Child[i] = -1;
+		node4.Count[i] = 0;
+	}
+
+	for (int i = 0; i < numchildren; ++i)
+	{
+		const BuildNode &child = myBuildNodes[children[i]];
+		if (child.Left < 0)
+		{
+			node4.Child[i] = child.Begin;
+			node4.Count[i] = child.End - child.Begin;
+		}
+		else
+			node4.Child[i] = collapse(children[i]);
+	}
+
+	myBvh.myNodes[node4idx] = node4;
+	return node4idx;
+}
+
+void
+BvhBuilder::run(const MeshView &mesh)
+{
+	triangulate(mesh);
+
+	const std::vector<Bvh::Triangle> &triangles = myBvh.myTriangles;
+	const int32_t numtris = int32_t(triangles.size());
+	if (!numtris)
+		return;
+
+	myTriBounds.resize(numtris);
+	myCentroids.resize(numtris);
+	myIndices.resize(numtris);
+	myScheduler.parallelFor(numtris, theGrainSize, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; ++i)
+		{
+			const Bvh::Triangle &tri = triangles[i];
+			Bounds &box = myTriBounds[i];
+			box = Bounds();
+			box.extend(tri.P0);
+			box.extend(tri.P1);
+			box.extend(tri.P2);
+			myCentroids[i] = (box.Min + box.Max) * 0.5f;
+			myIndices[i] = int32_t(i);
+		}
+	});
+
+	myBuildNodes.resize(2 * size_t(numtris));
+	myNumBuildNodes = 1;
+	BuildNode &root = myBuildNodes[0];
+	root.Begin = 0;
+	root.End = numtris;
+	computeBounds(root);
+
+	// split the top breadth first until there are enough subtrees to keep
+	// every thread busy
+	std::vector<std::pair<int32_t, int>> pending{ { 0, 0 } }, subtrees;
+	const size_t target = myScheduler.numThreads() > 1 ? size_t(4 * myScheduler.numThreads()) : 1;
+	for (size_t next = 0; next < pending.size(); ++next)
+	{
+		const int32_t nodeidx = pending[next].first;
+		const int depth = pending[next].second;
+		const BuildNode &node = myBuildNodes[nodeidx];
+		if (pending.size() - next + subtrees.size() >= target || node.End - node.Begin < theParallelBinSize)
+		{
+			subtrees.emplace_back(nodeidx, depth);
+			continue;
+		}
+
+		if (split(nodeidx, depth, true))
+		{
+			pending.emplace_back(myBuildNodes[nodeidx].Left, depth + 1);
+			pending.emplace_back(myBuildNodes[nodeidx].Left + 1, depth + 1);
+		}
+	}
+
+	myScheduler.parallelFor(int64_t(subtrees.size()), 1, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; ++i)
+			buildSubtree(subtrees[i].first, subtrees[i].second);
+	});
+
+	myBvh.myNodes.reserve(myNumBuildNodes / 2 + 1);
+	collapse(0);
+
+	// leaves index the triangles in the order of the build
+	std::vector<Bvh::Triangle> sorted(numtris);
+	myScheduler.parallelFor(numtris, theGrainSize, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; ++i)
+			sorted[i] = triangles[myIndices[i]];
+	});
+	myBvh.myTriangles.swap(sorted);
+}
+
+} // end Core
+} // end AKA
+
+void
+Bvh::clear()
+{
+	myTriangles.clear();
+	myNodes.clear();
+}
+
+void
+Bvh::build(const MeshView &mesh, Scheduler &scheduler)
+{
+	clear();
+	BvhBuilder(*this, scheduler).run(mesh);
+}
+
+bool
+Bvh::closestPoint(const Vec3 &pos, Hit &hit, float max_dist2) const
+{
+	hit = Hit();
+	hit.Dist2 = max_dist2;
+	if (myNodes.empty())
+		return false;
+
+	bool found = false;
+	StackEntry stack[theStackSize];
+	int stacksize = 0;
+	stack[stacksize++] = { 0, 0, 0.f };
+	while (stacksize)
+	{
+		const StackEntry entry = stack[--stacksize];
+		if (entry.Dist2 >= hit.Dist2)
+			continue;
+
+		if (entry.Count)
+		{
+			for (int32_t i = entry.Child; i < entry.Child + entry.Count; ++i)
+			{
+				const Triangle &tri = myTriangles[i];
+				Vec3 weights;
+				const Vec3 tri_pos = closestPointOnTriangle(pos, tri.P0, tri.P1, tri.P2, weights);
+				const float dist2 = length2(tri_pos - pos);
+				if (dist2 < hit.Dist2)
+				{
+					hit.Prim = tri.Prim;
+					hit.Triangle = tri.Fan;
+					hit.Weights = weights;
+					hit.Pos = tri_pos;
+					hit.Dist2 = dist2;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		const Node &node = myNodes[entry.Child];
+		float dist2[4];
+		boxDist2(node.MinX, node.MinY, node.MinZ, node.MaxX, node.MaxY, node.MaxZ, pos, dist2);
+
+		// push the children in range farthest first, so the nearest is
+		// visited next
+		StackEntry children[4];
+		int numchildren = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (node.Child[i] < 0 || dist2[i] >= hit.Dist2)
+				continue;
+
+			StackEntry child = { node.Child[i], node.Count[i], dist2[i] };
+			int j = numchildren++;
+			for (; j > 0 && children[j - 1].Dist2 < child.Dist2; --j)
+				children[j] = children[j - 1];
+			children[j] = child;
+		}
+		for (int i = 0; i < numchildren; ++i)
+			stack[stacksize++] = children[i];
+	}
+	return found;
+}
+
+bool
+Bvh::closestPoint(const Vec3 &pos, const Vec3 &seed, Hit &hit, float max_dist2) const
+{
+	// the seed lies on the mesh, so the nearest point is no further away,
+	// the slack keeps the seed's own triangle inside the strict bound
+	const float seed_dist2 = length2(seed - pos) * (1.f + theSeedSlack) + std::numeric_limits<float>::min();
+	if (seed_dist2 < max_dist2 && closestPoint(pos, hit, seed_dist2))
+		return true;
+	return closestPoint(pos, hit, max_dist2);
+}
+
+int
+Bvh::nearestPrims(const Vec3 &pos, float max_dist2, int max_hits, Hit *hits) const
+{
+	if (myNodes.empty() || max_hits < 1)
+		return 0;
+
+	int numhits = 0;
+	float bound = max_dist2;
+	StackEntry stack[theStackSize];
+	int stacksize = 0;
+	stack[stacksize++] = { 0, 0, 0.f };
+	while (stacksize)
+	{
+		const StackEntry entry = stack[--stacksize];
+		if (entry.Dist2 >= bound)
+			continue;
+
+		if (entry.Count)
+		{
+			for (int32_t i = entry.Child; i < entry.Child + entry.Count; ++i)
+			{
+				const Triangle &tri = myTriangles[i];
+				Vec3 weights;
+				const Vec3 tri_pos = closestPointOnTriangle(pos, tri.P0, tri.P1, tri.P2, weights);
+				const float dist2 = length2(tri_pos - pos);
+				if (dist2 >= bound)
+					continue;
+
+				// another fan triangle of the primitive may already be kept,
+				// otherwise the new hit takes the last slot
+				int slot = 0;
+				while (slot < numhits && hits[slot].Prim != tri.Prim)
+					++slot;
+				if (slot < numhits)
+				{
+					if (dist2 >= hits[slot].Dist2)
+						continue;
+				}
+				else if (numhits < max_hits)
+					slot = numhits++;
+				else
+					slot = numhits - 1;
+
+				for (; slot > 0 && hits[slot - 1].Dist2 > dist2; --slot)
+					hits[slot] = hits[slot - 1];
+				Hit &hit = hits[slot];
+				hit.Prim = tri.Prim;
+				hit.Triangle = tri.Fan;
+				hit.Weights = weights;
+				hit.Pos = tri_pos;
+				hit.Dist2 = dist2;
+
+				if (numhits == max_hits)
+					bound = hits[numhits - 1].Dist2;
+			}
+			continue;
+		}
+
+		const Node &node = myNodes[entry.Child];
+		float dist2[4];
+		boxDist2(node.MinX, node.MinY, node.MinZ, node.MaxX, node.MaxY, node.MaxZ, pos, dist2);
+
+		StackEntry children[4];
+		int numchildren = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (node.Child[i] < 0 || dist2[i] >= bound)
+				continue;
+
+			StackEntry child = { node.Child[i], node.Count[i], dist2[i] };
+			int j = numchildren++;
+			for (; j > 0 && children[j - 1].Dist2 < child.Dist2; --j)
+				children[j] = children[j - 1];
+			children[j] = child;
+		}
+		for (int i = 0; i < numchildren; ++i)
+			stack[stacksize++] = children[i];
+	}
+	return numhits;
+}
+
+void
+Bvh::closestPoints(Span<const Vec3> positions, Span<Hit> hits, float max_dist2, Curve curve) const
+{
+	std::vector<int64_t> order;
+	curveOrder(positions, curve, order);
+
+	const Hit *prev = nullptr;
+	for (int64_t idx : order)
+	{
+		if (prev)
+			closestPoint(positions[idx], prev->Pos, hits[idx], max_dist2);
+		else
+			closestPoint(positions[idx], hits[idx], max_dist2);
+		if (hits[idx].Prim >= 0)
+			prev = &hits[idx];
+	}
+}
+
+int64_t
+Bvh::getMemoryUsage() const
+{
+	return int64_t(myTriangles.capacity() * sizeof(Triangle) + myNodes.capacity() * sizeof(Node));
+}
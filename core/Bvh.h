@@ -0,0 +1,105 @@
+#pragma once
+
+#ifndef __Core_Bvh_h__
+#define __Core_Bvh_h__
+
+#include "CurveOrder.h"
+#include "Math.h"
+#include "Mesh.h"
+
+#include <limits>
+#include <vector>
+
+namespace AKA
+{
+namespace Core
+{
+
+class Scheduler;
+
+// Closest point BVH over the polygons of a mesh. Polygons are fanned into
+// triangles from their first corner, fan triangle t of a polygon spans its
+// corners 0, t + 1 and t + 2.
+//
+// The tree is built with binned SAH splits and collapsed into 4-wide nodes
+// kept in one contiguous array, a query tests the 4 boxes of a node at
+// once and descends into the nearest child first.
+class Bvh
+{
+public:
+	struct Hit
+	{
+		int32_t Prim = -1;
+		int32_t Triangle = -1;
+		// barycentric weights of the three corners of the fan triangle
+		Vec3 Weights;
+		Vec3 Pos;
+		float Dist2 = std::numeric_limits<float>::max();
+	};
+
+	void build(const MeshView &mesh, Scheduler &scheduler);
+	void clear();
+
+	bool empty() const { return myNodes.empty(); }
+	int64_t numNodes() const { return int64_t(myNodes.size()); }
+	int64_t numTriangles() const { return int64_t(myTriangles.size()); }
+
+	// Nearest point on the mesh within sqrt(max_dist2) of the position.
+	bool closestPoint(const Vec3 &pos, Hit &hit, float max_dist2 = std::numeric_limits<float>::max()) const;
+
+	// Nearest point with the search bounded by the distance to a point
+	// known to be on the mesh, usually the hit of the previous query of a
+	// coherent batch. The bound prunes most of the nodes a query from
+	// scratch would visit before it finds a close triangle.
+	bool closestPoint(const Vec3 &pos, const Vec3 &seed, Hit &hit, float max_dist2 = std::numeric_limits<float>::max()) const;
+
+	// Up to max_hits primitives within sqrt(max_dist2) of the position,
+	// nearest first, in one traversal bounded by the farthest kept hit once
+	// max_hits are found. A primitive is reported once, at its nearest fan
+	// triangle. Returns the number of hits written.
+	int nearestPrims(const Vec3 &pos, float max_dist2, int max_hits, Hit *hits) const;
+
+	// Closest points of a batch of positions, queried along the curve
+	// with the search of each seeded by the previous hit, so consecutive
+	// queries walk the same nodes. Positions with nothing in range get a
+	// hit with no primitive.
+	void closestPoints(Span<const Vec3> positions,
+					   Span<Hit> hits,
+					   float max_dist2 = std::numeric_limits<float>::max(),
+					   Curve curve = Curve::Morton) const;
+
+	int64_t getMemoryUsage() const;
+
+private:
+	struct Triangle
+	{
+		Vec3 P0, P1, P2;
+		int32_t Prim;
+		int32_t Fan;
+	};
+
+	// Boxes of the 4 children in SoA layout. Children with a count are
+	// leaves with the triangles [Child, Child + Count), the others are the
+	// nodes at index Child, unused children are -1 with an empty box.
+	struct Node
+	{
+		float MinX[4], MinY[4], MinZ[4];
+		float MaxX[4], MaxY[4], MaxZ[4];
+		int32_t Child[4];
+		int32_t Count[4];
+	};
+
+	friend struct BvhBuilder;
+
+	std::vector<Triangle> myTriangles;
+	std::vector<Node> myNodes;
+};
+
+// Closest point on triangle abc, returns the barycentric weights of the
+// corners.
+Vec3 closestPointOnTriangle(const Vec3 &p, const Vec3 &a, const Vec3 &b, const Vec3 &c, Vec3 &weights);
+
+} // end Core
+} // end AKA
+
+#endif
@@ -0,0 +1,189 @@
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace AKA::Core;
+
+// Build and closest point query benchmark of the core BVH on a synthetic
+// grid lattice, the queries the SOP captures triangle lattices with. Needs
+// no Houdini install or license.
+//
+// usage: pointdeformcore_benchmark [-points N] [-polys M] [-iterations I]
+//            [-curve morton|hilbert] [-threads 1,2,4,...]
+
+namespace
+{
+
+struct BenchmarkOptions
+{
+	int64_t NumPoints = 1000000;
+	int64_t NumPolys = 10000;
+	int Iterations = 5;
+	Curve CaptureCurve = Curve::Morton;
+	std::vector<int> ThreadCounts;
+};
+
+struct Grid
+{
+	std::vector<Vec3> Points;
+	std::vector<int32_t> PrimStarts;
+	std::vector<int32_t> Vertices;
+
+	MeshView view() const { return MeshView{ Points, PrimStarts, Vertices }; }
+};
+
+float
+latticeHeight(float x, float z, float phase)
+{
+	return 0.2f * std::sin(3.f * x + phase) * std::cos(2.f * z);
+}
+
+// Quad grid over [-1, 1] in x and z with about numpolys polygons.
+void
+buildGrid(int64_t numpolys, float phase, Grid &grid)
+{
+	const int32_t rows = std::max<int32_t>(1, int32_t(std::sqrt(double(numpolys))));
+	const int32_t cols = rows + 1;
+
+	grid.Points.clear();
+	for (int32_t j = 0; j < cols; ++j)
+	{
+		for (int32_t i = 0; i < cols; ++i)
+		{
+			const float x = -1.f + 2.f * i / rows;
+			const float z = -1.f + 2.f * j / rows;
+			grid.Points.emplace_back(x, latticeHeight(x, z, phase), z);
+		}
+	}
+
+	grid.PrimStarts.assign(1, 0);
+	grid.Vertices.clear();
+	for (int32_t j = 0; j < rows; ++j)
+	{
+		for (int32_t i = 0; i < rows; ++i)
+		{
+			const int32_t pt = j * cols + i;
+			grid.Vertices.insert(grid.Vertices.end(), { pt, pt + cols, pt + cols + 1, pt + 1 });
+			grid.PrimStarts.push_back(int32_t(grid.Vertices.size()));
+		}
+	}
+}
+
+double
+seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool
+parseOptions(int argc, char *argv[], BenchmarkOptions &options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (i + 1 >= argc)
+			return false;
+
+		const char *value = argv[++i];
+		if (!std::strcmp(argv[i - 1], "-points"))
+			options.NumPoints = std::atoll(value);
+		else if (!std::strcmp(argv[i - 1], "-polys"))
+			options.NumPolys = std::atoll(value);
+		else if (!std::strcmp(argv[i - 1], "-iterations"))
+			options.Iterations = std::atoi(value);
+		else if (!std::strcmp(argv[i - 1], "-curve"))
+		{
+			if (!std::strcmp(value, "morton"))
+				options.CaptureCurve = Curve::Morton;
+			else if (!std::strcmp(value, "hilbert"))
+				options.CaptureCurve = Curve::Hilbert;
+			else
+				return false;
+		}
+		else if (!std::strcmp(argv[i - 1], "-threads"))
+		{
+			for (const char *s = value; *s; )
+			{
+				options.ThreadCounts.push_back(std::atoi(s));
+				s = std::strchr(s, ',');
+				if (!s)
+					break;
+				++s;
+			}
+		}
+		else
+			return false;
+	}
+
+	if (options.ThreadCounts.empty())
+		options.ThreadCounts.push_back(0);
+	return options.NumPoints > 0 && options.NumPolys > 0 && options.Iterations > 0;
+}
+
+} // end namespace
+
+int
+main(int argc, char *argv[])
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		std::fprintf(stderr, "usage: %s [-points N] [-polys M] [-iterations I] [-curve morton|hilbert] [-threads 1,2,4,...]\n", argv[0]);
+		return 1;
+	}
+
+	Grid rest;
+	buildGrid(options.NumPolys, 0.f, rest);
+
+	std::mt19937 rng(5489u);
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	std::vector<Vec3> points(options.NumPoints);
+	for (Vec3 &p : points)
+	{
+		p.X = dist(rng);
+		p.Z = dist(rng);
+		p.Y = latticeHeight(p.X, p.Z, 0.f) + 0.1f * dist(rng);
+	}
+	std::vector<Bvh::Hit> hits(points.size());
+
+	std::printf("%lld points, %lld polygons\n", (long long)points.size(), (long long)rest.view().numPrims());
+	for (int num_threads : options.ThreadCounts)
+	{
+		ThreadPool pool(num_threads);
+		Bvh bvh;
+
+		double build_time = 0.0, query_time = 0.0;
+		for (int iter = 0; iter < options.Iterations; ++iter)
+		{
+			auto start = std::chrono::steady_clock::now();
+			bvh.build(rest.view(), pool);
+			build_time += seconds(start);
+
+			// the batch queries run serially, split them over the pool as
+			// the SOP splits its capture over its threads
+			start = std::chrono::steady_clock::now();
+			const int64_t grain = std::max<int64_t>(1024, int64_t(points.size()) / (8 * pool.numThreads()));
+			pool.parallelFor(int64_t(points.size()), grain, [&](int64_t begin, int64_t end)
+			{
+				bvh.closestPoints(Span<const Vec3>(points).subspan(begin, end - begin),
+								  Span<Bvh::Hit>(hits).subspan(begin, end - begin),
+								  std::numeric_limits<float>::max(), options.CaptureCurve);
+			});
+			query_time += seconds(start);
+		}
+
+		std::printf("threads %3d: build %8.3f ms, closest points %8.3f ms, memory %.1f MB\n",
+					pool.numThreads(),
+					1000.0 * build_time / options.Iterations,
+					1000.0 * query_time / options.Iterations,
+					double(bvh.getMemoryUsage()) / (1024.0 * 1024.0));
+	}
+	return 0;
+}
@@ -0,0 +1,251 @@
+#include "Bvh.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace AKA::Core;
+
+// Correctness checks of the core, the BVH queries against brute force over
+// every fan triangle and the frame math the SOP deforms with. Exits with
+// the number of failed checks.
+//
+// usage: pointdeformcore_tests
+
+namespace
+{
+
+int theFailures = 0;
+
+void
+check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+	std::printf("FAILED: %s\n", what);
+	++theFailures;
+}
+
+struct Mesh
+{
+	std::vector<Vec3> Points;
+	std::vector<int32_t> PrimStarts;
+	std::vector<int32_t> Vertices;
+
+	MeshView view() const { return MeshView{ Points, PrimStarts, Vertices }; }
+};
+
+// Jittered grid over [-1, 1] in x and z, quads with a triangle and a
+// pentagon in every row so every fan size is tested.
+void
+buildMesh(int32_t rows, std::mt19937 &rng, Mesh &mesh)
+{
+	std::uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+	const int32_t cols = rows + 1;
+	const float step = 2.f / rows;
+	for (int32_t j = 0; j < cols; ++j)
+	{
+		for (int32_t i = 0; i < cols; ++i)
+		{
+			const float x = -1.f + step * (i + (i % rows ? jitter(rng) : 0.f));
+			const float z = -1.f + step * (j + (j % rows ? jitter(rng) : 0.f));
+			mesh.Points.emplace_back(x, 0.2f * std::sin(3.f * x) * std::cos(2.f * z), z);
+		}
+	}
+
+	mesh.PrimStarts.assign(1, 0);
+	for (int32_t j = 0; j < rows; ++j)
+	{
+		for (int32_t i = 0; i < rows; ++i)
+		{
+			const int32_t pt = j * cols + i;
+			if (i == 0)
+				mesh.Vertices.insert(mesh.Vertices.end(), { pt, pt + cols, pt + cols + 1 });
+			else if (i == 1)
+			{
+				// also takes the upper triangle of the cell on its left
+				mesh.Vertices.insert(mesh.Vertices.end(), { pt - 1, pt + cols, pt + cols + 1, pt + 1, pt });
+			}
+			else
+				mesh.Vertices.insert(mesh.Vertices.end(), { pt, pt + cols, pt + cols + 1, pt + 1 });
+			mesh.PrimStarts.push_back(int32_t(mesh.Vertices.size()));
+		}
+	}
+}
+
+// Nearest distance of the position to every polygon of the mesh.
+void
+bruteForcePrimDists(const MeshView &mesh, const Vec3 &pos, std::vector<float> &dist2s)
+{
+	dist2s.assign(mesh.numPrims(), std::numeric_limits<float>::max());
+	for (int64_t prim = 0; prim < mesh.numPrims(); ++prim)
+	{
+		const Vec3 &p0 = mesh.Points[mesh.pointIndex(prim, 0)];
+		for (int32_t t = 0; t + 2 < mesh.vertexCount(prim); ++t)
+		{
+			Vec3 weights;
+			const Vec3 hit = closestPointOnTriangle(pos, p0, mesh.Points[mesh.pointIndex(prim, t + 1)],
+													mesh.Points[mesh.pointIndex(prim, t + 2)], weights);
+			dist2s[prim] = std::min(dist2s[prim], length2(hit - pos));
+		}
+	}
+}
+
+bool
+nearlyEqual(float a, float b)
+{
+	return std::abs(a - b) <= 1e-5f * std::max(1.f, std::max(std::abs(a), std::abs(b)));
+}
+
+bool
+nearlyEqual(const Vec3 &a, const Vec3 &b, float tolerance)
+{
+	return length2(a - b) <= tolerance * tolerance;
+}
+
+void
+randomPoints(int64_t count, std::mt19937 &rng, std::vector<Vec3> &points)
+{
+	std::uniform_real_distribution<float> coord(-1.2f, 1.2f);
+	std::uniform_real_distribution<float> height(-0.5f, 0.5f);
+	points.resize(count);
+	for (Vec3 &pos : points)
+		pos = Vec3(coord(rng), height(rng), coord(rng));
+}
+
+void
+testClosestPoint(const MeshView &mesh, const Bvh &bvh, const std::vector<Vec3> &points)
+{
+	std::vector<Bvh::Hit> batch(points.size());
+	bvh.closestPoints(points, batch);
+
+	std::vector<float> dist2s;
+	bool single_ok = true, seeded_ok = true, batch_ok = true, weights_ok = true;
+	for (size_t idx = 0; idx < points.size(); ++idx)
+	{
+		bruteForcePrimDists(mesh, points[idx], dist2s);
+		const float nearest = *std::min_element(dist2s.begin(), dist2s.end());
+
+		Bvh::Hit hit;
+		single_ok &= bvh.closestPoint(points[idx], hit) && nearlyEqual(hit.Dist2, nearest);
+
+		// the barycentric weights rebuild the hit position
+		const Vec3 pos = mesh.Points[mesh.pointIndex(hit.Prim, 0)] * hit.Weights.X +
+						 mesh.Points[mesh.pointIndex(hit.Prim, hit.Triangle + 1)] * hit.Weights.Y +
+						 mesh.Points[mesh.pointIndex(hit.Prim, hit.Triangle + 2)] * hit.Weights.Z;
+		weights_ok &= nearlyEqual(pos, hit.Pos, 1e-5f);
+
+		Bvh::Hit seeded_hit;
+		const Vec3 &seed = mesh.Points[idx % mesh.Points.size()];
+		seeded_ok &= bvh.closestPoint(points[idx], seed, seeded_hit) && nearlyEqual(seeded_hit.Dist2, nearest);
+
+		batch_ok &= batch[idx].Prim >= 0 && nearlyEqual(batch[idx].Dist2, nearest);
+	}
+	check(single_ok, "closestPoint matches brute force");
+	check(weights_ok, "closestPoint weights rebuild the hit");
+	check(seeded_ok, "seeded closestPoint matches brute force");
+	check(batch_ok, "closestPoints matches brute force");
+
+	Bvh::Hit hit;
+	check(!bvh.closestPoint(Vec3(10.f, 0.f, 0.f), hit, 1.f), "closestPoint finds nothing out of range");
+}
+
+void
+testNearestPrims(const MeshView &mesh, const Bvh &bvh, const std::vector<Vec3> &points)
+{
+	const int max_hits = 6;
+	const float max_dist2 = 0.3f * 0.3f;
+
+	std::vector<float> dist2s;
+	bool ok = true;
+	for (const Vec3 &pos : points)
+	{
+		bruteForcePrimDists(mesh, pos, dist2s);
+		std::vector<float> expected;
+		for (float dist2 : dist2s)
+		{
+			if (dist2 <= max_dist2)
+				expected.push_back(dist2);
+		}
+		std::sort(expected.begin(), expected.end());
+		expected.resize(std::min<size_t>(expected.size(), max_hits));
+
+		Bvh::Hit hits[max_hits];
+		const int numhits = bvh.nearestPrims(pos, max_dist2, max_hits, hits);
+		ok &= numhits == int(expected.size());
+		for (int i = 0; ok && i < numhits; ++i)
+		{
+			ok &= nearlyEqual(hits[i].Dist2, expected[i]) && nearlyEqual(dist2s[hits[i].Prim], hits[i].Dist2);
+			for (int j = 0; j < i; ++j)
+				ok &= hits[j].Prim != hits[i].Prim;
+		}
+	}
+	check(ok, "nearestPrims matches brute force");
+}
+
+void
+testFrames(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> coord(-1.f, 1.f);
+	bool orthonormal_ok = true, normal_ok = true, up_ok = true;
+	for (int i = 0; i < 1000; ++i)
+	{
+		const Vec3 nrm(coord(rng), coord(rng), coord(rng));
+		const Vec3 pos(coord(rng), coord(rng), coord(rng));
+		const Vec3 anchor(coord(rng), coord(rng), coord(rng));
+		if (length2(nrm) < 1e-2f || length2(pos - anchor) < 1e-2f)
+			continue;
+
+		const Vec3 up = bindingUp(normalize(nrm), pos, anchor);
+		if (length2(up) < 1e-2f)
+			continue;
+		const Mat3 frame = buildFrame(nrm, up);
+
+		// the transpose of a rotation is its inverse
+		const Mat3 inverse = transpose(frame);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			Vec3 unit;
+			unit[axis] = 1.f;
+			orthonormal_ok &= nearlyEqual(rowVecMult(rowVecMult(unit, frame), inverse), unit, 1e-5f);
+		}
+		normal_ok &= nearlyEqual(frame.Rows[2], normalize(nrm), 1e-5f);
+		up_ok &= std::abs(dot(frame.Rows[1], normalize(up)) - 1.f) <= 1e-4f;
+	}
+	check(orthonormal_ok, "buildFrame is a rotation");
+	check(normal_ok, "buildFrame keeps the normal as its z axis");
+	check(up_ok, "buildFrame keeps a tangent up vector as its y axis");
+
+	check(nearlyEqual(falloffWeight(0.f, 4.f), 1.f), "falloffWeight is 1 at the binding");
+	check(nearlyEqual(falloffWeight(4.f, 4.f), 0.f), "falloffWeight is 0 at the radius");
+	check(nearlyEqual(falloffWeight(9.f, 4.f), 0.f), "falloffWeight is 0 beyond the radius");
+	check(falloffWeight(1.f, 4.f) > falloffWeight(2.f, 4.f), "falloffWeight decreases with distance");
+}
+
+} // end namespace
+
+int
+main()
+{
+	std::mt19937 rng(7);
+	Mesh rest;
+	buildMesh(24, rng, rest);
+
+	std::vector<Vec3> points;
+	randomPoints(2000, rng, points);
+
+	ThreadPool pool(4);
+	Bvh bvh;
+	bvh.build(rest.view(), pool);
+
+	testClosestPoint(rest.view(), bvh, points);
+	testNearestPrims(rest.view(), bvh, points);
+	testFrames(rng);
+
+	if (!theFailures)
+		std::printf("all checks passed\n");
+	return theFailures;
+}
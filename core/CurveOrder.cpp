@@ -0,0 +1,149 @@
+#include "CurveOrder.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace AKA::Core;
+
+namespace
+{
+
+// Spreads the low 10 bits of v two bits apart.
+inline uint32_t
+expandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+inline uint32_t
+quantize(float v, float bmin, float scale)
+{
+	const float q = (v - bmin) * scale;
+	return uint32_t(std::min(std::max(q, 0.f), 1023.f));
+}
+
+// LSD radix sort of the indices by 30 bit keys, 3 passes of 10 bits.
+void
+radixSort(std::vector<uint32_t> &keys, std::vector<int64_t> &order)
+{
+	const size_t n = keys.size();
+	std::vector<uint32_t> tmp_keys(n);
+	std::vector<int64_t> tmp_order(n);
+	for (int shift = 0; shift < 30; shift += 10)
+	{
+		size_t counts[1025] = {};
+		for (size_t i = 0; i < n; ++i)
+			++counts[((keys[i] >> shift) & 1023u) + 1];
+		for (int b = 0; b < 1024; ++b)
+			counts[b + 1] += counts[b];
+		for (size_t i = 0; i < n; ++i)
+		{
+			const size_t dst = counts[(keys[i] >> shift) & 1023u]++;
+			tmp_keys[dst] = keys[i];
+			tmp_order[dst] = order[i];
+		}
+		keys.swap(tmp_keys);
+		order.swap(tmp_order);
+	}
+}
+
+} // end namespace
+
+namespace AKA
+{
+namespace Core
+{
+
+uint32_t
+mortonCode(const Vec3 &pos, const Vec3 &bmin, const Vec3 &scale)
+{
+	return (expandBits(quantize(pos.X, bmin.X, scale.X)) << 2) |
+		   (expandBits(quantize(pos.Y, bmin.Y, scale.Y)) << 1) |
+		   expandBits(quantize(pos.Z, bmin.Z, scale.Z));
+}
+
+// Skilling, Programming the Hilbert curve, 2004. The axes are turned into
+// the transposed Hilbert index, whose interleaved bits are the index.
+uint32_t
+hilbertCode(const Vec3 &pos, const Vec3 &bmin, const Vec3 &scale)
+{
+	uint32_t x[3] = { quantize(pos.X, bmin.X, scale.X),
+					  quantize(pos.Y, bmin.Y, scale.Y),
+					  quantize(pos.Z, bmin.Z, scale.Z) };
+
+	const uint32_t m = 1u << 9;
+	for (uint32_t q = m; q > 1; q >>= 1)
+	{
+		const uint32_t p = q - 1;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (x[i] & q)
+				x[0] ^= p;
+			else
+			{
+				const uint32_t t = (x[0] ^ x[i]) & p;
+				x[0] ^= t;
+				x[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	x[1] ^= x[0];
+	x[2] ^= x[1];
+	uint32_t t = 0;
+	for (uint32_t q = m; q > 1; q >>= 1)
+	{
+		if (x[2] & q)
+			t ^= q - 1;
+	}
+	for (int i = 0; i < 3; ++i)
+		x[i] ^= t;
+
+	return (expandBits(x[0]) << 2) | (expandBits(x[1]) << 1) | expandBits(x[2]);
+}
+
+void
+curveOrder(Span<const Vec3> positions, Curve curve, std::vector<int64_t> &order)
+{
+	const int64_t n = positions.size();
+	order.resize(n);
+	for (int64_t i = 0; i < n; ++i)
+		order[i] = i;
+	if (n < 2)
+		return;
+
+	Vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+	for (const Vec3 &pos : positions)
+	{
+		bmin = minimum(bmin, pos);
+		bmax = maximum(bmax, pos);
+	}
+
+	Vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float extent = bmax[axis] - bmin[axis];
+		scale[axis] = extent > 0.f ? 1024.f / extent : 0.f;
+	}
+
+	std::vector<uint32_t> keys(n);
+	if (curve == Curve::Hilbert)
+	{
+		for (int64_t i = 0; i < n; ++i)
+			keys[i] = hilbertCode(positions[i], bmin, scale);
+	}
+	else
+	{
+		for (int64_t i = 0; i < n; ++i)
+			keys[i] = mortonCode(positions[i], bmin, scale);
+	}
+	radixSort(keys, order);
+}
+
+} // end Core
+} // end AKA
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef __Core_CurveOrder_h__
+#define __Core_CurveOrder_h__
+
+#include "Math.h"
+#include "Span.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace AKA
+{
+namespace Core
+{
+
+// Space filling curves to order positions by. The Hilbert curve never
+// jumps across the bounds like the Morton curve does, at a higher cost
+// per code.
+enum class Curve
+{
+	Morton,
+	Hilbert
+};
+
+// 30 bit codes of a position along the curves, 10 bits per axis of its
+// place inside the bounds given by their minimum and 1024 over their
+// extent.
+uint32_t mortonCode(const Vec3 &pos, const Vec3 &bmin, const Vec3 &scale);
+uint32_t hilbertCode(const Vec3 &pos, const Vec3 &bmin, const Vec3 &scale);
+
+// Indices of the positions in the order of their codes along the curve
+// within the bounds of all the positions. Queries made in that order are
+// spatially coherent and walk the same nodes of a BVH one after another.
+void curveOrder(Span<const Vec3> positions, Curve curve, std::vector<int64_t> &order);
+
+} // end Core
+} // end AKA
+
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+
+#ifndef __Core_Math_h__
+#define __Core_Math_h__
+
+#include <algorithm>
+#include <cmath>
+
+namespace AKA
+{
+namespace Core
+{
+
+struct Vec3
+{
+	Vec3() = default;
+	explicit Vec3(float v) : X(v), Y(v), Z(v) {}
+	Vec3(float x, float y, float z) : X(x), Y(y), Z(z) {}
+
+	float &operator[](int i) { return (&X)[i]; }
+	float operator[](int i) const { return (&X)[i]; }
+
+	Vec3 &operator+=(const Vec3 &v) { X += v.X; Y += v.Y; Z += v.Z; return *this; }
+	Vec3 &operator-=(const Vec3 &v) { X -= v.X; Y -= v.Y; Z -= v.Z; return *this; }
+	Vec3 &operator*=(float s) { X *= s; Y *= s; Z *= s; return *this; }
+
+	float X = 0.f;
+	float Y = 0.f;
+	float Z = 0.f;
+};
+
+inline Vec3 operator+(const Vec3 &a, const Vec3 &b) { return Vec3(a.X + b.X, a.Y + b.Y, a.Z + b.Z); }
+inline Vec3 operator-(const Vec3 &a, const Vec3 &b) { return Vec3(a.X - b.X, a.Y - b.Y, a.Z - b.Z); }
+inline Vec3 operator-(const Vec3 &a) { return Vec3(-a.X, -a.Y, -a.Z); }
+inline Vec3 operator*(const Vec3 &a, float s) { return Vec3(a.X * s, a.Y * s, a.Z * s); }
+
+inline float dot(const Vec3 &a, const Vec3 &b) { return a.X * b.X + a.Y * b.Y + a.Z * b.Z; }
+inline float length2(const Vec3 &a) { return dot(a, a); }
+inline float length(const Vec3 &a) { return std::sqrt(dot(a, a)); }
+
+inline Vec3
+cross(const Vec3 &a, const Vec3 &b)
+{
+	return Vec3(a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z, a.X * b.Y - a.Y * b.X);
+}
+
+// Zero length vectors are left as they are, like UT_Vector3::normalize().
+inline Vec3
+normalize(const Vec3 &a)
+{
+	const float len = length(a);
+	return len > 0.f ? a * (1.f / len) : a;
+}
+
+inline Vec3 minimum(const Vec3 &a, const Vec3 &b) { return Vec3(std::min(a.X, b.X), std::min(a.Y, b.Y), std::min(a.Z, b.Z)); }
+inline Vec3 maximum(const Vec3 &a, const Vec3 &b) { return Vec3(std::max(a.X, b.X), std::max(a.Y, b.Y), std::max(a.Z, b.Z)); }
+
+// 3x3 matrix applied to row vectors, as UT_Matrix3 is.
+struct Mat3
+{
+	Mat3() = default;
+	Mat3(const Vec3 &x, const Vec3 &y, const Vec3 &z) : Rows{ x, y, z } {}
+
+	Vec3 Rows[3] = { Vec3(1.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f), Vec3(0.f, 0.f, 1.f) };
+};
+
+inline Vec3
+rowVecMult(const Vec3 &v, const Mat3 &m)
+{
+	return m.Rows[0] * v.X + m.Rows[1] * v.Y + m.Rows[2] * v.Z;
+}
+
+inline Mat3
+transpose(const Mat3 &m)
+{
+	return Mat3(Vec3(m.Rows[0].X, m.Rows[1].X, m.Rows[2].X),
+				Vec3(m.Rows[0].Y, m.Rows[1].Y, m.Rows[2].Y),
+				Vec3(m.Rows[0].Z, m.Rows[1].Z, m.Rows[2].Z));
+}
+
+// Rotation whose rows are the frame axes built from a normal and an up
+// vector. Capture and deform must use the same construction so the rest
+// and deformed frames match.
+inline Mat3
+buildFrame(const Vec3 &nrm, const Vec3 &up)
+{
+	const Vec3 zaxis = normalize(nrm);
+	const Vec3 xaxis = normalize(cross(up, zaxis));
+	const Vec3 yaxis = cross(zaxis, xaxis);
+	return Mat3(xaxis, yaxis, zaxis);
+}
+
+// Up vector of a binding, tangent to its polygon and pointing away from
+// the polygon's anchor corner.
+inline Vec3
+bindingUp(const Vec3 &prim_nrm, const Vec3 &pos, const Vec3 &anchor)
+{
+	return cross(prim_nrm, normalize(pos - anchor));
+}
+
+// Smooth falloff weight of a binding at squared distance dist2 within a
+// radius, 1 at the position and 0 at the radius.
+inline float
+falloffWeight(float dist2, float radius2)
+{
+	const float t = std::max(1.f - dist2 / radius2, 0.f);
+	return t * t;
+}
+
+} // end Core
+} // end AKA
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#ifndef __Core_Mesh_h__
+#define __Core_Mesh_h__
+
+#include "Math.h"
+#include "Span.h"
+
+namespace AKA
+{
+namespace Core
+{
+
+// Polygon mesh given as flat arrays, in the layout most tools already keep
+// their geometry in. The vertices of polygon i are
+// Vertices[PrimStarts[i]] up to Vertices[PrimStarts[i + 1]], so PrimStarts
+// holds one more entry than there are polygons.
+struct MeshView
+{
+	int64_t numPrims() const { return PrimStarts.empty() ? 0 : PrimStarts.size() - 1; }
+	int32_t vertexCount(int64_t prim) const { return PrimStarts[prim + 1] - PrimStarts[prim]; }
+	int32_t pointIndex(int64_t prim, int32_t vtx) const { return Vertices[PrimStarts[prim] + vtx]; }
+
+	Span<const Vec3> Points;
+	Span<const int32_t> PrimStarts;
+	Span<const int32_t> Vertices;
+};
+
+} // end Core
+} // end AKA
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef __Core_Span_h__
+#define __Core_Span_h__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace AKA
+{
+namespace Core
+{
+
+// Non-owning view of a contiguous array, the data is owned by the caller
+// for as long as the view is used.
+template<typename T>
+class Span
+{
+public:
+	Span() = default;
+	Span(T *data, int64_t size) : myData(data), mySize(size) {}
+	template<typename U>
+	Span(std::vector<U> &v) : myData(v.data()), mySize(int64_t(v.size())) {}
+	template<typename U>
+	Span(const std::vector<U> &v) : myData(v.data()), mySize(int64_t(v.size())) {}
+
+	T *data() const { return myData; }
+	int64_t size() const { return mySize; }
+	bool empty() const { return mySize == 0; }
+
+	T &operator[](int64_t i) const { return myData[i]; }
+	T *begin() const { return myData; }
+	T *end() const { return myData + mySize; }
+
+	Span subspan(int64_t offset, int64_t count) const { return Span(myData + offset, count); }
+
+private:
+	T *myData = nullptr;
+	int64_t mySize = 0;
+};
+
+} // end Core
+} // end AKA
+
+#endif
@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace AKA::Core;
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+	myWorkers.reserve(num_threads - 1);
+	for (int i = 1; i < num_threads; ++i)
+		myWorkers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myStop = true;
+	}
+	myWake.notify_all();
+	for (std::thread &worker : myWorkers)
+		worker.join();
+}
+
+void
+ThreadPool::parallelFor(int64_t size, int64_t grain, const Body &body)
+{
+	if (size <= 0)
+		return;
+
+	grain = std::max<int64_t>(grain, 1);
+	if (myWorkers.empty() || size <= grain)
+	{
+		body(0, size);
+		return;
+	}
+
+	std::lock_guard<std::mutex> run_lock(myRunMutex);
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myBody = &body;
+		mySize = size;
+		myGrain = grain;
+		myNextBlock.store(0, std::memory_order_relaxed);
+		myBusyWorkers = int(myWorkers.size());
+		++myGeneration;
+	}
+	myWake.notify_all();
+
+	runBlocks();
+
+	// the body and the loop bounds must outlive every worker using them
+	std::unique_lock<std::mutex> lock(myMutex);
+	myDone.wait(lock, [this] { return myBusyWorkers == 0; });
+	myBody = nullptr;
+}
+
+void
+ThreadPool::workerLoop()
+{
+	uint64_t generation = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(myMutex);
+			myWake.wait(lock, [&] { return myStop || myGeneration != generation; });
+			if (myStop)
+				return;
+			generation = myGeneration;
+		}
+
+		runBlocks();
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(myMutex);
+			last = --myBusyWorkers == 0;
+		}
+		if (last)
+			myDone.notify_one();
+	}
+}
+
+void
+ThreadPool::runBlocks()
+{
+	const int64_t num_blocks = (mySize + myGrain - 1) / myGrain;
+	for (int64_t block = myNextBlock.fetch_add(1, std::memory_order_relaxed);
+		 block < num_blocks;
+		 block = myNextBlock.fetch_add(1, std::memory_order_relaxed))
+	{
+		const int64_t begin = block * myGrain;
+		(*myBody)(begin, std::min(begin + myGrain, mySize));
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef __Core_ThreadPool_h__
+#define __Core_ThreadPool_h__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AKA
+{
+namespace Core
+{
+
+// Runs the parallel loops of the core. ThreadPool is the default, hosts
+// with a scheduler of their own wrap it instead of oversubscribing the
+// machine with a second set of threads.
+class Scheduler
+{
+public:
+	using Body = std::function<void(int64_t begin, int64_t end)>;
+
+	virtual ~Scheduler() = default;
+
+	// Number of threads running a loop, the calling thread included.
+	virtual int numThreads() const = 0;
+
+	// Calls body over [0, size) in blocks of about grain items, returns
+	// once every block is done. Loops are not reentrant, a body must not
+	// start another loop on the same scheduler.
+	virtual void parallelFor(int64_t size, int64_t grain, const Body &body) = 0;
+};
+
+// Fixed set of worker threads running one parallel loop at a time. The
+// calling thread takes blocks of the loop too, so a pool of one thread
+// runs everything inline.
+class ThreadPool : public Scheduler
+{
+public:
+	// 0 threads picks the hardware concurrency.
+	explicit ThreadPool(int num_threads = 0);
+	~ThreadPool() override;
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	int numThreads() const override { return int(myWorkers.size()) + 1; }
+	void parallelFor(int64_t size, int64_t grain, const Body &body) override;
+
+private:
+	void workerLoop();
+	void runBlocks();
+
+	std::vector<std::thread> myWorkers;
+
+	// serializes loops started from different threads
+	std::mutex myRunMutex;
+
+	std::mutex myMutex;
+	std::condition_variable myWake;
+	std::condition_variable myDone;
+	uint64_t myGeneration = 0;
+	int myBusyWorkers = 0;
+	bool myStop = false;
+
+	const Body *myBody = nullptr;
+	int64_t mySize = 0;
+	int64_t myGrain = 1;
+	std::atomic<int64_t> myNextBlock{ 0 };
+};
+
+} // end Core
+} // end AKA
+
+#endif